@@ -24,16 +24,29 @@
  * #ChamplainFileCache is a cache that stores and retrieves tiles from the
  * file system. Tiles most frequently loaded gain in "popularity". This popularity
  * is taken into account when purging the cache.
+ *
+ * By default every tile is stored in its own file. With the
+ * %CHAMPLAIN_FILE_CACHE_STORAGE_DATABASE #ChamplainFileCache:storage the
+ * tiles are stored in SQLite databases instead, one
+ * <filename>&lt;map source id&gt;.mbtiles</filename> file per map source in
+ * the cache directory. The databases use the MBTiles schema (with a few
+ * extra columns for the cache metadata) so they can be read by other
+ * MBTiles tools. Loading a tile then costs a single indexed lookup instead
+ * of a file system lookup, open and read plus a database query.
  */
 
 #define DEBUG_FLAG CHAMPLAIN_DEBUG_CACHE
 #include "champlain-debug.h"
 
 #include "champlain-file-cache.h"
+#include "champlain-enum-types.h"
+#include "champlain-private.h"
+#include "champlain-marshal.h"
 
 #include <sqlite3.h>
 #include <errno.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <gio/gio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -43,32 +56,204 @@ G_DEFINE_TYPE (ChamplainFileCache, champlain_file_cache, CHAMPLAIN_TYPE_TILE_CAC
 #define GET_PRIVATE(obj) \
   (G_TYPE_INSTANCE_GET_PRIVATE ((obj), CHAMPLAIN_TYPE_FILE_CACHE, ChamplainFileCachePrivate))
 
+/* Size of the buffers get_filename() writes to */
+#define FILENAME_SIZE 4096
+
+/* How long stored tiles wait for more to write them in one transaction */
+#define WRITE_DELAY 500
+
+/* How often the popularity of the displayed tiles is written, in seconds */
+#define POPULARITY_INTERVAL 10
+
+/* The purge deletes PURGE_CHUNK tiles at a time for at most PURGE_SLICE ms
+ * before letting the other jobs run */
+#define PURGE_CHUNK 32
+#define PURGE_SLICE 50
+
+/* Background revalidations of expired tiles running at the same time and
+ * waiting to run at most */
+#define MAX_REVALIDATIONS 2
+#define MAX_QUEUED_REVALIDATIONS 256
+
+enum
+{
+  /* normal signals */
+  PURGE_PROGRESS,
+  PURGE_COMPLETED,
+  LAST_SIGNAL
+};
+
+static guint champlain_file_cache_signals[LAST_SIGNAL] = { 0, };
+
 enum
 {
   PROP_0,
   PROP_SIZE_LIMIT,
-  PROP_CACHE_DIR
+  PROP_CACHE_DIR,
+  PROP_STORAGE,
+  PROP_LOW_WATER_MARK,
+  PROP_STALE_WHILE_REVALIDATE
 };
 
 struct _ChamplainFileCachePrivate
 {
   guint size_limit;
+  guint low_water_mark;
   gchar *cache_dir;
+  ChamplainFileCacheStorage storage;
+  gboolean purging;
 
+  /* CHAMPLAIN_FILE_CACHE_STORAGE_FILES */
   sqlite3 *db;
-  sqlite3_stmt *stmt_select;
-  sqlite3_stmt *stmt_update;
+
+  /* Disk I/O which can block - used only from the worker thread */
+  GThreadPool *worker;
+  sqlite3 *worker_db;
+  sqlite3_stmt *stmt_worker_select;
+  sqlite3_stmt *stmt_worker_store;
+  sqlite3_stmt *stmt_worker_popularity;
+  sqlite3_stmt *stmt_worker_modified;
+  sqlite3_stmt *stmt_worker_missing;
+  sqlite3_stmt *stmt_worker_store_missing;
+  sqlite3_stmt *stmt_worker_delete_missing;
+  sqlite3_stmt *stmt_worker_purge;
+  sqlite3_stmt *stmt_worker_delete;
+  gint64 popularity_base;
+  gint64 purged_popularity;
+
+  /* The size of the written tiles, kept up to date by the worker */
+  guint64 total_size;
+
+  /* Stored tiles not written yet, ChamplainTileKey -> WorkerJob. New stores
+   * go to pending, the worker moves them to writing while it writes them. */
+  GMutex *lock;
+  GCond *flushed;
+  GHashTable *pending;
+  GHashTable *writing;
+  guint write_source_id;
+
+  /* Popularity gained by the tiles displayed since the last update,
+   * ChamplainTileKey -> WorkerJob */
+  GHashTable *popularity;
+  guint popularity_source_id;
+
+  /* CHAMPLAIN_FILE_CACHE_STORAGE_DATABASE, interned map source id -> TileStore */
+  GHashTable *stores;
+
+  /* Expired tiles being revalidated, ChamplainTileKey -> Revalidation */
+  gboolean stale_while_revalidate;
+  GHashTable *revalidations;
+  GQueue *revalidation_queue;
+  guint revalidations_running;
+  guint revalidate_source_id;
 };
 
+/* An MBTiles database holding the tiles of one map source. The tile data
+ * are stored once per content hash in images, referenced by the map rows
+ * of all the tiles having the content. */
+typedef struct
+{
+  sqlite3 *db;
+  sqlite3_stmt *stmt_select;
+  sqlite3_stmt *stmt_store;
+  sqlite3_stmt *stmt_popularity;
+  sqlite3_stmt *stmt_modified;
+  sqlite3_stmt *stmt_purge;
+  sqlite3_stmt *stmt_delete;
+  sqlite3_stmt *stmt_ref;
+  sqlite3_stmt *stmt_insert_image;
+  sqlite3_stmt *stmt_unref;
+  sqlite3_stmt *stmt_orphan;
+  sqlite3_stmt *stmt_delete_image;
+  sqlite3_stmt *stmt_missing;
+  sqlite3_stmt *stmt_store_missing;
+  sqlite3_stmt *stmt_delete_missing;
+  gint64 popularity_base;
+  gint64 purged_popularity;
+} TileStore;
+
+typedef enum
+{
+  JOB_LOAD,
+  JOB_LOAD_MISSING,
+  JOB_STORE_MISSING,
+  JOB_REFRESH,
+  JOB_POPULARITY,
+  JOB_STORE,
+  JOB_WRITE,
+  JOB_FLUSH,
+  JOB_PURGE,
+  JOB_OPEN_STORES
+} JobType;
+
+/* A request for the worker thread. The worker uses only the copied tile
+ * coordinates and filename; the tile and the cache are referenced by the
+ * jobs with a callback, which is run in the main loop once the job is done
+ * and which frees the job. */
+typedef struct
+{
+  JobType type;
+  ChamplainFileCache *file_cache;
+  ChamplainTile *tile;
+  GSourceFunc callback;
+
+  const gchar *source_id;
+  guint zoom_level;
+  guint x;
+  guint y;
+  ChamplainTileKey key;
+  gchar *filename;
+
+  /* The tiles of a JOB_POPULARITY batch and the popularity they gained */
+  GList *jobs;
+  guint popularity;
+
+  /* JOB_PURGE starts over limit and deletes tiles down to target */
+  guint64 limit;
+  guint64 target;
+  guint64 freed;
+
+  /* In for JOB_STORE, out for JOB_LOAD */
+  gchar *data;
+  gsize size;
+  gchar *etag;
+  GTimeVal modified_time;
+  GTimeVal expire_time;
+  gboolean found;
+  gboolean missing; /* the tile source has no data for the tile */
+} WorkerJob;
+
+/* A displayed expired tile and the tile the next source validates in the
+ * background */
+typedef struct
+{
+  ChamplainTileKey key;
+  ChamplainFileCache *file_cache;
+  ChamplainTile *tile;
+  ChamplainTile *revalidation;
+  gboolean updated;
+} Revalidation;
+
 static void finalize_sql (ChamplainFileCache *file_cache);
 static void init_cache (ChamplainFileCache *file_cache);
-static gchar *get_filename (ChamplainFileCache *file_cache,
-    ChamplainTile *tile);
+static gboolean get_filename (ChamplainFileCache *file_cache,
+    ChamplainTile *tile,
+    gchar *filename);
 static gboolean tile_is_expired (ChamplainFileCache *file_cache,
     ChamplainTile *tile);
-static void delete_tile (ChamplainFileCache *file_cache,
-    const gchar *filename);
 static gboolean create_cache_dir (const gchar *dir_name);
+static void close_store (TileStore *store);
+static void worker_thread (WorkerJob *job,
+    ChamplainFileCache *file_cache);
+static WorkerJob *new_job (ChamplainFileCache *file_cache,
+    JobType type,
+    ChamplainTile *tile);
+static void free_job (WorkerJob *job);
+static void push_job (ChamplainFileCache *file_cache,
+    WorkerJob *job);
+static void update_popularity (ChamplainFileCache *file_cache);
+static void free_revalidation (Revalidation *revalidation);
+static gboolean revalidate_on_idle (ChamplainFileCache *file_cache);
 
 static void fill_tile (ChamplainMapSource *map_source,
     ChamplainTile *tile);
@@ -81,6 +266,8 @@ static void refresh_tile_time (ChamplainTileCache *tile_cache,
     ChamplainTile *tile);
 static void on_tile_filled (ChamplainTileCache *tile_cache,
     ChamplainTile *tile);
+static void store_missing_tile (ChamplainTileCache *tile_cache,
+    ChamplainTile *tile);
 
 static void
 champlain_file_cache_get_property (GObject *object,
@@ -100,6 +287,18 @@ champlain_file_cache_get_property (GObject *object,
       g_value_set_string (value, champlain_file_cache_get_cache_dir (file_cache));
       break;
 
+    case PROP_STORAGE:
+      g_value_set_enum (value, champlain_file_cache_get_storage (file_cache));
+      break;
+
+    case PROP_LOW_WATER_MARK:
+      g_value_set_uint (value, champlain_file_cache_get_low_water_mark (file_cache));
+      break;
+
+    case PROP_STALE_WHILE_REVALIDATE:
+      g_value_set_boolean (value, champlain_file_cache_get_stale_while_revalidate (file_cache));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -127,6 +326,18 @@ champlain_file_cache_set_property (GObject *object,
       priv->cache_dir = g_strdup (g_value_get_string (value));
       break;
 
+    case PROP_STORAGE:
+      priv->storage = g_value_get_enum (value);
+      break;
+
+    case PROP_LOW_WATER_MARK:
+      champlain_file_cache_set_low_water_mark (file_cache, g_value_get_uint (value));
+      break;
+
+    case PROP_STALE_WHILE_REVALIDATE:
+      champlain_file_cache_set_stale_while_revalidate (file_cache, g_value_get_boolean (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -146,24 +357,72 @@ finalize_sql (ChamplainFileCache *file_cache)
   ChamplainFileCachePrivate *priv = file_cache->priv;
   gint error;
 
-  if (priv->stmt_select)
+  if (priv->db)
+    {
+      error = sqlite3_close (priv->db);
+      if (error != SQLITE_OK)
+        DEBUG ("Sqlite returned error %d when closing cache.db", error);
+      priv->db = NULL;
+    }
+
+  if (priv->stmt_worker_select)
     {
-      sqlite3_finalize (priv->stmt_select);
-      priv->stmt_select = NULL;
+      sqlite3_finalize (priv->stmt_worker_select);
+      priv->stmt_worker_select = NULL;
     }
 
-  if (priv->stmt_update)
+  if (priv->stmt_worker_store)
     {
-      sqlite3_finalize (priv->stmt_update);
-      priv->stmt_update = NULL;
+      sqlite3_finalize (priv->stmt_worker_store);
+      priv->stmt_worker_store = NULL;
     }
 
-  if (priv->db)
+  if (priv->stmt_worker_popularity)
     {
-      error = sqlite3_close (priv->db);
-      if (error != SQLITE_OK)
-        DEBUG ("Sqlite returned error %d when closing cache.db", error);
-      priv->db = NULL;
+      sqlite3_finalize (priv->stmt_worker_popularity);
+      priv->stmt_worker_popularity = NULL;
+    }
+
+  if (priv->stmt_worker_modified)
+    {
+      sqlite3_finalize (priv->stmt_worker_modified);
+      priv->stmt_worker_modified = NULL;
+    }
+
+  if (priv->stmt_worker_missing)
+    {
+      sqlite3_finalize (priv->stmt_worker_missing);
+      priv->stmt_worker_missing = NULL;
+    }
+
+  if (priv->stmt_worker_store_missing)
+    {
+      sqlite3_finalize (priv->stmt_worker_store_missing);
+      priv->stmt_worker_store_missing = NULL;
+    }
+
+  if (priv->stmt_worker_delete_missing)
+    {
+      sqlite3_finalize (priv->stmt_worker_delete_missing);
+      priv->stmt_worker_delete_missing = NULL;
+    }
+
+  if (priv->stmt_worker_purge)
+    {
+      sqlite3_finalize (priv->stmt_worker_purge);
+      priv->stmt_worker_purge = NULL;
+    }
+
+  if (priv->stmt_worker_delete)
+    {
+      sqlite3_finalize (priv->stmt_worker_delete);
+      priv->stmt_worker_delete = NULL;
+    }
+
+  if (priv->worker_db)
+    {
+      sqlite3_close (priv->worker_db);
+      priv->worker_db = NULL;
     }
 }
 
@@ -174,7 +433,28 @@ champlain_file_cache_finalize (GObject *object)
   ChamplainFileCache *file_cache = CHAMPLAIN_FILE_CACHE (object);
   ChamplainFileCachePrivate *priv = file_cache->priv;
 
+  /* Finishes the pending writes */
+  update_popularity (file_cache);
+  if (priv->write_source_id)
+    {
+      g_source_remove (priv->write_source_id);
+      push_job (file_cache, new_job (file_cache, JOB_WRITE, NULL));
+    }
+  g_thread_pool_free (priv->worker, FALSE, TRUE);
+
   finalize_sql (file_cache);
+  g_hash_table_destroy (priv->stores);
+  g_hash_table_destroy (priv->pending);
+  g_hash_table_destroy (priv->popularity);
+
+  /* The running revalidations reference the cache, only the queued ones
+   * can be left */
+  if (priv->revalidate_source_id)
+    g_source_remove (priv->revalidate_source_id);
+  g_queue_free (priv->revalidation_queue);
+  g_hash_table_destroy (priv->revalidations);
+  g_mutex_free (priv->lock);
+  g_cond_free (priv->flushed);
 
   g_free (priv->cache_dir);
 
@@ -221,9 +501,12 @@ init_cache (ChamplainFileCache *file_cache)
       return;
     }
 
+  /* The write-ahead log lets the worker thread read while the main loop
+   * writes (ignored by SQLite older than 3.7) */
   sqlite3_exec (priv->db,
       "PRAGMA synchronous=OFF;"
-      "PRAGMA count_changes=OFF;",
+      "PRAGMA count_changes=OFF;"
+      "PRAGMA journal_mode=WAL;",
       NULL, NULL, &error_msg);
   if (error_msg != NULL)
     {
@@ -237,7 +520,11 @@ init_cache (ChamplainFileCache *file_cache)
       "filename TEXT PRIMARY KEY, "
       "etag TEXT, "
       "popularity INT DEFAULT 1, "
-      "size INT DEFAULT 0)",
+      "size INT DEFAULT 0, "
+      "modified INT DEFAULT 0, "
+      "expires INT DEFAULT 0);"
+      "CREATE INDEX IF NOT EXISTS popularity_index ON tiles (popularity);"
+      "CREATE TABLE IF NOT EXISTS metadata (name TEXT PRIMARY KEY, value TEXT)",
       NULL, NULL, &error_msg);
   if (error_msg != NULL)
     {
@@ -246,25 +533,26 @@ init_cache (ChamplainFileCache *file_cache)
       return;
     }
 
-  error = sqlite3_prepare_v2 (priv->db,
-        "SELECT etag FROM tiles WHERE filename = ?", -1,
-        &priv->stmt_select, NULL);
-  if (error != SQLITE_OK)
-    {
-      priv->stmt_select = NULL;
-      DEBUG ("Failed to prepare the select Etag statement, error:%d: %s",
-          error, sqlite3_errmsg (priv->db));
-      return;
-    }
+  /* Adds the download and expiration times to caches created before they
+   * were stored; in newer caches the columns already exist and the
+   * statements fail harmlessly. The old tiles get 0 for both, so they lose
+   * their file modification time based age and are revalidated once. */
+  sqlite3_exec (priv->db,
+      "ALTER TABLE tiles ADD COLUMN modified INT DEFAULT 0",
+      NULL, NULL, NULL);
+  sqlite3_exec (priv->db,
+      "ALTER TABLE tiles ADD COLUMN expires INT DEFAULT 0",
+      NULL, NULL, NULL);
 
-  error = sqlite3_prepare_v2 (priv->db,
-        "UPDATE tiles SET popularity = popularity + 1 WHERE filename = ?", -1,
-        &priv->stmt_update, NULL);
-  if (error != SQLITE_OK)
+  /* The tiles the tile source has no data for, forgotten once expired */
+  sqlite3_exec (priv->db,
+      "CREATE TABLE IF NOT EXISTS missing (filename TEXT PRIMARY KEY, expires INT);"
+      "DELETE FROM missing WHERE expires <= CAST (strftime ('%s', 'now') AS INT)",
+      NULL, NULL, &error_msg);
+  if (error_msg != NULL)
     {
-      priv->stmt_update = NULL;
-      DEBUG ("Failed to prepare the update popularity statement, error: %s",
-          sqlite3_errmsg (priv->db));
+      DEBUG ("Creating table 'missing' failed: %s", error_msg);
+      sqlite3_free (error_msg);
       return;
     }
 
@@ -289,7 +577,14 @@ champlain_file_cache_constructed (GObject *object)
 #endif
     }
 
-  init_cache (file_cache);
+  if (priv->storage == CHAMPLAIN_FILE_CACHE_STORAGE_FILES)
+    init_cache (file_cache);
+  else if (create_cache_dir (priv->cache_dir))
+    {
+      /* Counts the databases of all the map sources in the size limit */
+      push_job (file_cache, new_job (file_cache, JOB_OPEN_STORES, NULL));
+      g_object_notify (G_OBJECT (file_cache), "cache-dir");
+    }
 
   G_OBJECT_CLASS (champlain_file_cache_parent_class)->constructed (object);
 }
@@ -315,9 +610,9 @@ champlain_file_cache_class_init (ChamplainFileCacheClass *klass)
   /**
    * ChamplainFileCache:size-limit:
    *
-   * The cache size limit in bytes.
-   *
-   * Note: this new value will not be applied until you call #champlain_cache_purge
+   * The cache size limit in bytes. When the stored tiles make the cache
+   * grow over the limit, the cache is purged down to the
+   * #ChamplainFileCache:low-water-mark in the background.
    *
    * Since: 0.4
    */
@@ -344,9 +639,104 @@ champlain_file_cache_class_init (ChamplainFileCacheClass *klass)
         G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
   g_object_class_install_property (object_class, PROP_CACHE_DIR, pspec);
 
+  /**
+   * ChamplainFileCache:storage:
+   *
+   * The way the tiles are stored on the disk. The two storages don't share
+   * the cached tiles.
+   *
+   * Since: 0.14
+   */
+  pspec = g_param_spec_enum ("storage",
+        "Storage",
+        "The way the tiles are stored",
+        CHAMPLAIN_TYPE_FILE_CACHE_STORAGE,
+        CHAMPLAIN_FILE_CACHE_STORAGE_FILES,
+        G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_STORAGE, pspec);
+
+  /**
+   * ChamplainFileCache:low-water-mark:
+   *
+   * The size the cache is purged to, in percent of the
+   * #ChamplainFileCache:size-limit. Purging below the limit leaves room for
+   * new tiles so that the cache isn't purged again after every download.
+   *
+   * Since: 0.14
+   */
+  pspec = g_param_spec_uint ("low-water-mark",
+        "Low Water Mark",
+        "The size the cache is purged to in percent of the size limit",
+        0,
+        100,
+        90,
+        G_PARAM_CONSTRUCT | G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_LOW_WATER_MARK, pspec);
+
+  /**
+   * ChamplainFileCache:stale-while-revalidate:
+   *
+   * When TRUE, expired tiles are displayed right away and validated in the
+   * background. A newer version of a tile replaces the displayed one once
+   * downloaded. The background validations are rate limited so they don't
+   * delay the downloads of the missing tiles.
+   *
+   * Since: 0.14
+   */
+  pspec = g_param_spec_boolean ("stale-while-revalidate",
+        "Stale While Revalidate",
+        "Display expired tiles while validating them",
+        FALSE,
+        G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_STALE_WHILE_REVALIDATE, pspec);
+
+  /**
+   * ChamplainFileCache::purge-progress:
+   * @file_cache: a #ChamplainFileCache
+   * @n_freed: the number of bytes freed by the purge so far
+   * @size: the current size of the cache in bytes
+   *
+   * Emitted after every part of a purge done in the background.
+   *
+   * Since: 0.14
+   */
+  champlain_file_cache_signals[PURGE_PROGRESS] =
+    g_signal_new ("purge-progress",
+        G_OBJECT_CLASS_TYPE (object_class),
+        G_SIGNAL_RUN_LAST,
+        0,
+        NULL,
+        NULL,
+        _champlain_marshal_VOID__UINT_UINT,
+        G_TYPE_NONE,
+        2,
+        G_TYPE_UINT, G_TYPE_UINT);
+
+  /**
+   * ChamplainFileCache::purge-completed:
+   * @file_cache: a #ChamplainFileCache
+   * @n_freed: the number of bytes freed by the purge
+   *
+   * Emitted when a purge is finished.
+   *
+   * Since: 0.14
+   */
+  champlain_file_cache_signals[PURGE_COMPLETED] =
+    g_signal_new ("purge-completed",
+        G_OBJECT_CLASS_TYPE (object_class),
+        G_SIGNAL_RUN_LAST,
+        0,
+        NULL,
+        NULL,
+        g_cclosure_marshal_VOID__UINT,
+        G_TYPE_NONE,
+        1,
+        G_TYPE_UINT);
+
   tile_cache_class->store_tile = store_tile;
   tile_cache_class->refresh_tile_time = refresh_tile_time;
   tile_cache_class->on_tile_filled = on_tile_filled;
+  champlain_tile_cache_class_set_store_missing_tile (tile_cache_class, store_missing_tile);
 
   map_source_class->fill_tile = fill_tile;
 }
@@ -361,10 +751,40 @@ champlain_file_cache_init (ChamplainFileCache *file_cache)
 
   priv->cache_dir = NULL;
   priv->size_limit = 100000000;
+  priv->low_water_mark = 90;
+  priv->purging = FALSE;
+  priv->total_size = 0;
   priv->cache_dir = NULL;
   priv->db = NULL;
-  priv->stmt_select = NULL;
-  priv->stmt_update = NULL;
+  priv->worker_db = NULL;
+  priv->stmt_worker_select = NULL;
+  priv->stmt_worker_store = NULL;
+  priv->stmt_worker_popularity = NULL;
+  priv->stmt_worker_modified = NULL;
+  priv->stmt_worker_purge = NULL;
+  priv->stmt_worker_delete = NULL;
+  priv->lock = g_mutex_new ();
+  priv->flushed = g_cond_new ();
+  priv->pending = g_hash_table_new_full (champlain_tile_key_hash, champlain_tile_key_equal,
+        NULL, (GDestroyNotify) free_job);
+  priv->writing = NULL;
+  priv->write_source_id = 0;
+  priv->popularity = g_hash_table_new_full (champlain_tile_key_hash, champlain_tile_key_equal,
+        NULL, (GDestroyNotify) free_job);
+  priv->popularity_source_id = 0;
+  priv->storage = CHAMPLAIN_FILE_CACHE_STORAGE_FILES;
+  priv->stores = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+        NULL, (GDestroyNotify) close_store);
+  priv->stale_while_revalidate = FALSE;
+  priv->revalidations = g_hash_table_new_full (champlain_tile_key_hash, champlain_tile_key_equal,
+        NULL, (GDestroyNotify) free_revalidation);
+  priv->revalidation_queue = g_queue_new ();
+  priv->revalidations_running = 0;
+  priv->revalidate_source_id = 0;
+
+  /* A single thread keeps the jobs in order */
+  priv->worker = g_thread_pool_new ((GFunc) worker_thread, file_cache,
+        1, FALSE, NULL);
 }
 
 
@@ -435,6 +855,25 @@ champlain_file_cache_get_cache_dir (ChamplainFileCache *file_cache)
 }
 
 
+/**
+ * champlain_file_cache_get_storage:
+ * @file_cache: a #ChamplainFileCache
+ *
+ * Gets the way the tiles are stored on the disk.
+ *
+ * Returns: the storage
+ *
+ * Since: 0.14
+ */
+ChamplainFileCacheStorage
+champlain_file_cache_get_storage (ChamplainFileCache *file_cache)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache), CHAMPLAIN_FILE_CACHE_STORAGE_FILES);
+
+  return file_cache->priv->storage;
+}
+
+
 /**
  * champlain_file_cache_set_size_limit:
  * @file_cache: a #ChamplainFileCache
@@ -457,19 +896,104 @@ champlain_file_cache_set_size_limit (ChamplainFileCache *file_cache,
 }
 
 
-static gchar *
+/**
+ * champlain_file_cache_get_low_water_mark:
+ * @file_cache: a #ChamplainFileCache
+ *
+ * Gets the size the cache is purged to.
+ *
+ * Returns: the size in percent of the size limit
+ *
+ * Since: 0.14
+ */
+guint
+champlain_file_cache_get_low_water_mark (ChamplainFileCache *file_cache)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache), 0);
+
+  return file_cache->priv->low_water_mark;
+}
+
+
+/**
+ * champlain_file_cache_set_low_water_mark:
+ * @file_cache: a #ChamplainFileCache
+ * @low_water_mark: the size in percent of the size limit
+ *
+ * Sets the size the cache is purged to.
+ *
+ * Since: 0.14
+ */
+void
+champlain_file_cache_set_low_water_mark (ChamplainFileCache *file_cache,
+    guint low_water_mark)
+{
+  g_return_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache));
+  g_return_if_fail (low_water_mark <= 100);
+
+  file_cache->priv->low_water_mark = low_water_mark;
+  g_object_notify (G_OBJECT (file_cache), "low-water-mark");
+}
+
+
+/**
+ * champlain_file_cache_get_stale_while_revalidate:
+ * @file_cache: a #ChamplainFileCache
+ *
+ * Checks whether expired tiles are displayed while being validated.
+ *
+ * Returns: TRUE if expired tiles are validated in the background
+ *
+ * Since: 0.14
+ */
+gboolean
+champlain_file_cache_get_stale_while_revalidate (ChamplainFileCache *file_cache)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache), FALSE);
+
+  return file_cache->priv->stale_while_revalidate;
+}
+
+
+/**
+ * champlain_file_cache_set_stale_while_revalidate:
+ * @file_cache: a #ChamplainFileCache
+ * @value: TRUE to display expired tiles while validating them
+ *
+ * Sets whether expired tiles are displayed right away and validated in the
+ * background instead of being validated before they are displayed.
+ *
+ * Since: 0.14
+ */
+void
+champlain_file_cache_set_stale_while_revalidate (ChamplainFileCache *file_cache,
+    gboolean value)
+{
+  g_return_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache));
+
+  file_cache->priv->stale_while_revalidate = value;
+  g_object_notify (G_OBJECT (file_cache), "stale-while-revalidate");
+}
+
+
+/* Writes the path of the tile's file to filename, a buffer of
+ * FILENAME_SIZE bytes, so that the hot paths don't allocate. Returns FALSE
+ * if the path doesn't fit. */
+static gboolean
 get_filename (ChamplainFileCache *file_cache,
-    ChamplainTile *tile)
+    ChamplainTile *tile,
+    gchar *filename)
 {
   ChamplainFileCachePrivate *priv = file_cache->priv;
+  gint length;
 
-  g_return_val_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache), NULL);
-  g_return_val_if_fail (CHAMPLAIN_IS_TILE (tile), NULL);
-  g_return_val_if_fail (priv->cache_dir, NULL);
+  g_return_val_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache), FALSE);
+  g_return_val_if_fail (CHAMPLAIN_IS_TILE (tile), FALSE);
+  g_return_val_if_fail (priv->cache_dir, FALSE);
 
   ChamplainMapSource *map_source = CHAMPLAIN_MAP_SOURCE (file_cache);
 
-  gchar *filename = g_strdup_printf ("%s" G_DIR_SEPARATOR_S
+  length = g_snprintf (filename, FILENAME_SIZE, "%s" G_DIR_SEPARATOR_S
         "%s" G_DIR_SEPARATOR_S
         "%d" G_DIR_SEPARATOR_S
         "%d" G_DIR_SEPARATOR_S "%d.png",
@@ -478,153 +1002,1785 @@ get_filename (ChamplainFileCache *file_cache,
         champlain_tile_get_zoom_level (tile),
         champlain_tile_get_x (tile),
         champlain_tile_get_y (tile));
-  return filename;
-}
-
-
-static gboolean
-tile_is_expired (ChamplainFileCache *file_cache,
-    ChamplainTile *tile)
-{
-  g_return_val_if_fail (CHAMPLAIN_FILE_CACHE (file_cache), FALSE);
-  g_return_val_if_fail (CHAMPLAIN_TILE (tile), FALSE);
-
-  GTimeVal now = { 0, };
-  const GTimeVal *modified_time = champlain_tile_get_modified_time (tile);
-  gboolean validate_cache = TRUE;
 
-  if (modified_time)
+  if (length >= FILENAME_SIZE)
     {
-      g_get_current_time (&now);
-      g_time_val_add (&now, (-24ul * 60ul * 60ul * 1000ul * 1000ul * 7ul)); /* Cache expires in 7 days */
-      validate_cache = modified_time->tv_sec < now.tv_sec;
+      g_warning ("The path of the cached tile is too long: %s", filename);
+      return FALSE;
     }
 
-  DEBUG ("%p is %s expired", tile, (validate_cache ? "" : "not"));
-
-  return validate_cache;
+  return TRUE;
 }
 
 
-typedef struct
+static guint64
+get_total_size (ChamplainFileCache *file_cache)
 {
-  ChamplainMapSource *map_source;
-  ChamplainTile *tile;
-} FileLoadedData;
+  guint64 total_size;
+
+  g_mutex_lock (file_cache->priv->lock);
+  total_size = file_cache->priv->total_size;
+  g_mutex_unlock (file_cache->priv->lock);
+
+  return total_size;
+}
+
 
 static void
-tile_rendered_cb (ChamplainTile *tile,
-    gpointer data,
-    guint size,
-    gboolean error,
-    FileLoadedData *user_data)
+add_total_size (ChamplainFileCache *file_cache,
+    gint64 size)
 {
-  ChamplainMapSource *map_source = user_data->map_source;
-  GFile *file;
-  ChamplainFileCache *file_cache;
-  ChamplainMapSource *next_source;
-  ChamplainFileCachePrivate *priv;
-  GFileInfo *info = NULL;
-  GTimeVal modified_time = { 0, };
-  gchar *filename = NULL;
+  g_mutex_lock (file_cache->priv->lock);
+  file_cache->priv->total_size += size;
+  g_mutex_unlock (file_cache->priv->lock);
+}
 
-  g_signal_handlers_disconnect_by_func (tile, tile_rendered_cb, user_data);
-  g_slice_free (FileLoadedData, user_data);
 
-  next_source = champlain_map_source_get_next_source (map_source);
-  file_cache = CHAMPLAIN_FILE_CACHE (map_source);
-  priv = file_cache->priv;
+/* Instead of lowering the popularity of all the remaining tiles after a
+ * purge, which rewrites the whole table, new tiles start at the popularity
+ * of the last purged tile. The base only grows and is kept in metadata. */
+static gint64
+load_popularity_base (sqlite3 *db)
+{
+  sqlite3_stmt *stmt;
+  gint64 base = 0;
 
-  if (error)
+  if (sqlite3_prepare_v2 (db,
+          "SELECT value FROM metadata WHERE name = 'popularity_base'", -1,
+          &stmt, NULL) == SQLITE_OK)
     {
-      DEBUG ("Tile rendering failed");
-      goto load_next;
+      if (sqlite3_step (stmt) == SQLITE_ROW)
+        base = sqlite3_column_int64 (stmt, 0);
+      sqlite3_finalize (stmt);
     }
 
-  champlain_tile_set_state (tile, CHAMPLAIN_STATE_LOADED);
+  return base;
+}
 
-  filename = get_filename (file_cache, tile);
-  file = g_file_new_for_path (filename);
 
-  /* Retrieve modification time */
-  info = g_file_query_info (file,
-        G_FILE_ATTRIBUTE_TIME_MODIFIED,
-        G_FILE_QUERY_INFO_NONE, NULL, NULL);
-  if (info)
-    {
-      g_file_info_get_modification_time (info, &modified_time);
-      champlain_tile_set_modified_time (tile, &modified_time);
+static void
+save_popularity_base (sqlite3 *db,
+    gint64 base)
+{
+  gchar *query;
+  gchar *error = NULL;
 
-      g_object_unref (info);
+  query = sqlite3_mprintf ("INSERT OR REPLACE INTO metadata (name, value) "
+        "VALUES ('popularity_base', %lld)", (sqlite3_int64) base);
+  sqlite3_exec (db, query, NULL, NULL, &error);
+  if (error != NULL)
+    {
+      DEBUG ("Saving the popularity base failed: %s", error);
+      sqlite3_free (error);
     }
-  g_object_unref (file);
+  sqlite3_free (query);
+}
 
-  /* Notify other caches that the tile has been filled */
-  if (CHAMPLAIN_IS_TILE_CACHE (next_source))
-    champlain_tile_cache_on_tile_filled (CHAMPLAIN_TILE_CACHE (next_source), tile);
 
-  if (tile_is_expired (file_cache, tile))
-    {
-      int sql_rc = SQLITE_OK;
+static void
+close_store (TileStore *store)
+{
+  sqlite3_finalize (store->stmt_select);
+  sqlite3_finalize (store->stmt_purge);
+  sqlite3_finalize (store->stmt_delete);
+  sqlite3_finalize (store->stmt_store);
+  sqlite3_finalize (store->stmt_popularity);
+  sqlite3_finalize (store->stmt_modified);
+  sqlite3_finalize (store->stmt_ref);
+  sqlite3_finalize (store->stmt_insert_image);
+  sqlite3_finalize (store->stmt_unref);
+  sqlite3_finalize (store->stmt_orphan);
+  sqlite3_finalize (store->stmt_delete_image);
+  sqlite3_finalize (store->stmt_missing);
+  sqlite3_finalize (store->stmt_store_missing);
+  sqlite3_finalize (store->stmt_delete_missing);
+  sqlite3_close (store->db);
+  g_slice_free (TileStore, store);
+}
 
-      /* Retrieve etag */
-      sqlite3_reset (priv->stmt_select);
-      sql_rc = sqlite3_bind_text (priv->stmt_select, 1, filename, -1, SQLITE_STATIC);
-      if (sql_rc == SQLITE_ERROR)
-        {
-          DEBUG ("Failed to prepare the SQL query for finding the Etag of '%s', error: %s",
-              filename, sqlite3_errmsg (priv->db));
-          goto load_next;
-        }
 
-      sql_rc = sqlite3_step (priv->stmt_select);
-      if (sql_rc == SQLITE_ROW)
+/* The content hash identifying the tile data in images */
+static gchar *
+compute_tile_id (const gchar *data,
+    gsize size)
+{
+  return g_compute_checksum_for_data (G_CHECKSUM_SHA1, (const guchar *) data, size);
+}
+
+
+static void
+sql_tile_id (sqlite3_context *context,
+    G_GNUC_UNUSED int argc,
+    sqlite3_value **argv)
+{
+  gchar *tile_id = compute_tile_id (sqlite3_value_blob (argv[0]), sqlite3_value_bytes (argv[0]));
+
+  sqlite3_result_text (context, tile_id, -1, g_free);
+}
+
+
+/* Moves the tiles of databases created before the deduplication from the
+ * tiles table to map and images */
+static void
+migrate_store (TileStore *store)
+{
+  sqlite3_stmt *stmt;
+  gchar *error_msg = NULL;
+  gboolean legacy = FALSE;
+
+  if (sqlite3_prepare_v2 (store->db,
+          "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'tiles'", -1,
+          &stmt, NULL) == SQLITE_OK)
+    {
+      legacy = sqlite3_step (stmt) == SQLITE_ROW;
+      sqlite3_finalize (stmt);
+    }
+
+  if (!legacy)
+    return;
+
+  DEBUG ("Deduplicating the tiles of an existing database");
+
+  sqlite3_create_function (store->db, "champlain_tile_id", 1, SQLITE_UTF8, NULL,
+      sql_tile_id, NULL, NULL);
+
+  /* Databases created before the expiration time was stored lack it */
+  sqlite3_exec (store->db,
+      "ALTER TABLE tiles ADD COLUMN expires INTEGER DEFAULT 0",
+      NULL, NULL, NULL);
+
+  sqlite3_exec (store->db,
+      "BEGIN;"
+      "CREATE TABLE map ("
+      "zoom_level INTEGER, "
+      "tile_column INTEGER, "
+      "tile_row INTEGER, "
+      "tile_id TEXT, "
+      "etag TEXT, "
+      "popularity INTEGER DEFAULT 1, "
+      "modified INTEGER DEFAULT 0, "
+      "expires INTEGER DEFAULT 0);"
+      "CREATE TABLE images (tile_id TEXT PRIMARY KEY, tile_data BLOB, refs INTEGER DEFAULT 0);"
+      "INSERT INTO map "
+      "SELECT zoom_level, tile_column, tile_row, champlain_tile_id (tile_data), "
+      "etag, popularity, modified, expires FROM tiles;"
+      "INSERT OR IGNORE INTO images (tile_id, tile_data) "
+      "SELECT champlain_tile_id (tile_data), tile_data FROM tiles;"
+      "UPDATE images SET refs = (SELECT COUNT (*) FROM map WHERE map.tile_id = images.tile_id);"
+      "DROP TABLE tiles;"
+      "COMMIT;",
+      NULL, NULL, &error_msg);
+  if (error_msg != NULL)
+    {
+      DEBUG ("Deduplicating the tiles failed: %s", error_msg);
+      sqlite3_free (error_msg);
+      sqlite3_exec (store->db, "ROLLBACK", NULL, NULL, NULL);
+      return;
+    }
+
+  /* Gives the space of the duplicates back to the file system */
+  sqlite3_exec (store->db, "VACUUM", NULL, NULL, NULL);
+}
+
+
+/* Returns the database of the map source, opening it when used for the
+ * first time */
+static TileStore *
+get_store (ChamplainFileCache *file_cache,
+    const gchar *source_id)
+{
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  TileStore *store;
+  gchar *filename;
+  gchar *error_msg = NULL;
+  gint error;
+  sqlite3_stmt *stmt;
+
+  store = g_hash_table_lookup (priv->stores, source_id);
+  if (store)
+    return store;
+
+  store = g_slice_new0 (TileStore);
+
+  filename = g_strdup_printf ("%s" G_DIR_SEPARATOR_S "%s.mbtiles",
+        priv->cache_dir, source_id);
+  error = sqlite3_open_v2 (filename, &store->db,
+        SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+  if (error != SQLITE_OK)
+    {
+      DEBUG ("Sqlite returned error %d when opening %s", error, filename);
+      g_free (filename);
+      goto error;
+    }
+  g_free (filename);
+
+  sqlite3_exec (store->db,
+      "PRAGMA synchronous=OFF;"
+      "PRAGMA count_changes=OFF;",
+      NULL, NULL, NULL);
+
+  migrate_store (store);
+
+  /* The deduplicated MBTiles schema; other MBTiles readers use the tiles
+   * view. etag, popularity, modified, expires and refs are cache metadata,
+   * missing holds the tiles the tile source has no data for. tile_row
+   * counts from the bottom. */
+  sqlite3_exec (store->db,
+      "CREATE TABLE IF NOT EXISTS metadata (name TEXT, value TEXT);"
+      "CREATE UNIQUE INDEX IF NOT EXISTS name ON metadata (name);"
+      "CREATE TABLE IF NOT EXISTS map ("
+      "zoom_level INTEGER, "
+      "tile_column INTEGER, "
+      "tile_row INTEGER, "
+      "tile_id TEXT, "
+      "etag TEXT, "
+      "popularity INTEGER DEFAULT 1, "
+      "modified INTEGER DEFAULT 0, "
+      "expires INTEGER DEFAULT 0);"
+      "CREATE TABLE IF NOT EXISTS images (tile_id TEXT PRIMARY KEY, tile_data BLOB, refs INTEGER DEFAULT 0);"
+      "CREATE UNIQUE INDEX IF NOT EXISTS map_index ON map (zoom_level, tile_column, tile_row);"
+      "CREATE INDEX IF NOT EXISTS popularity_index ON map (popularity);"
+      "CREATE VIEW IF NOT EXISTS tiles AS "
+      "SELECT map.zoom_level AS zoom_level, map.tile_column AS tile_column, "
+      "map.tile_row AS tile_row, images.tile_data AS tile_data "
+      "FROM map JOIN images ON images.tile_id = map.tile_id;"
+      "CREATE TABLE IF NOT EXISTS missing ("
+      "zoom_level INTEGER, "
+      "tile_column INTEGER, "
+      "tile_row INTEGER, "
+      "expires INTEGER);"
+      "CREATE UNIQUE INDEX IF NOT EXISTS missing_index ON missing (zoom_level, tile_column, tile_row);"
+      "DELETE FROM missing WHERE expires <= CAST (strftime ('%s', 'now') AS INTEGER);",
+      NULL, NULL, &error_msg);
+  if (error_msg != NULL)
+    {
+      DEBUG ("Creating the MBTiles schema failed: %s", error_msg);
+      sqlite3_free (error_msg);
+      goto error;
+    }
+
+  error_msg = sqlite3_mprintf ("INSERT OR IGNORE INTO metadata (name, value) VALUES ('name', %Q);"
+        "INSERT OR IGNORE INTO metadata (name, value) VALUES ('type', 'baselayer');"
+        "INSERT OR IGNORE INTO metadata (name, value) VALUES ('version', '1.0');",
+        source_id);
+  sqlite3_exec (store->db, error_msg, NULL, NULL, NULL);
+  sqlite3_free (error_msg);
+
+  if (sqlite3_prepare_v2 (store->db,
+          "SELECT images.rowid, map.etag, map.modified, length (images.tile_data), "
+          "map.expires, map.tile_id FROM map JOIN images ON images.tile_id = map.tile_id "
+          "WHERE map.zoom_level = ? AND map.tile_column = ? AND map.tile_row = ?", -1,
+          &store->stmt_select, NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2 (store->db,
+          "INSERT OR REPLACE INTO map "
+          "(zoom_level, tile_column, tile_row, tile_id, etag, modified, expires, popularity) "
+          "VALUES (?, ?, ?, ?, ?, ?, ?, ?)", -1,
+          &store->stmt_store, NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2 (store->db,
+          "UPDATE map SET popularity = popularity + ? "
+          "WHERE zoom_level = ? AND tile_column = ? AND tile_row = ?", -1,
+          &store->stmt_popularity, NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2 (store->db,
+          "UPDATE map SET modified = ?, expires = ? "
+          "WHERE zoom_level = ? AND tile_column = ? AND tile_row = ?", -1,
+          &store->stmt_modified, NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2 (store->db,
+          "SELECT rowid, tile_id, popularity FROM map "
+          "ORDER BY popularity LIMIT ?", -1,
+          &store->stmt_purge, NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2 (store->db,
+          "DELETE FROM map WHERE rowid = ?", -1,
+          &store->stmt_delete, NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2 (store->db,
+          "UPDATE images SET refs = refs + 1 WHERE tile_id = ?", -1,
+          &store->stmt_ref, NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2 (store->db,
+          "INSERT INTO images (tile_id, tile_data, refs) VALUES (?, ?, 1)", -1,
+          &store->stmt_insert_image, NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2 (store->db,
+          "UPDATE images SET refs = refs - 1 WHERE tile_id = ?", -1,
+          &store->stmt_unref, NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2 (store->db,
+          "SELECT length (tile_data) FROM images WHERE tile_id = ? AND refs <= 0", -1,
+          &store->stmt_orphan, NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2 (store->db,
+          "DELETE FROM images WHERE tile_id = ? AND refs <= 0", -1,
+          &store->stmt_delete_image, NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2 (store->db,
+          "SELECT 1 FROM missing "
+          "WHERE zoom_level = ? AND tile_column = ? AND tile_row = ? AND expires > ?", -1,
+          &store->stmt_missing, NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2 (store->db,
+          "INSERT OR REPLACE INTO missing (zoom_level, tile_column, tile_row, expires) "
+          "VALUES (?, ?, ?, ?)", -1,
+          &store->stmt_store_missing, NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2 (store->db,
+          "DELETE FROM missing WHERE zoom_level = ? AND tile_column = ? AND tile_row = ?", -1,
+          &store->stmt_delete_missing, NULL) != SQLITE_OK)
+    {
+      DEBUG ("Failed to prepare the MBTiles statements: %s", sqlite3_errmsg (store->db));
+      goto error;
+    }
+
+  store->popularity_base = load_popularity_base (store->db);
+
+  /* Counted once, then kept up to date by the writes and the purge */
+  if (sqlite3_prepare_v2 (store->db, "SELECT SUM (length (tile_data)) FROM images", -1,
+          &stmt, NULL) == SQLITE_OK)
+    {
+      if (sqlite3_step (stmt) == SQLITE_ROW)
+        add_total_size (file_cache, sqlite3_column_int64 (stmt, 0));
+      sqlite3_finalize (stmt);
+    }
+
+  g_hash_table_insert (priv->stores, (gpointer) source_id, store);
+
+  return store;
+
+error:
+  close_store (store);
+  return NULL;
+}
+
+
+/* Opens the databases of all the map sources found in the cache directory,
+ * not only of those used in this session, so that they are all counted and
+ * purged */
+static void
+open_all_stores (ChamplainFileCache *file_cache)
+{
+  GDir *dir;
+  const gchar *name;
+
+  dir = g_dir_open (file_cache->priv->cache_dir, 0, NULL);
+  if (!dir)
+    return;
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      gchar *source_id;
+
+      if (!g_str_has_suffix (name, ".mbtiles"))
+        continue;
+
+      source_id = g_strndup (name, strlen (name) - strlen (".mbtiles"));
+      if (*source_id)
+        get_store (file_cache, g_intern_string (source_id));
+      g_free (source_id);
+    }
+
+  g_dir_close (dir);
+
+  DEBUG ("Opened %u MBTiles databases, cache size is %" G_GUINT64_FORMAT,
+      g_hash_table_size (file_cache->priv->stores), get_total_size (file_cache));
+}
+
+
+/* Binds the MBTiles coordinates of the job's tile starting at the given
+ * index */
+static void
+bind_tile (sqlite3_stmt *stmt,
+    gint index,
+    WorkerJob *job)
+{
+  sqlite3_bind_int (stmt, index, job->zoom_level);
+  sqlite3_bind_int (stmt, index + 1, job->x);
+  sqlite3_bind_int (stmt, index + 2, (1 << job->zoom_level) - 1 - job->y);
+}
+
+
+/* Checks whether the tile source reported the job's tile missing and the
+ * report hasn't expired yet */
+static void
+db_load_missing (TileStore *store,
+    WorkerJob *job)
+{
+  GTimeVal now = { 0, };
+
+  g_get_current_time (&now);
+
+  sqlite3_reset (store->stmt_missing);
+  bind_tile (store->stmt_missing, 1, job);
+  sqlite3_bind_int64 (store->stmt_missing, 4, now.tv_sec);
+  job->missing = sqlite3_step (store->stmt_missing) == SQLITE_ROW;
+  sqlite3_reset (store->stmt_missing);
+}
+
+
+/* Reads the tile data with incremental blob I/O together with the etag and
+ * the modification time of the tile */
+static void
+db_load_tile (ChamplainFileCache *file_cache,
+    WorkerJob *job)
+{
+  TileStore *store = get_store (file_cache, job->source_id);
+  sqlite3_blob *blob = NULL;
+  sqlite3_int64 rowid;
+  gint size;
+
+  if (!store)
+    return;
+
+  sqlite3_reset (store->stmt_select);
+  bind_tile (store->stmt_select, 1, job);
+  if (sqlite3_step (store->stmt_select) != SQLITE_ROW)
+    {
+      sqlite3_reset (store->stmt_select);
+      db_load_missing (store, job);
+      return;
+    }
+
+  rowid = sqlite3_column_int64 (store->stmt_select, 0);
+  if (sqlite3_column_type (store->stmt_select, 1) != SQLITE_NULL)
+    job->etag = g_strdup ((const gchar *) sqlite3_column_text (store->stmt_select, 1));
+  job->modified_time.tv_sec = sqlite3_column_int64 (store->stmt_select, 2);
+  job->expire_time.tv_sec = sqlite3_column_int64 (store->stmt_select, 4);
+  sqlite3_reset (store->stmt_select);
+
+  if (sqlite3_blob_open (store->db, "main", "images", "tile_data", rowid, 0, &blob) != SQLITE_OK)
+    {
+      DEBUG ("Failed to open the tile blob: %s", sqlite3_errmsg (store->db));
+      goto finish;
+    }
+
+  size = sqlite3_blob_bytes (blob);
+  job->data = g_malloc (size);
+  if (sqlite3_blob_read (blob, job->data, size, 0) != SQLITE_OK)
+    {
+      DEBUG ("Failed to read the tile blob: %s", sqlite3_errmsg (store->db));
+      g_free (job->data);
+      job->data = NULL;
+      goto finish;
+    }
+
+  job->size = size;
+  job->found = TRUE;
+
+finish:
+  if (blob)
+    sqlite3_blob_close (blob);
+}
+
+
+/* Adds a reference to the image, storing it when it isn't there yet.
+ * Returns the number of bytes written. */
+static gint64
+ref_image (TileStore *store,
+    const gchar *tile_id,
+    WorkerJob *job)
+{
+  gint64 size = 0;
+
+  sqlite3_reset (store->stmt_ref);
+  sqlite3_bind_text (store->stmt_ref, 1, tile_id, -1, SQLITE_STATIC);
+  sqlite3_step (store->stmt_ref);
+  sqlite3_reset (store->stmt_ref);
+
+  if (sqlite3_changes (store->db) > 0)
+    return 0;
+
+  sqlite3_reset (store->stmt_insert_image);
+  sqlite3_bind_text (store->stmt_insert_image, 1, tile_id, -1, SQLITE_STATIC);
+  sqlite3_bind_blob (store->stmt_insert_image, 2, job->data, job->size, SQLITE_STATIC);
+  if (sqlite3_step (store->stmt_insert_image) != SQLITE_DONE)
+    DEBUG ("Saving the tile image failed: %s", sqlite3_errmsg (store->db));
+  else
+    size = job->size;
+  sqlite3_reset (store->stmt_insert_image);
+
+  return size;
+}
+
+
+/* Removes a reference to the image, deleting it when no tile uses it
+ * anymore. Returns the number of bytes freed. */
+static gint64
+unref_image (TileStore *store,
+    const gchar *tile_id)
+{
+  gint64 size = 0;
+
+  sqlite3_reset (store->stmt_unref);
+  sqlite3_bind_text (store->stmt_unref, 1, tile_id, -1, SQLITE_STATIC);
+  sqlite3_step (store->stmt_unref);
+  sqlite3_reset (store->stmt_unref);
+
+  sqlite3_reset (store->stmt_orphan);
+  sqlite3_bind_text (store->stmt_orphan, 1, tile_id, -1, SQLITE_STATIC);
+  if (sqlite3_step (store->stmt_orphan) == SQLITE_ROW)
+    size = sqlite3_column_int64 (store->stmt_orphan, 0);
+  sqlite3_reset (store->stmt_orphan);
+
+  if (size == 0)
+    return 0;
+
+  sqlite3_reset (store->stmt_delete_image);
+  sqlite3_bind_text (store->stmt_delete_image, 1, tile_id, -1, SQLITE_STATIC);
+  if (sqlite3_step (store->stmt_delete_image) != SQLITE_DONE)
+    {
+      DEBUG ("Deleting the tile image failed: %s", sqlite3_errmsg (store->db));
+      size = 0;
+    }
+  sqlite3_reset (store->stmt_delete_image);
+
+  return size;
+}
+
+
+/* Stores the tile data under their content hash so that identical tiles,
+ * such as the sea, share one image */
+static void
+db_store_tile (ChamplainFileCache *file_cache,
+    WorkerJob *job)
+{
+  TileStore *store = get_store (file_cache, job->source_id);
+  GTimeVal now = { 0, };
+  gchar *tile_id, *old_tile_id = NULL;
+  gint64 size = 0;
+
+  if (!store)
+    return;
+
+  g_get_current_time (&now);
+  tile_id = compute_tile_id (job->data, job->size);
+
+  /* Replaces the previous version of the tile */
+  sqlite3_reset (store->stmt_select);
+  bind_tile (store->stmt_select, 1, job);
+  if (sqlite3_step (store->stmt_select) == SQLITE_ROW)
+    old_tile_id = g_strdup ((const gchar *) sqlite3_column_text (store->stmt_select, 5));
+  sqlite3_reset (store->stmt_select);
+
+  if (g_strcmp0 (tile_id, old_tile_id) != 0)
+    {
+      size += ref_image (store, tile_id, job);
+      if (old_tile_id)
+        size -= unref_image (store, old_tile_id);
+    }
+
+  sqlite3_reset (store->stmt_store);
+  bind_tile (store->stmt_store, 1, job);
+  sqlite3_bind_text (store->stmt_store, 4, tile_id, -1, SQLITE_STATIC);
+  sqlite3_bind_text (store->stmt_store, 5, job->etag, -1, SQLITE_STATIC);
+  sqlite3_bind_int64 (store->stmt_store, 6, now.tv_sec);
+  sqlite3_bind_int64 (store->stmt_store, 7, job->expire_time.tv_sec);
+  sqlite3_bind_int64 (store->stmt_store, 8, store->popularity_base + 1);
+  if (sqlite3_step (store->stmt_store) != SQLITE_DONE)
+    DEBUG ("Saving the tile failed: %s", sqlite3_errmsg (store->db));
+  sqlite3_reset (store->stmt_store);
+
+  /* The tile source has the tile now */
+  sqlite3_reset (store->stmt_delete_missing);
+  bind_tile (store->stmt_delete_missing, 1, job);
+  sqlite3_step (store->stmt_delete_missing);
+  sqlite3_reset (store->stmt_delete_missing);
+
+  add_total_size (file_cache, size);
+
+  g_free (tile_id);
+  g_free (old_tile_id);
+}
+
+
+static void
+db_update_tile (ChamplainFileCache *file_cache,
+    WorkerJob *job,
+    gboolean popularity)
+{
+  TileStore *store = get_store (file_cache, job->source_id);
+  sqlite3_stmt *stmt;
+
+  if (!store)
+    return;
+
+  if (popularity)
+    {
+      stmt = store->stmt_popularity;
+      sqlite3_reset (stmt);
+      sqlite3_bind_int (stmt, 1, job->popularity);
+      bind_tile (stmt, 2, job);
+    }
+  else
+    {
+      GTimeVal now = { 0, };
+
+      g_get_current_time (&now);
+
+      stmt = store->stmt_modified;
+      sqlite3_reset (stmt);
+      sqlite3_bind_int64 (stmt, 1, now.tv_sec);
+      sqlite3_bind_int64 (stmt, 2, job->expire_time.tv_sec);
+      bind_tile (stmt, 3, job);
+    }
+
+  if (sqlite3_step (stmt) != SQLITE_DONE)
+    DEBUG ("Updating the tile failed: %s", sqlite3_errmsg (store->db));
+  sqlite3_reset (stmt);
+}
+
+
+static void
+db_store_missing (ChamplainFileCache *file_cache,
+    WorkerJob *job)
+{
+  TileStore *store = get_store (file_cache, job->source_id);
+
+  if (!store)
+    return;
+
+  sqlite3_reset (store->stmt_store_missing);
+  bind_tile (store->stmt_store_missing, 1, job);
+  sqlite3_bind_int64 (store->stmt_store_missing, 4, job->expire_time.tv_sec);
+  if (sqlite3_step (store->stmt_store_missing) != SQLITE_DONE)
+    DEBUG ("Saving the missing tile failed: %s", sqlite3_errmsg (store->db));
+  sqlite3_reset (store->stmt_store_missing);
+}
+
+
+static WorkerJob *
+new_job (ChamplainFileCache *file_cache,
+    JobType type,
+    ChamplainTile *tile)
+{
+  WorkerJob *job = g_slice_new0 (WorkerJob);
+
+  job->type = type;
+  job->file_cache = file_cache;
+
+  if (tile)
+    {
+      job->source_id = champlain_tile_cache_get_source_id (CHAMPLAIN_TILE_CACHE (file_cache));
+      job->zoom_level = champlain_tile_get_zoom_level (tile);
+      job->x = champlain_tile_get_x (tile);
+      job->y = champlain_tile_get_y (tile);
+      champlain_tile_key_init (&job->key, job->source_id, job->zoom_level, job->x, job->y);
+    }
+
+  return job;
+}
+
+
+static void
+free_job (WorkerJob *job)
+{
+  g_list_foreach (job->jobs, (GFunc) free_job, NULL);
+  g_list_free (job->jobs);
+  g_free (job->filename);
+  g_free (job->data);
+  g_free (job->etag);
+  g_slice_free (WorkerJob, job);
+}
+
+
+static void
+push_job (ChamplainFileCache *file_cache,
+    WorkerJob *job)
+{
+  GError *error = NULL;
+
+  g_thread_pool_push (file_cache->priv->worker, job, &error);
+  if (error)
+    {
+      g_warning ("Thread pool error: %s", error->message);
+      g_error_free (error);
+
+      /* Better late than never */
+      worker_thread (job, file_cache);
+    }
+}
+
+
+/* The worker's own connection to cache.db so it never waits for the main
+ * loop's statements */
+static gboolean
+open_worker_db (ChamplainFileCache *file_cache)
+{
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  sqlite3_stmt *stmt;
+  gchar *filename;
+  gint error;
+
+  if (priv->stmt_worker_delete)
+    return TRUE;
+
+  if (priv->worker_db)
+    return FALSE;
+
+  filename = g_build_filename (priv->cache_dir, "cache.db", NULL);
+  error = sqlite3_open_v2 (filename, &priv->worker_db, SQLITE_OPEN_READWRITE, NULL);
+  g_free (filename);
+
+  if (error != SQLITE_OK)
+    {
+      DEBUG ("Sqlite returned error %d when opening cache.db", error);
+      return FALSE;
+    }
+
+  sqlite3_busy_timeout (priv->worker_db, 1000);
+
+  error = sqlite3_prepare_v2 (priv->worker_db,
+        "SELECT etag, size, modified, expires FROM tiles WHERE filename = ?", -1,
+        &priv->stmt_worker_select, NULL);
+  if (error != SQLITE_OK)
+    {
+      priv->stmt_worker_select = NULL;
+      DEBUG ("Failed to prepare the select Etag statement, error:%d: %s",
+          error, sqlite3_errmsg (priv->worker_db));
+      return FALSE;
+    }
+
+  error = sqlite3_prepare_v2 (priv->worker_db,
+        "REPLACE INTO tiles (filename, etag, size, modified, expires, popularity) "
+        "VALUES (?, ?, ?, ?, ?, ?)", -1,
+        &priv->stmt_worker_store, NULL);
+  if (error != SQLITE_OK)
+    {
+      priv->stmt_worker_store = NULL;
+      DEBUG ("Failed to prepare the store statement, error:%d: %s",
+          error, sqlite3_errmsg (priv->worker_db));
+      return FALSE;
+    }
+
+  error = sqlite3_prepare_v2 (priv->worker_db,
+        "UPDATE tiles SET popularity = popularity + ? WHERE filename = ?", -1,
+        &priv->stmt_worker_popularity, NULL);
+  if (error != SQLITE_OK)
+    {
+      priv->stmt_worker_popularity = NULL;
+      DEBUG ("Failed to prepare the update popularity statement, error:%d: %s",
+          error, sqlite3_errmsg (priv->worker_db));
+      return FALSE;
+    }
+
+  error = sqlite3_prepare_v2 (priv->worker_db,
+        "UPDATE tiles SET modified = ?, expires = ? WHERE filename = ?", -1,
+        &priv->stmt_worker_modified, NULL);
+  if (error != SQLITE_OK)
+    {
+      priv->stmt_worker_modified = NULL;
+      DEBUG ("Failed to prepare the update modified statement, error:%d: %s",
+          error, sqlite3_errmsg (priv->worker_db));
+      return FALSE;
+    }
+
+  error = sqlite3_prepare_v2 (priv->worker_db,
+        "SELECT filename, size, popularity FROM tiles ORDER BY popularity LIMIT ?", -1,
+        &priv->stmt_worker_purge, NULL);
+  if (error != SQLITE_OK)
+    {
+      priv->stmt_worker_purge = NULL;
+      DEBUG ("Failed to prepare the purge statement, error:%d: %s",
+          error, sqlite3_errmsg (priv->worker_db));
+      return FALSE;
+    }
+
+  error = sqlite3_prepare_v2 (priv->worker_db,
+        "SELECT 1 FROM missing WHERE filename = ? AND expires > ?", -1,
+        &priv->stmt_worker_missing, NULL);
+  if (error != SQLITE_OK)
+    {
+      priv->stmt_worker_missing = NULL;
+      DEBUG ("Failed to prepare the select missing statement, error:%d: %s",
+          error, sqlite3_errmsg (priv->worker_db));
+      return FALSE;
+    }
+
+  error = sqlite3_prepare_v2 (priv->worker_db,
+        "REPLACE INTO missing (filename, expires) VALUES (?, ?)", -1,
+        &priv->stmt_worker_store_missing, NULL);
+  if (error != SQLITE_OK)
+    {
+      priv->stmt_worker_store_missing = NULL;
+      DEBUG ("Failed to prepare the store missing statement, error:%d: %s",
+          error, sqlite3_errmsg (priv->worker_db));
+      return FALSE;
+    }
+
+  error = sqlite3_prepare_v2 (priv->worker_db,
+        "DELETE FROM missing WHERE filename = ?", -1,
+        &priv->stmt_worker_delete_missing, NULL);
+  if (error != SQLITE_OK)
+    {
+      priv->stmt_worker_delete_missing = NULL;
+      DEBUG ("Failed to prepare the delete missing statement, error:%d: %s",
+          error, sqlite3_errmsg (priv->worker_db));
+      return FALSE;
+    }
+
+  error = sqlite3_prepare_v2 (priv->worker_db,
+        "DELETE FROM tiles WHERE filename = ?", -1,
+        &priv->stmt_worker_delete, NULL);
+  if (error != SQLITE_OK)
+    {
+      priv->stmt_worker_delete = NULL;
+      DEBUG ("Failed to prepare the delete statement, error:%d: %s",
+          error, sqlite3_errmsg (priv->worker_db));
+      return FALSE;
+    }
+
+  priv->popularity_base = load_popularity_base (priv->worker_db);
+
+  /* Counted once, then kept up to date by the writes and the purge */
+  if (sqlite3_prepare_v2 (priv->worker_db, "SELECT SUM (size) FROM tiles", -1,
+          &stmt, NULL) == SQLITE_OK)
+    {
+      if (sqlite3_step (stmt) == SQLITE_ROW)
+        add_total_size (file_cache, sqlite3_column_int64 (stmt, 0));
+      sqlite3_finalize (stmt);
+    }
+
+  return TRUE;
+}
+
+
+/* Retrieves the etag and the download time of the tile in one lookup */
+static void
+load_file_metadata (ChamplainFileCache *file_cache,
+    WorkerJob *job)
+{
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  int sql_rc = SQLITE_OK;
+
+  if (!open_worker_db (file_cache))
+    return;
+
+  sqlite3_reset (priv->stmt_worker_select);
+  sql_rc = sqlite3_bind_text (priv->stmt_worker_select, 1, job->filename, -1, SQLITE_STATIC);
+  if (sql_rc == SQLITE_ERROR)
+    {
+      DEBUG ("Failed to prepare the SQL query for finding the Etag of '%s', error: %s",
+          job->filename, sqlite3_errmsg (priv->worker_db));
+      return;
+    }
+
+  sql_rc = sqlite3_step (priv->stmt_worker_select);
+  if (sql_rc == SQLITE_ROW)
+    {
+      job->etag = g_strdup ((const gchar *) sqlite3_column_text (priv->stmt_worker_select, 0));
+      job->modified_time.tv_sec = sqlite3_column_int64 (priv->stmt_worker_select, 2);
+      job->expire_time.tv_sec = sqlite3_column_int64 (priv->stmt_worker_select, 3);
+    }
+  else if (sql_rc == SQLITE_DONE)
+    DEBUG ("'%s' does't have an etag", job->filename);
+  else
+    DEBUG ("Failed to finding the Etag of '%s', %d error: %s",
+        job->filename, sql_rc, sqlite3_errmsg (priv->worker_db));
+
+  sqlite3_reset (priv->stmt_worker_select);
+}
+
+
+static void
+refresh_file_time (ChamplainFileCache *file_cache,
+    WorkerJob *job)
+{
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  GTimeVal now = { 0, };
+
+  if (!open_worker_db (file_cache))
+    return;
+
+  g_get_current_time (&now);
+
+  sqlite3_reset (priv->stmt_worker_modified);
+  sqlite3_bind_int64 (priv->stmt_worker_modified, 1, now.tv_sec);
+  sqlite3_bind_int64 (priv->stmt_worker_modified, 2, job->expire_time.tv_sec);
+  sqlite3_bind_text (priv->stmt_worker_modified, 3, job->filename, -1, SQLITE_STATIC);
+  if (sqlite3_step (priv->stmt_worker_modified) != SQLITE_DONE)
+    DEBUG ("Updating the modification time failed: %s", sqlite3_errmsg (priv->worker_db));
+  sqlite3_reset (priv->stmt_worker_modified);
+}
+
+
+static void
+load_file_missing (ChamplainFileCache *file_cache,
+    WorkerJob *job)
+{
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  GTimeVal now = { 0, };
+
+  if (!open_worker_db (file_cache))
+    return;
+
+  g_get_current_time (&now);
+
+  sqlite3_reset (priv->stmt_worker_missing);
+  sqlite3_bind_text (priv->stmt_worker_missing, 1, job->filename, -1, SQLITE_STATIC);
+  sqlite3_bind_int64 (priv->stmt_worker_missing, 2, now.tv_sec);
+  job->missing = sqlite3_step (priv->stmt_worker_missing) == SQLITE_ROW;
+  sqlite3_reset (priv->stmt_worker_missing);
+}
+
+
+static void
+store_file_missing (ChamplainFileCache *file_cache,
+    WorkerJob *job)
+{
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+
+  if (!open_worker_db (file_cache))
+    return;
+
+  sqlite3_reset (priv->stmt_worker_store_missing);
+  sqlite3_bind_text (priv->stmt_worker_store_missing, 1, job->filename, -1, SQLITE_STATIC);
+  sqlite3_bind_int64 (priv->stmt_worker_store_missing, 2, job->expire_time.tv_sec);
+  if (sqlite3_step (priv->stmt_worker_store_missing) != SQLITE_DONE)
+    DEBUG ("Saving the missing tile failed: %s", sqlite3_errmsg (priv->worker_db));
+  sqlite3_reset (priv->stmt_worker_store_missing);
+}
+
+
+static gboolean
+write_file (WorkerJob *job)
+{
+  GError *error = NULL;
+  GFile *file;
+  GFileOutputStream *ostream;
+  gchar *path;
+  gsize bytes_written;
+  gboolean success = FALSE;
+
+  file = g_file_new_for_path (job->filename);
+
+  /* If the file exists, delete it */
+  g_file_delete (file, NULL, NULL);
+
+  /* If needed, create the cache's dirs */
+  path = g_path_get_dirname (job->filename);
+  if (g_mkdir_with_parents (path, 0700) == -1 && errno != EEXIST)
+    {
+      g_warning ("Unable to create the image cache path '%s': %s",
+          path, g_strerror (errno));
+      goto finish;
+    }
+
+  ostream = g_file_create (file, G_FILE_CREATE_PRIVATE, NULL, &error);
+  if (!ostream)
+    {
+      DEBUG ("GFileOutputStream creation failed: %s", error->message);
+      g_error_free (error);
+      goto finish;
+    }
+
+  /* Write the cache */
+  success = g_output_stream_write_all (G_OUTPUT_STREAM (ostream),
+        job->data, job->size, &bytes_written, NULL, &error);
+  if (!success)
+    {
+      DEBUG ("Writing file contents failed: %s", error->message);
+      g_error_free (error);
+    }
+
+  g_object_unref (ostream);
+
+finish:
+  g_free (path);
+  g_object_unref (file);
+
+  return success;
+}
+
+
+/* Writes the tile files first and then their metadata in one transaction */
+static void
+write_files (ChamplainFileCache *file_cache,
+    GList *jobs)
+{
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  GList *iter;
+
+  for (iter = jobs; iter; iter = iter->next)
+    {
+      WorkerJob *job = iter->data;
+
+      job->found = write_file (job);
+    }
+
+  if (!open_worker_db (file_cache))
+    return;
+
+  sqlite3_exec (priv->worker_db, "BEGIN", NULL, NULL, NULL);
+  for (iter = jobs; iter; iter = iter->next)
+    {
+      WorkerJob *job = iter->data;
+
+      gint64 size = job->size;
+
+      if (!job->found)
+        continue;
+
+      /* Replaces the previous version of the tile */
+      sqlite3_reset (priv->stmt_worker_select);
+      sqlite3_bind_text (priv->stmt_worker_select, 1, job->filename, -1, SQLITE_STATIC);
+      if (sqlite3_step (priv->stmt_worker_select) == SQLITE_ROW)
+        size -= sqlite3_column_int64 (priv->stmt_worker_select, 1);
+      sqlite3_reset (priv->stmt_worker_select);
+
+      sqlite3_reset (priv->stmt_worker_store);
+      sqlite3_bind_text (priv->stmt_worker_store, 1, job->filename, -1, SQLITE_STATIC);
+      sqlite3_bind_text (priv->stmt_worker_store, 2, job->etag, -1, SQLITE_STATIC);
+      sqlite3_bind_int (priv->stmt_worker_store, 3, job->size);
+      sqlite3_bind_int64 (priv->stmt_worker_store, 4, job->modified_time.tv_sec);
+      sqlite3_bind_int64 (priv->stmt_worker_store, 5, job->expire_time.tv_sec);
+      sqlite3_bind_int64 (priv->stmt_worker_store, 6, priv->popularity_base + 1);
+      if (sqlite3_step (priv->stmt_worker_store) != SQLITE_DONE)
+        DEBUG ("Saving Etag and size failed: %s", sqlite3_errmsg (priv->worker_db));
+      else
+        add_total_size (file_cache, size);
+
+      /* The tile source has the tile now */
+      sqlite3_reset (priv->stmt_worker_delete_missing);
+      sqlite3_bind_text (priv->stmt_worker_delete_missing, 1, job->filename, -1, SQLITE_STATIC);
+      sqlite3_step (priv->stmt_worker_delete_missing);
+    }
+  sqlite3_reset (priv->stmt_worker_store);
+  sqlite3_reset (priv->stmt_worker_delete_missing);
+  sqlite3_exec (priv->worker_db, "COMMIT", NULL, NULL, NULL);
+}
+
+
+/* Begins a transaction in the database of the job's tile unless it is
+ * in the list of the databases with a transaction already */
+static gboolean
+begin_store (ChamplainFileCache *file_cache,
+    WorkerJob *job,
+    GList **stores)
+{
+  TileStore *store = get_store (file_cache, job->source_id);
+
+  if (!store)
+    return FALSE;
+
+  if (!g_list_find (*stores, store))
+    {
+      sqlite3_exec (store->db, "BEGIN", NULL, NULL, NULL);
+      *stores = g_list_prepend (*stores, store);
+    }
+
+  return TRUE;
+}
+
+
+static void
+commit_stores (GList *stores)
+{
+  GList *iter;
+
+  for (iter = stores; iter; iter = iter->next)
+    {
+      TileStore *store = iter->data;
+
+      sqlite3_exec (store->db, "COMMIT", NULL, NULL, NULL);
+    }
+  g_list_free (stores);
+}
+
+
+/* Writes the tiles in one transaction per database */
+static void
+write_databases (ChamplainFileCache *file_cache,
+    GList *jobs)
+{
+  GList *stores = NULL;
+  GList *iter;
+
+  for (iter = jobs; iter; iter = iter->next)
+    {
+      if (begin_store (file_cache, iter->data, &stores))
+        db_store_tile (file_cache, iter->data);
+    }
+
+  commit_stores (stores);
+}
+
+
+/* Adds the popularity gained by the tiles in one transaction */
+static void
+write_popularity (ChamplainFileCache *file_cache,
+    GList *jobs)
+{
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  GList *stores = NULL;
+  GList *iter;
+
+  DEBUG ("Updating popularity of %u tiles", g_list_length (jobs));
+
+  if (priv->storage == CHAMPLAIN_FILE_CACHE_STORAGE_DATABASE)
+    {
+      for (iter = jobs; iter; iter = iter->next)
+        {
+          if (begin_store (file_cache, iter->data, &stores))
+            db_update_tile (file_cache, iter->data, TRUE);
+        }
+
+      commit_stores (stores);
+      return;
+    }
+
+  if (!open_worker_db (file_cache))
+    return;
+
+  sqlite3_exec (priv->worker_db, "BEGIN", NULL, NULL, NULL);
+  for (iter = jobs; iter; iter = iter->next)
+    {
+      WorkerJob *job = iter->data;
+
+      /* Tiles may not be present in this cache */
+      sqlite3_reset (priv->stmt_worker_popularity);
+      sqlite3_bind_int (priv->stmt_worker_popularity, 1, job->popularity);
+      sqlite3_bind_text (priv->stmt_worker_popularity, 2, job->filename, -1, SQLITE_STATIC);
+      sqlite3_step (priv->stmt_worker_popularity);
+    }
+  sqlite3_reset (priv->stmt_worker_popularity);
+  sqlite3_exec (priv->worker_db, "COMMIT", NULL, NULL, NULL);
+}
+
+
+static void
+write_pending (ChamplainFileCache *file_cache)
+{
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  GList *jobs;
+
+  /* The tiles stay visible to fill_tile() until they are written */
+  g_mutex_lock (priv->lock);
+  priv->writing = priv->pending;
+  priv->pending = g_hash_table_new_full (champlain_tile_key_hash, champlain_tile_key_equal,
+        NULL, (GDestroyNotify) free_job);
+  g_mutex_unlock (priv->lock);
+
+  jobs = g_hash_table_get_values (priv->writing);
+  if (jobs)
+    {
+      DEBUG ("Writing %u tiles", g_list_length (jobs));
+
+      if (priv->storage == CHAMPLAIN_FILE_CACHE_STORAGE_DATABASE)
+        write_databases (file_cache, jobs);
+      else
+        write_files (file_cache, jobs);
+      g_list_free (jobs);
+    }
+
+  g_mutex_lock (priv->lock);
+  g_hash_table_destroy (priv->writing);
+  priv->writing = NULL;
+  g_mutex_unlock (priv->lock);
+}
+
+
+/* Deletes up to PURGE_CHUNK least popular tiles until the cache is below
+ * the target, returns the number of deleted tiles */
+static guint
+purge_files_chunk (ChamplainFileCache *file_cache,
+    WorkerJob *job)
+{
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  GPtrArray *filenames = g_ptr_array_new ();
+  GArray *sizes = g_array_new (FALSE, FALSE, sizeof (gint64));
+  guint i;
+
+  sqlite3_reset (priv->stmt_worker_purge);
+  sqlite3_bind_int (priv->stmt_worker_purge, 1, PURGE_CHUNK);
+  while (sqlite3_step (priv->stmt_worker_purge) == SQLITE_ROW)
+    {
+      gint64 size = sqlite3_column_int64 (priv->stmt_worker_purge, 1);
+
+      g_ptr_array_add (filenames,
+          g_strdup ((const gchar *) sqlite3_column_text (priv->stmt_worker_purge, 0)));
+      g_array_append_val (sizes, size);
+      priv->purged_popularity = sqlite3_column_int64 (priv->stmt_worker_purge, 2);
+    }
+  sqlite3_reset (priv->stmt_worker_purge);
+
+  for (i = 0; i < filenames->len && get_total_size (file_cache) > job->target; i++)
+    {
+      const gchar *filename = g_ptr_array_index (filenames, i);
+      gint64 size = g_array_index (sizes, gint64, i);
+
+      DEBUG ("Deleting %s of size %" G_GINT64_FORMAT, filename, size);
+
+      sqlite3_reset (priv->stmt_worker_delete);
+      sqlite3_bind_text (priv->stmt_worker_delete, 1, filename, -1, SQLITE_STATIC);
+      if (sqlite3_step (priv->stmt_worker_delete) != SQLITE_DONE)
+        DEBUG ("Deleting tile from db failed: %s", sqlite3_errmsg (priv->worker_db));
+
+      if (g_unlink (filename) == -1)
+        DEBUG ("Deleting tile from disk failed: %s", g_strerror (errno));
+
+      add_total_size (file_cache, -size);
+      job->freed += size;
+    }
+  sqlite3_reset (priv->stmt_worker_delete);
+
+  g_ptr_array_foreach (filenames, (GFunc) g_free, NULL);
+  g_ptr_array_free (filenames, TRUE);
+  g_array_free (sizes, TRUE);
+
+  return i;
+}
+
+
+/* Deletes the least popular tiles; an image shared by several tiles is
+ * freed with the last of them */
+static guint
+purge_store_chunk (ChamplainFileCache *file_cache,
+    TileStore *store,
+    WorkerJob *job)
+{
+  GArray *rowids = g_array_new (FALSE, FALSE, sizeof (gint64));
+  GPtrArray *tile_ids = g_ptr_array_new_with_free_func (g_free);
+  guint i;
+
+  sqlite3_reset (store->stmt_purge);
+  sqlite3_bind_int (store->stmt_purge, 1, PURGE_CHUNK);
+  while (sqlite3_step (store->stmt_purge) == SQLITE_ROW)
+    {
+      gint64 rowid = sqlite3_column_int64 (store->stmt_purge, 0);
+
+      g_array_append_val (rowids, rowid);
+      g_ptr_array_add (tile_ids,
+          g_strdup ((const gchar *) sqlite3_column_text (store->stmt_purge, 1)));
+      store->purged_popularity = sqlite3_column_int64 (store->stmt_purge, 2);
+    }
+  sqlite3_reset (store->stmt_purge);
+
+  for (i = 0; i < rowids->len && get_total_size (file_cache) > job->target; i++)
+    {
+      gint64 size;
+
+      sqlite3_reset (store->stmt_delete);
+      sqlite3_bind_int64 (store->stmt_delete, 1, g_array_index (rowids, gint64, i));
+      if (sqlite3_step (store->stmt_delete) != SQLITE_DONE)
         {
-          const gchar *etag = (const gchar *) sqlite3_column_text (priv->stmt_select, 0);
-          champlain_tile_set_etag (CHAMPLAIN_TILE (tile), etag);
+          DEBUG ("Deleting tile failed: %s", sqlite3_errmsg (store->db));
+          continue;
         }
-      else if (sql_rc == SQLITE_DONE)
+
+      size = unref_image (store, g_ptr_array_index (tile_ids, i));
+      add_total_size (file_cache, -size);
+      job->freed += size;
+    }
+  sqlite3_reset (store->stmt_delete);
+
+  g_array_free (rowids, TRUE);
+  g_ptr_array_free (tile_ids, TRUE);
+
+  return i;
+}
+
+
+/* Lets new tiles compete with the popularity of the remaining ones by
+ * starting them at the popularity of the last deleted tile */
+static void
+age_popularity (sqlite3 *db,
+    gint64 *base,
+    gint64 purged_popularity)
+{
+  if (purged_popularity <= *base)
+    return;
+
+  *base = purged_popularity;
+  save_popularity_base (db, *base);
+}
+
+
+/* Purges the cache for at most PURGE_SLICE ms, sets job->found once the
+ * cache is below the target. The size limit applies to all the MBTiles
+ * databases in the cache directory together, they are all opened by
+ * JOB_OPEN_STORES when the cache starts; every slice deletes the least
+ * popular tiles of each. */
+static void
+purge_slice (ChamplainFileCache *file_cache,
+    WorkerJob *job)
+{
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  gboolean database = priv->storage == CHAMPLAIN_FILE_CACHE_STORAGE_DATABASE;
+  GHashTableIter iter;
+  TileStore *store;
+  GTimer *timer;
+  guint deleted;
+
+  job->found = TRUE;
+
+  if (!database && !open_worker_db (file_cache))
+    return;
+
+  if (job->freed == 0 && get_total_size (file_cache) <= job->limit)
+    {
+      DEBUG ("Cache doesn't need to be purged at %" G_GUINT64_FORMAT " bytes",
+          get_total_size (file_cache));
+      return;
+    }
+
+  timer = g_timer_new ();
+
+  if (database)
+    {
+      g_hash_table_iter_init (&iter, priv->stores);
+      while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &store))
+        sqlite3_exec (store->db, "BEGIN", NULL, NULL, NULL);
+    }
+  else
+    sqlite3_exec (priv->worker_db, "BEGIN", NULL, NULL, NULL);
+
+  do
+    {
+      if (database)
         {
-          DEBUG ("'%s' does't have an etag",
-              filename);
-          goto load_next;
+          deleted = 0;
+          g_hash_table_iter_init (&iter, priv->stores);
+          while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &store))
+            deleted += purge_store_chunk (file_cache, store, job);
         }
-      else if (sql_rc == SQLITE_ERROR)
+      else
+        deleted = purge_files_chunk (file_cache, job);
+    }
+  while (deleted > 0 && get_total_size (file_cache) > job->target &&
+         g_timer_elapsed (timer, NULL) * 1000 < PURGE_SLICE);
+
+  job->found = deleted == 0 || get_total_size (file_cache) <= job->target;
+
+  if (database)
+    {
+      g_hash_table_iter_init (&iter, priv->stores);
+      while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &store))
         {
-          DEBUG ("Failed to finding the Etag of '%s', %d error: %s",
-              filename, sql_rc, sqlite3_errmsg (priv->db));
-          goto load_next;
+          if (job->found)
+            age_popularity (store->db, &store->popularity_base, store->purged_popularity);
+          sqlite3_exec (store->db, "COMMIT", NULL, NULL, NULL);
         }
+    }
+  else
+    {
+      if (job->found)
+        age_popularity (priv->worker_db, &priv->popularity_base, priv->purged_popularity);
+      sqlite3_exec (priv->worker_db, "COMMIT", NULL, NULL, NULL);
+    }
+
+  DEBUG ("Freed %" G_GUINT64_FORMAT " bytes in %.3f s, cache size is now %" G_GUINT64_FORMAT,
+      job->freed, g_timer_elapsed (timer, NULL), get_total_size (file_cache));
+
+  g_timer_destroy (timer);
+}
+
+
+static void
+worker_thread (WorkerJob *job,
+    ChamplainFileCache *file_cache)
+{
+  gboolean database = file_cache->priv->storage == CHAMPLAIN_FILE_CACHE_STORAGE_DATABASE;
+
+  switch (job->type)
+    {
+    case JOB_LOAD:
+      if (database)
+        db_load_tile (file_cache, job);
+      else
+        load_file_metadata (file_cache, job);
+      break;
+
+    case JOB_LOAD_MISSING:
+      /* The database storage checks together with JOB_LOAD */
+      load_file_missing (file_cache, job);
+      break;
+
+    case JOB_STORE_MISSING:
+      if (database)
+        db_store_missing (file_cache, job);
+      else
+        store_file_missing (file_cache, job);
+      break;
+
+    case JOB_REFRESH:
+      if (database)
+        db_update_tile (file_cache, job, FALSE);
+      else
+        refresh_file_time (file_cache, job);
+      break;
+
+    case JOB_POPULARITY:
+      write_popularity (file_cache, job->jobs);
+      break;
+
+    case JOB_STORE:
+      /* Stored tiles wait in the pending table */
+      g_assert_not_reached ();
+      break;
+
+    case JOB_WRITE:
+      write_pending (file_cache);
+      break;
+
+    case JOB_FLUSH:
+      write_pending (file_cache);
+
+      /* The flushing thread waits for the job and frees it */
+      g_mutex_lock (file_cache->priv->lock);
+      job->found = TRUE;
+      g_cond_broadcast (file_cache->priv->flushed);
+      g_mutex_unlock (file_cache->priv->lock);
+      return;
+
+    case JOB_PURGE:
+      purge_slice (file_cache, job);
+      break;
+
+    case JOB_OPEN_STORES:
+      open_all_stores (file_cache);
+      break;
+    }
+
+  if (job->callback)
+    clutter_threads_add_idle_full (CLUTTER_PRIORITY_REDRAW, job->callback, job, NULL);
+  else
+    free_job (job);
+}
+
+
+static gboolean
+tile_is_expired (ChamplainFileCache *file_cache,
+    ChamplainTile *tile)
+{
+  g_return_val_if_fail (CHAMPLAIN_FILE_CACHE (file_cache), FALSE);
+  g_return_val_if_fail (CHAMPLAIN_TILE (tile), FALSE);
+
+  GTimeVal now = { 0, };
+  const GTimeVal *modified_time = champlain_tile_get_modified_time (tile);
+  const GTimeVal *expire_time = champlain_tile_get_expire_time (tile);
+  gboolean validate_cache = TRUE;
+
+  /* The server's caching headers, clamped by the network source */
+  if (expire_time)
+    {
+      g_get_current_time (&now);
+      validate_cache = expire_time->tv_sec <= now.tv_sec;
+    }
+  else if (modified_time)
+    {
+      g_get_current_time (&now);
+      g_time_val_add (&now, (-24ul * 60ul * 60ul * 1000ul * 1000ul * 7ul)); /* Cache expires in 7 days */
+      validate_cache = modified_time->tv_sec < now.tv_sec;
+    }
+
+  DEBUG ("%p is %s expired", tile, (validate_cache ? "" : "not"));
+
+  return validate_cache;
+}
+
+
+typedef struct
+{
+  ChamplainMapSource *map_source;
+  ChamplainTile *tile;
+  gboolean has_metadata;
+} FileLoadedData;
+
+static void
+fill_next (ChamplainMapSource *map_source,
+    ChamplainTile *tile)
+{
+  ChamplainMapSource *next_source = champlain_map_source_get_next_source (map_source);
+
+  if (CHAMPLAIN_IS_MAP_SOURCE (next_source))
+    champlain_map_source_fill_tile (next_source, tile);
+  else if (champlain_tile_get_state (tile) == CHAMPLAIN_STATE_LOADED)
+    {
+      /* if we have some content, use the tile even if it wasn't validated */
+      champlain_tile_set_state (tile, CHAMPLAIN_STATE_DONE);
+      champlain_tile_display_content (tile);
+    }
+}
+
+
+/* Continues the fill of a tile not found in the cache, skipping the tile
+ * source when it is known not to have the tile */
+static gboolean
+tile_not_found_cb (WorkerJob *job)
+{
+  ChamplainMapSource *map_source = CHAMPLAIN_MAP_SOURCE (job->file_cache);
+
+  if (job->missing)
+    {
+      DEBUG ("%p is missing in the tile source", job->tile);
+      champlain_tile_cache_fill_missing_tile (CHAMPLAIN_TILE_CACHE (map_source), job->tile);
+    }
+  else
+    fill_next (map_source, job->tile);
+
+  g_object_unref (job->tile);
+  g_object_unref (job->file_cache);
+  free_job (job);
+
+  return FALSE;
+}
+
+
+static void
+free_revalidation (Revalidation *revalidation)
+{
+  if (revalidation->tile)
+    g_object_remove_weak_pointer (G_OBJECT (revalidation->tile), (gpointer *) &revalidation->tile);
+
+  clutter_actor_destroy (CLUTTER_ACTOR (revalidation->revalidation));
+  g_object_unref (revalidation->revalidation);
+
+  g_slice_free (Revalidation, revalidation);
+}
+
+
+/* Replaces the displayed tile's content with the downloaded one */
+static void
+revalidation_done_cb (ChamplainTile *tile,
+    G_GNUC_UNUSED GParamSpec *pspec,
+    Revalidation *revalidation)
+{
+  ChamplainFileCache *file_cache = revalidation->file_cache;
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  ClutterActor *content;
+  ChamplainTileKey key;
+  gboolean same_tile = FALSE;
+
+  if (champlain_tile_get_state (tile) != CHAMPLAIN_STATE_DONE)
+    return;
+
+  g_signal_handlers_disconnect_by_func (tile, revalidation_done_cb, revalidation);
+
+  content = champlain_tile_get_content (tile);
+
+  /* The view recycles its tiles, the displayed one may show another
+   * place by now */
+  if (revalidation->tile)
+    {
+      champlain_tile_key_init (&key,
+          champlain_tile_cache_get_source_id (CHAMPLAIN_TILE_CACHE (file_cache)),
+          champlain_tile_get_zoom_level (revalidation->tile),
+          champlain_tile_get_x (revalidation->tile),
+          champlain_tile_get_y (revalidation->tile));
+      same_tile = champlain_tile_key_equal (&key, &revalidation->key);
+    }
+
+  /* Only a stored tile is new; not modified tiles have no content and
+   * failed downloads are rendered by the error source */
+  if (revalidation->updated && same_tile && content)
+    {
+      DEBUG ("Tile %p was updated", revalidation->tile);
+
+      g_object_ref (content);
+      if (clutter_actor_get_parent (content))
+        clutter_container_remove_actor (CLUTTER_CONTAINER (clutter_actor_get_parent (content)), content);
+      champlain_tile_set_content (revalidation->tile, content);
+      g_object_unref (content);
+
+      champlain_tile_set_fade_in (revalidation->tile, TRUE);
+      champlain_tile_display_content (revalidation->tile);
+    }
+
+  priv->revalidations_running--;
+  g_hash_table_remove (priv->revalidations, &revalidation->key);
+
+  if (g_queue_get_length (priv->revalidation_queue) > 0 && !priv->revalidate_source_id)
+    priv->revalidate_source_id = g_idle_add_full (G_PRIORITY_LOW,
+          (GSourceFunc) revalidate_on_idle, file_cache, NULL);
+
+  g_object_unref (file_cache);
+}
+
+
+/* Starts the queued revalidations once the main loop has nothing more
+ * urgent to do, such as requesting the missing tiles */
+static gboolean
+revalidate_on_idle (ChamplainFileCache *file_cache)
+{
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+
+  priv->revalidate_source_id = 0;
+
+  while (priv->revalidations_running < MAX_REVALIDATIONS &&
+         g_queue_get_length (priv->revalidation_queue) > 0)
+    {
+      Revalidation *revalidation = g_queue_pop_head (priv->revalidation_queue);
+
+      priv->revalidations_running++;
+      g_object_ref (file_cache);
+
+      g_signal_connect (revalidation->revalidation, "notify::state",
+          G_CALLBACK (revalidation_done_cb), revalidation);
+      fill_next (CHAMPLAIN_MAP_SOURCE (file_cache), revalidation->revalidation);
+    }
+
+  return FALSE;
+}
+
+
+/* Validates a copy of the displayed tile with the next source */
+static void
+queue_revalidation (ChamplainFileCache *file_cache,
+    ChamplainTile *tile)
+{
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  Revalidation *revalidation;
+  ChamplainTileKey key;
+  ChamplainTile *copy;
+
+  champlain_tile_key_init (&key,
+      champlain_tile_cache_get_source_id (CHAMPLAIN_TILE_CACHE (file_cache)),
+      champlain_tile_get_zoom_level (tile),
+      champlain_tile_get_x (tile),
+      champlain_tile_get_y (tile));
+
+  if (g_hash_table_lookup (priv->revalidations, &key) ||
+      g_queue_get_length (priv->revalidation_queue) >= MAX_QUEUED_REVALIDATIONS)
+    return;
+
+  copy = champlain_tile_new_full (champlain_tile_get_x (tile),
+        champlain_tile_get_y (tile),
+        champlain_tile_get_size (tile),
+        champlain_tile_get_zoom_level (tile));
+  g_object_ref_sink (copy);
+  champlain_tile_set_etag (copy, champlain_tile_get_etag (tile));
+  if (champlain_tile_get_modified_time (tile))
+    champlain_tile_set_modified_time (copy, champlain_tile_get_modified_time (tile));
+  champlain_tile_set_state (copy, CHAMPLAIN_STATE_LOADED);
+
+  revalidation = g_slice_new (Revalidation);
+  revalidation->key = key;
+  revalidation->file_cache = file_cache;
+  revalidation->tile = tile;
+  revalidation->revalidation = copy;
+  revalidation->updated = FALSE;
+  g_object_add_weak_pointer (G_OBJECT (tile), (gpointer *) &revalidation->tile);
+
+  g_hash_table_insert (priv->revalidations, &revalidation->key, revalidation);
+  g_queue_push_tail (priv->revalidation_queue, revalidation);
+
+  if (!priv->revalidate_source_id)
+    priv->revalidate_source_id = g_idle_add_full (G_PRIORITY_LOW,
+          (GSourceFunc) revalidate_on_idle, file_cache, NULL);
+}
+
+
+/* Finishes loading of a tile whose content and metadata are loaded */
+static void
+tile_loaded (ChamplainFileCache *file_cache,
+    ChamplainTile *tile)
+{
+  ChamplainMapSource *map_source = CHAMPLAIN_MAP_SOURCE (file_cache);
+  ChamplainMapSource *next_source = champlain_map_source_get_next_source (map_source);
+
+  /* Notify other caches that the tile has been filled */
+  if (CHAMPLAIN_IS_TILE_CACHE (next_source))
+    champlain_tile_cache_on_tile_filled (CHAMPLAIN_TILE_CACHE (next_source), tile);
+
+  if (!tile_is_expired (file_cache, tile) || file_cache->priv->stale_while_revalidate)
+    {
+      /* Tile loaded and no validation needed - done */
+      champlain_tile_set_fade_in (tile, FALSE);
+      champlain_tile_set_state (tile, CHAMPLAIN_STATE_DONE);
+      champlain_tile_display_content (tile);
+
+      if (tile_is_expired (file_cache, tile))
+        queue_revalidation (file_cache, tile);
+      return;
+    }
+
+  /* Validate the tile */
+  fill_next (map_source, tile);
+}
+
+
+static gboolean
+file_metadata_loaded_cb (WorkerJob *job)
+{
+  if (job->modified_time.tv_sec > 0)
+    champlain_tile_set_modified_time (job->tile, &job->modified_time);
+  if (job->expire_time.tv_sec > 0)
+    champlain_tile_set_expire_time (job->tile, &job->expire_time);
+  if (job->etag)
+    champlain_tile_set_etag (job->tile, job->etag);
+
+  tile_loaded (job->file_cache, job->tile);
+
+  g_object_unref (job->tile);
+  g_object_unref (job->file_cache);
+  free_job (job);
 
-      /* Validate the tile */
-      /* goto load_next; */
-    }
-  else
+  return FALSE;
+}
+
+
+static void
+tile_rendered_cb (ChamplainTile *tile,
+    gpointer data,
+    guint size,
+    gboolean error,
+    FileLoadedData *user_data)
+{
+  ChamplainMapSource *map_source = user_data->map_source;
+  gboolean has_metadata = user_data->has_metadata;
+  ChamplainFileCache *file_cache;
+  gchar filename[FILENAME_SIZE];
+
+  g_signal_handlers_disconnect_by_func (tile, tile_rendered_cb, user_data);
+  g_slice_free (FileLoadedData, user_data);
+
+  file_cache = CHAMPLAIN_FILE_CACHE (map_source);
+
+  if (error)
     {
-      /* Tile loaded and no validation needed - done */
-      champlain_tile_set_fade_in (tile, FALSE);
-      champlain_tile_set_state (tile, CHAMPLAIN_STATE_DONE);
-      champlain_tile_display_content (tile);
+      DEBUG ("Tile rendering failed");
+      fill_next (map_source, tile);
       goto cleanup;
     }
 
-load_next:
-  if (CHAMPLAIN_IS_MAP_SOURCE (next_source))
-    champlain_map_source_fill_tile (next_source, tile);
-  else if (champlain_tile_get_state (tile) == CHAMPLAIN_STATE_LOADED)
+  champlain_tile_set_state (tile, CHAMPLAIN_STATE_LOADED);
+
+  /* The database storage loads the modification time and etag together with
+   * the tile, the file storage gets them from the worker */
+  if (!has_metadata)
     {
-      /* if we have some content, use the tile even if it wasn't validated */
-      champlain_tile_set_state (tile, CHAMPLAIN_STATE_DONE);
-      champlain_tile_display_content (tile);
+      WorkerJob *job;
+
+      if (!get_filename (file_cache, tile, filename))
+        {
+          fill_next (map_source, tile);
+          goto cleanup;
+        }
+
+      /* The job takes over the references */
+      job = new_job (file_cache, JOB_LOAD, tile);
+      job->tile = tile;
+      job->filename = g_strdup (filename);
+      job->callback = (GSourceFunc) file_metadata_loaded_cb;
+      push_job (file_cache, job);
+      return;
     }
 
+  tile_loaded (file_cache, tile);
+
 cleanup:
-  g_free (filename);
   g_object_unref (tile);
   g_object_unref (map_source);
 }
 
 
+static void
+render_tile (FileLoadedData *user_data,
+    const gchar *contents,
+    gsize length)
+{
+  ChamplainRenderer *renderer;
+
+  renderer = champlain_map_source_get_renderer (user_data->map_source);
+
+  g_return_if_fail (CHAMPLAIN_IS_RENDERER (renderer));
+
+  g_signal_connect (user_data->tile, "render-complete", G_CALLBACK (tile_rendered_cb), user_data);
+
+  champlain_renderer_set_data (renderer, contents, length);
+  champlain_renderer_render (renderer, user_data->tile);
+}
+
+
 static void
 file_loaded_cb (GFile *file,
     GAsyncResult *res,
@@ -634,35 +2790,111 @@ file_loaded_cb (GFile *file,
   gchar *contents;
   gsize length;
   GError *error = NULL;
-  ChamplainTile *tile = user_data->tile;
-  ChamplainMapSource *map_source = user_data->map_source;
-  ChamplainRenderer *renderer;
 
   ok = g_file_load_contents_finish (file, res, &contents, &length, NULL, &error);
 
   if (!ok)
     {
+      WorkerJob *job;
       gchar *path;
 
       path = g_file_get_path (file);
       DEBUG ("Failed to load tile %s, error: %s", path, error->message);
-      g_free (path);
-      contents = NULL;
-      length = 0;
       g_error_free (error);
+      g_object_unref (file);
+
+      /* The job takes over the references */
+      job = new_job (CHAMPLAIN_FILE_CACHE (user_data->map_source), JOB_LOAD_MISSING, user_data->tile);
+      job->tile = user_data->tile;
+      job->filename = path;
+      job->callback = (GSourceFunc) tile_not_found_cb;
+      g_slice_free (FileLoadedData, user_data);
+      push_job (job->file_cache, job);
+      return;
     }
 
   g_object_unref (file);
 
-  renderer = champlain_map_source_get_renderer (map_source);
+  render_tile (user_data, contents, length);
+  g_free (contents);
+}
 
-  g_return_if_fail (CHAMPLAIN_IS_RENDERER (renderer));
 
-  g_signal_connect (tile, "render-complete", G_CALLBACK (tile_rendered_cb), user_data);
+static gboolean
+db_tile_loaded_cb (WorkerJob *job)
+{
+  FileLoadedData *user_data;
 
-  champlain_renderer_set_data (renderer, contents, length);
+  if (!job->found)
+    return tile_not_found_cb (job);
+
+  if (job->modified_time.tv_sec > 0)
+    champlain_tile_set_modified_time (job->tile, &job->modified_time);
+  if (job->expire_time.tv_sec > 0)
+    champlain_tile_set_expire_time (job->tile, &job->expire_time);
+  if (job->etag)
+    champlain_tile_set_etag (job->tile, job->etag);
+
+  /* The rendering takes over the references */
+  user_data = g_slice_new (FileLoadedData);
+  user_data->tile = job->tile;
+  user_data->map_source = CHAMPLAIN_MAP_SOURCE (job->file_cache);
+  user_data->has_metadata = TRUE;
+
+  render_tile (user_data, job->data, job->size);
+  free_job (job);
+
+  return FALSE;
+}
+
+
+/* Renders a stored tile which hasn't been written yet */
+static gboolean
+load_pending (ChamplainFileCache *file_cache,
+    ChamplainTile *tile)
+{
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  FileLoadedData *user_data;
+  WorkerJob *job;
+  ChamplainTileKey key;
+  gchar *contents = NULL;
+  gsize length = 0;
+
+  champlain_tile_key_init (&key,
+      champlain_tile_cache_get_source_id (CHAMPLAIN_TILE_CACHE (file_cache)),
+      champlain_tile_get_zoom_level (tile),
+      champlain_tile_get_x (tile),
+      champlain_tile_get_y (tile));
+
+  g_mutex_lock (priv->lock);
+  job = g_hash_table_lookup (priv->pending, &key);
+  if (!job && priv->writing)
+    job = g_hash_table_lookup (priv->writing, &key);
+  if (job)
+    {
+      contents = g_memdup (job->data, job->size);
+      length = job->size;
+      champlain_tile_set_etag (tile, job->etag);
+      champlain_tile_set_modified_time (tile, &job->modified_time);
+      if (job->expire_time.tv_sec > 0)
+        champlain_tile_set_expire_time (tile, &job->expire_time);
+    }
+  g_mutex_unlock (priv->lock);
+
+  if (!job)
+    return FALSE;
+
+  DEBUG ("fill of %p from the write queue", tile);
+
+  user_data = g_slice_new (FileLoadedData);
+  user_data->tile = g_object_ref (tile);
+  user_data->map_source = g_object_ref (file_cache);
+  user_data->has_metadata = TRUE;
+
+  render_tile (user_data, contents, length);
   g_free (contents);
-  champlain_renderer_render (renderer, tile);
+
+  return TRUE;
 }
 
 
@@ -673,40 +2905,50 @@ fill_tile (ChamplainMapSource *map_source,
   g_return_if_fail (CHAMPLAIN_IS_FILE_CACHE (map_source));
   g_return_if_fail (CHAMPLAIN_IS_TILE (tile));
 
-  ChamplainMapSource *next_source = champlain_map_source_get_next_source (map_source);
+  ChamplainFileCache *file_cache = CHAMPLAIN_FILE_CACHE (map_source);
+  gchar filename[FILENAME_SIZE];
 
   if (champlain_tile_get_state (tile) == CHAMPLAIN_STATE_DONE)
     return;
 
-  if (champlain_tile_get_state (tile) != CHAMPLAIN_STATE_LOADED)
+  if (champlain_tile_get_state (tile) != CHAMPLAIN_STATE_LOADED &&
+      load_pending (file_cache, tile))
+    return;
+
+  if (champlain_tile_get_state (tile) != CHAMPLAIN_STATE_LOADED &&
+      file_cache->priv->storage == CHAMPLAIN_FILE_CACHE_STORAGE_DATABASE)
+    {
+      WorkerJob *job;
+
+      job = new_job (file_cache, JOB_LOAD, tile);
+      job->tile = g_object_ref (tile);
+      job->callback = (GSourceFunc) db_tile_loaded_cb;
+      g_object_ref (file_cache);
+
+      push_job (file_cache, job);
+    }
+  else if (champlain_tile_get_state (tile) != CHAMPLAIN_STATE_LOADED &&
+      get_filename (file_cache, tile, filename))
     {
       FileLoadedData *user_data;
-      gchar *filename;
       GFile *file;
 
-      filename = get_filename (CHAMPLAIN_FILE_CACHE (map_source), tile);
+      DEBUG ("fill of %s", filename);
+
       file = g_file_new_for_path (filename);
-      g_free (filename);
 
       user_data = g_slice_new (FileLoadedData);
       user_data->tile = tile;
       user_data->map_source = map_source;
+      user_data->has_metadata = FALSE;
 
       g_object_ref (tile);
       g_object_ref (map_source);
 
-      DEBUG ("fill of %s", filename);
-
       g_file_load_contents_async (file, NULL, (GAsyncReadyCallback) file_loaded_cb, user_data);
     }
-  else if (CHAMPLAIN_IS_MAP_SOURCE (next_source))
-    champlain_map_source_fill_tile (next_source, tile);
-  else if (champlain_tile_get_state (tile) == CHAMPLAIN_STATE_LOADED)
-    {
-      /* if we have some content, use the tile even if it wasn't validated */
-      champlain_tile_set_state (tile, CHAMPLAIN_STATE_DONE);
-      champlain_tile_display_content (tile);
-    }
+  else
+    fill_next (map_source, tile);
 }
 
 
@@ -719,33 +2961,55 @@ refresh_tile_time (ChamplainTileCache *tile_cache,
   ChamplainMapSource *map_source = CHAMPLAIN_MAP_SOURCE (tile_cache);
   ChamplainMapSource *next_source = champlain_map_source_get_next_source (map_source);
   ChamplainFileCache *file_cache = CHAMPLAIN_FILE_CACHE (tile_cache);
-  gchar *filename = NULL;
-  GFile *file;
-  GFileInfo *info;
+  gchar filename[FILENAME_SIZE];
+  WorkerJob *job;
 
-  filename = get_filename (file_cache, tile);
-  file = g_file_new_for_path (filename);
-  g_free (filename);
+  if (file_cache->priv->storage == CHAMPLAIN_FILE_CACHE_STORAGE_FILES &&
+      !get_filename (file_cache, tile, filename))
+    goto refresh_next;
 
-  info = g_file_query_info (file, G_FILE_ATTRIBUTE_TIME_MODIFIED,
-        G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  job = new_job (file_cache, JOB_REFRESH, tile);
+  if (file_cache->priv->storage == CHAMPLAIN_FILE_CACHE_STORAGE_FILES)
+    job->filename = g_strdup (filename);
+  if (champlain_tile_get_expire_time (tile))
+    job->expire_time = *champlain_tile_get_expire_time (tile);
+  push_job (file_cache, job);
 
-  if (info)
-    {
-      GTimeVal now = { 0, };
+refresh_next:
+  if (CHAMPLAIN_IS_TILE_CACHE (next_source))
+    champlain_tile_cache_refresh_tile_time (CHAMPLAIN_TILE_CACHE (next_source), tile);
+}
 
-      g_get_current_time (&now);
 
-      g_file_info_set_modification_time (info, &now);
-      g_file_set_attributes_from_info (file, info, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+/* Starts a purge when the written tiles got the cache over the limit */
+static gboolean
+tiles_written_cb (WorkerJob *job)
+{
+  ChamplainFileCache *file_cache = job->file_cache;
 
-      g_object_unref (info);
-    }
+  if (get_total_size (file_cache) > file_cache->priv->size_limit)
+    champlain_file_cache_purge (file_cache);
 
-  g_object_unref (file);
+  g_object_unref (file_cache);
+  free_job (job);
 
-  if (CHAMPLAIN_IS_TILE_CACHE (next_source))
-    champlain_tile_cache_refresh_tile_time (CHAMPLAIN_TILE_CACHE (next_source), tile);
+  return FALSE;
+}
+
+
+static gboolean
+write_on_idle (ChamplainFileCache *file_cache)
+{
+  WorkerJob *job;
+
+  file_cache->priv->write_source_id = 0;
+
+  job = new_job (file_cache, JOB_WRITE, NULL);
+  job->callback = (GSourceFunc) tiles_written_cb;
+  g_object_ref (file_cache);
+  push_job (file_cache, job);
+
+  return FALSE;
 }
 
 
@@ -761,143 +3025,159 @@ store_tile (ChamplainTileCache *tile_cache,
   ChamplainMapSource *next_source = champlain_map_source_get_next_source (map_source);
   ChamplainFileCache *file_cache = CHAMPLAIN_FILE_CACHE (tile_cache);
   ChamplainFileCachePrivate *priv = file_cache->priv;
-  gchar *query = NULL;
-  gchar *error = NULL;
-  gchar *path = NULL;
-  gchar *filename = NULL;
-  GError *gerror = NULL;
-  GFile *file;
-  GFileOutputStream *ostream;
-  gsize bytes_written;
+  gchar filename[FILENAME_SIZE];
+  Revalidation *revalidation;
+  WorkerJob *job;
 
   DEBUG ("Update of %p", tile);
 
-  filename = get_filename (file_cache, tile);
-  file = g_file_new_for_path (filename);
-
-  /* If the file exists, delete it */
-  g_file_delete (file, NULL, NULL);
+  if (priv->storage == CHAMPLAIN_FILE_CACHE_STORAGE_FILES &&
+      !get_filename (file_cache, tile, filename))
+    goto store_next;
 
-  /* If needed, create the cache's dirs */
-  path = g_path_get_dirname (filename);
-  if (g_mkdir_with_parents (path, 0700) == -1)
-    {
-      if (errno != EEXIST)
-        {
-          g_warning ("Unable to create the image cache path '%s': %s",
-              path, g_strerror (errno));
-          goto store_next;
-        }
-    }
+  job = new_job (file_cache, JOB_STORE, tile);
 
-  ostream = g_file_create (file, G_FILE_CREATE_PRIVATE, NULL, &gerror);
-  if (!ostream)
-    {
-      DEBUG ("GFileOutputStream creation failed: %s", gerror->message);
-      g_error_free (gerror);
-      goto store_next;
-    }
+  /* A background revalidation downloaded a newer version */
+  revalidation = g_hash_table_lookup (priv->revalidations, &job->key);
+  if (revalidation && revalidation->revalidation == tile)
+    revalidation->updated = TRUE;
 
-  /* Write the cache */
-  if (!g_output_stream_write_all (G_OUTPUT_STREAM (ostream), contents, size, &bytes_written, NULL, &gerror))
-    {
-      DEBUG ("Writing file contents failed: %s", gerror->message);
-      g_error_free (gerror);
-      g_object_unref (ostream);
-      goto store_next;
-    }
+  if (priv->storage == CHAMPLAIN_FILE_CACHE_STORAGE_FILES)
+    job->filename = g_strdup (filename);
+  job->data = g_memdup (contents, size);
+  job->size = size;
+  job->etag = g_strdup (champlain_tile_get_etag (tile));
+  g_get_current_time (&job->modified_time);
+  if (champlain_tile_get_expire_time (tile))
+    job->expire_time = *champlain_tile_get_expire_time (tile);
 
-  g_object_unref (ostream);
+  /* Replaces an older store of the tile which wasn't written yet */
+  g_mutex_lock (priv->lock);
+  g_hash_table_replace (priv->pending, &job->key, job);
+  g_mutex_unlock (priv->lock);
 
-  query = sqlite3_mprintf ("REPLACE INTO tiles (filename, etag, size) VALUES (%Q, %Q, %d)",
-        filename,
-        champlain_tile_get_etag (tile),
-        size);
-  sqlite3_exec (priv->db, query, NULL, NULL, &error);
-  if (error != NULL)
-    {
-      DEBUG ("Saving Etag and size failed: %s", error);
-      sqlite3_free (error);
-    }
-  sqlite3_free (query);
+  if (!priv->write_source_id)
+    priv->write_source_id = g_timeout_add (WRITE_DELAY, (GSourceFunc) write_on_idle, file_cache);
 
 store_next:
   if (CHAMPLAIN_IS_TILE_CACHE (next_source))
     champlain_tile_cache_store_tile (CHAMPLAIN_TILE_CACHE (next_source), tile, contents, size);
-
-  g_free (filename);
-  g_free (path);
-  g_object_unref (file);
 }
 
 
 static void
-on_tile_filled (ChamplainTileCache *tile_cache,
+store_missing_tile (ChamplainTileCache *tile_cache,
     ChamplainTile *tile)
 {
   g_return_if_fail (CHAMPLAIN_IS_FILE_CACHE (tile_cache));
-  g_return_if_fail (CHAMPLAIN_IS_TILE (tile));
 
   ChamplainMapSource *map_source = CHAMPLAIN_MAP_SOURCE (tile_cache);
   ChamplainMapSource *next_source = champlain_map_source_get_next_source (map_source);
   ChamplainFileCache *file_cache = CHAMPLAIN_FILE_CACHE (tile_cache);
-  ChamplainFileCachePrivate *priv = file_cache->priv;
-  int sql_rc = SQLITE_OK;
-  gchar *filename = NULL;
+  const GTimeVal *expire_time = champlain_tile_get_expire_time (tile);
+  gchar filename[FILENAME_SIZE];
+  WorkerJob *job;
 
-  filename = get_filename (file_cache, tile);
+  if (!expire_time)
+    goto store_next;
 
-  DEBUG ("popularity of %s", filename);
+  if (file_cache->priv->storage == CHAMPLAIN_FILE_CACHE_STORAGE_FILES &&
+      !get_filename (file_cache, tile, filename))
+    goto store_next;
 
-  sqlite3_reset (priv->stmt_update);
-  sql_rc = sqlite3_bind_text (priv->stmt_update, 1, filename, -1, SQLITE_STATIC);
-  if (sql_rc != SQLITE_OK)
-    {
-      DEBUG ("Failed to set values to the popularity query of '%s', error: %s",
-          filename, sqlite3_errmsg (priv->db));
-      goto call_next;
-    }
+  DEBUG ("%p is missing in the tile source", tile);
 
-  sql_rc = sqlite3_step (priv->stmt_update);
-  if (sql_rc != SQLITE_DONE)
-    {
-      /* may not be present in this cache */
-      goto call_next;
-    }
+  job = new_job (file_cache, JOB_STORE_MISSING, tile);
+  if (file_cache->priv->storage == CHAMPLAIN_FILE_CACHE_STORAGE_FILES)
+    job->filename = g_strdup (filename);
+  job->expire_time = *expire_time;
+  push_job (file_cache, job);
 
-call_next:
-  g_free (filename);
+store_next:
   if (CHAMPLAIN_IS_TILE_CACHE (next_source))
-    champlain_tile_cache_on_tile_filled (CHAMPLAIN_TILE_CACHE (next_source), tile);
+    champlain_tile_cache_store_missing_tile (CHAMPLAIN_TILE_CACHE (next_source), tile);
 }
 
 
+/* Hands the popularity gained since the last update to the worker */
 static void
-delete_tile (ChamplainFileCache *file_cache, const gchar *filename)
+update_popularity (ChamplainFileCache *file_cache)
 {
-  g_return_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache));
-  gchar *query, *error = NULL;
-  GError *gerror = NULL;
-  GFile *file;
-
   ChamplainFileCachePrivate *priv = file_cache->priv;
+  WorkerJob *job;
 
-  query = sqlite3_mprintf ("DELETE FROM tiles WHERE filename = %Q", filename);
-  sqlite3_exec (priv->db, query, NULL, NULL, &error);
-  if (error != NULL)
+  if (priv->popularity_source_id)
     {
-      DEBUG ("Deleting tile from db failed: %s", error);
-      sqlite3_free (error);
+      g_source_remove (priv->popularity_source_id);
+      priv->popularity_source_id = 0;
     }
-  sqlite3_free (query);
 
-  file = g_file_new_for_path (filename);
-  if (!g_file_delete (file, NULL, &gerror))
+  if (g_hash_table_size (priv->popularity) == 0)
+    return;
+
+  job = new_job (file_cache, JOB_POPULARITY, NULL);
+  job->jobs = g_hash_table_get_values (priv->popularity);
+  g_hash_table_steal_all (priv->popularity);
+
+  push_job (file_cache, job);
+}
+
+
+static gboolean
+update_popularity_on_idle (ChamplainFileCache *file_cache)
+{
+  file_cache->priv->popularity_source_id = 0;
+  update_popularity (file_cache);
+
+  return FALSE;
+}
+
+
+static void
+on_tile_filled (ChamplainTileCache *tile_cache,
+    ChamplainTile *tile)
+{
+  g_return_if_fail (CHAMPLAIN_IS_FILE_CACHE (tile_cache));
+  g_return_if_fail (CHAMPLAIN_IS_TILE (tile));
+
+  ChamplainMapSource *map_source = CHAMPLAIN_MAP_SOURCE (tile_cache);
+  ChamplainMapSource *next_source = champlain_map_source_get_next_source (map_source);
+  ChamplainFileCache *file_cache = CHAMPLAIN_FILE_CACHE (tile_cache);
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  ChamplainTileKey key;
+  WorkerJob *job;
+  gchar filename[FILENAME_SIZE];
+
+  champlain_tile_key_init (&key,
+      champlain_tile_cache_get_source_id (tile_cache),
+      champlain_tile_get_zoom_level (tile),
+      champlain_tile_get_x (tile),
+      champlain_tile_get_y (tile));
+
+  /* Counted in memory, written every POPULARITY_INTERVAL seconds */
+  job = g_hash_table_lookup (priv->popularity, &key);
+  if (job)
+    job->popularity++;
+  else
     {
-      DEBUG ("Deleting tile from disk failed: %s", gerror->message);
-      g_error_free (gerror);
+      if (priv->storage == CHAMPLAIN_FILE_CACHE_STORAGE_FILES &&
+          !get_filename (file_cache, tile, filename))
+        goto call_next;
+
+      job = new_job (file_cache, JOB_POPULARITY, tile);
+      if (priv->storage == CHAMPLAIN_FILE_CACHE_STORAGE_FILES)
+        job->filename = g_strdup (filename);
+      job->popularity = 1;
+      g_hash_table_insert (priv->popularity, &job->key, job);
     }
-  g_object_unref (file);
+
+  if (!priv->popularity_source_id)
+    priv->popularity_source_id = g_timeout_add_seconds (POPULARITY_INTERVAL,
+          (GSourceFunc) update_popularity_on_idle, file_cache);
+
+call_next:
+  if (CHAMPLAIN_IS_TILE_CACHE (next_source))
+    champlain_tile_cache_on_tile_filled (CHAMPLAIN_TILE_CACHE (next_source), tile);
 }
 
 
@@ -930,88 +3210,105 @@ champlain_file_cache_purge_on_idle (ChamplainFileCache *file_cache)
 
 
 /**
- * champlain_file_cache_purge:
+ * champlain_file_cache_flush:
  * @file_cache: a #ChamplainFileCache
  *
- * Purge the cache from the less popular tiles until cache's size limit is reached.
+ * Stored tiles are written to the disk in batches by a background thread.
+ * This function writes the tiles stored so far and waits until they are on
+ * the disk, e.g. before the application quits.
  *
- * Since: 0.4
+ * Since: 0.14
  */
 void
-champlain_file_cache_purge (ChamplainFileCache *file_cache)
+champlain_file_cache_flush (ChamplainFileCache *file_cache)
 {
   g_return_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache));
 
   ChamplainFileCachePrivate *priv = file_cache->priv;
-  gchar *query;
-  sqlite3_stmt *stmt;
-  int rc = 0;
-  guint current_size = 0;
-  guint highest_popularity = 0;
-  gchar *error;
+  WorkerJob *job;
 
-  query = "SELECT SUM (size) FROM tiles";
-  rc = sqlite3_prepare (priv->db, query, strlen (query), &stmt, NULL);
-  if (rc != SQLITE_OK)
-    {
-      DEBUG ("Can't compute cache size %s", sqlite3_errmsg (priv->db));
-    }
+  update_popularity (file_cache);
 
-  rc = sqlite3_step (stmt);
-  if (rc != SQLITE_ROW)
+  if (priv->write_source_id)
     {
-      DEBUG ("Failed to count the total cache consumption %s",
-          sqlite3_errmsg (priv->db));
-      sqlite3_finalize (stmt);
-      return;
+      g_source_remove (priv->write_source_id);
+      priv->write_source_id = 0;
     }
 
-  current_size = sqlite3_column_int (stmt, 0);
-  if (current_size < priv->size_limit)
-    {
-      DEBUG ("Cache doesn't need to be purged at %d bytes", current_size);
-      sqlite3_finalize (stmt);
-      return;
-    }
+  job = new_job (file_cache, JOB_FLUSH, NULL);
+  push_job (file_cache, job);
+
+  g_mutex_lock (priv->lock);
+  while (!job->found)
+    g_cond_wait (priv->flushed, priv->lock);
+  g_mutex_unlock (priv->lock);
 
-  sqlite3_finalize (stmt);
+  free_job (job);
+}
+
+
+static gboolean
+purge_progress_cb (WorkerJob *job)
+{
+  ChamplainFileCache *file_cache = job->file_cache;
+
+  if (job->freed > 0)
+    g_signal_emit (file_cache, champlain_file_cache_signals[PURGE_PROGRESS], 0,
+        (guint) MIN (job->freed, G_MAXUINT),
+        (guint) MIN (get_total_size (file_cache), G_MAXUINT));
 
-  /* Ok, delete the less popular tiles until size_limit reached */
-  query = "SELECT filename, size, popularity FROM tiles ORDER BY popularity";
-  rc = sqlite3_prepare (priv->db, query, strlen (query), &stmt, NULL);
-  if (rc != SQLITE_OK)
+  if (!job->found)
     {
-      DEBUG ("Can't fetch tiles to delete: %s", sqlite3_errmsg (priv->db));
+      /* The next slice runs after the jobs queued in the meantime */
+      push_job (file_cache, job);
+      return FALSE;
     }
 
-  rc = sqlite3_step (stmt);
-  while (rc == SQLITE_ROW && current_size > priv->size_limit)
-    {
-      const char *filename;
-      guint size;
+  file_cache->priv->purging = FALSE;
+  g_signal_emit (file_cache, champlain_file_cache_signals[PURGE_COMPLETED], 0,
+      (guint) MIN (job->freed, G_MAXUINT));
 
-      filename = (const char *) sqlite3_column_text (stmt, 0);
-      size = sqlite3_column_int (stmt, 1);
-      highest_popularity = sqlite3_column_int (stmt, 2);
-      DEBUG ("Deleting %s of size %d", filename, size);
+  g_object_unref (file_cache);
+  free_job (job);
 
-      delete_tile (file_cache, filename);
+  return FALSE;
+}
 
-      current_size -= size;
 
-      rc = sqlite3_step (stmt);
-    }
-  DEBUG ("Cache size is now %d", current_size);
+/**
+ * champlain_file_cache_purge:
+ * @file_cache: a #ChamplainFileCache
+ *
+ * Purge the cache from the less popular tiles if it is over its size limit.
+ * The tiles are deleted in a background thread, in short slices which let
+ * the tiles be loaded in the meantime, until the cache shrinks to the
+ * #ChamplainFileCache:low-water-mark. The progress is reported by the
+ * #ChamplainFileCache::purge-progress and
+ * #ChamplainFileCache::purge-completed signals.
+ *
+ * Since: 0.4
+ */
+void
+champlain_file_cache_purge (ChamplainFileCache *file_cache)
+{
+  g_return_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache));
 
-  sqlite3_finalize (stmt);
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  WorkerJob *job;
 
-  query = sqlite3_mprintf ("UPDATE tiles SET popularity = popularity - %d",
-        highest_popularity);
-  sqlite3_exec (priv->db, query, NULL, NULL, &error);
-  if (error != NULL)
-    {
-      DEBUG ("Updating popularity failed: %s", error);
-      sqlite3_free (error);
-    }
-  sqlite3_free (query);
+  if (priv->purging)
+    return;
+
+  /* Count the recent popularity */
+  update_popularity (file_cache);
+
+  priv->purging = TRUE;
+
+  job = new_job (file_cache, JOB_PURGE, NULL);
+  job->limit = priv->size_limit;
+  job->target = (guint64) priv->size_limit * priv->low_water_mark / 100;
+  job->callback = (GSourceFunc) purge_progress_cb;
+  g_object_ref (file_cache);
+
+  push_job (file_cache, job);
 }
@@ -46,6 +46,24 @@ G_BEGIN_DECLS
 #define CHAMPLAIN_FILE_CACHE_GET_CLASS(obj) \
   (G_TYPE_INSTANCE_GET_CLASS ((obj), CHAMPLAIN_TYPE_FILE_CACHE, ChamplainFileCacheClass))
 
+/**
+ * ChamplainFileCacheStorage:
+ * @CHAMPLAIN_FILE_CACHE_STORAGE_FILES: every tile is stored in its own file,
+ *     the metadata are kept in a separate database
+ * @CHAMPLAIN_FILE_CACHE_STORAGE_DATABASE: the tiles are stored in one
+ *     MBTiles-compatible SQLite database per map source, identical tiles
+ *     are stored only once
+ *
+ * The way #ChamplainFileCache stores the tiles on the disk.
+ *
+ * Since: 0.14
+ */
+typedef enum
+{
+  CHAMPLAIN_FILE_CACHE_STORAGE_FILES,
+  CHAMPLAIN_FILE_CACHE_STORAGE_DATABASE
+} ChamplainFileCacheStorage;
+
 typedef struct _ChamplainFileCachePrivate ChamplainFileCachePrivate;
 
 typedef struct _ChamplainFileCache ChamplainFileCache;
@@ -81,8 +99,20 @@ guint champlain_file_cache_get_size_limit (ChamplainFileCache *file_cache);
 void champlain_file_cache_set_size_limit (ChamplainFileCache *file_cache,
     guint size_limit);
 
+guint champlain_file_cache_get_low_water_mark (ChamplainFileCache *file_cache);
+void champlain_file_cache_set_low_water_mark (ChamplainFileCache *file_cache,
+    guint low_water_mark);
+
+gboolean champlain_file_cache_get_stale_while_revalidate (ChamplainFileCache *file_cache);
+void champlain_file_cache_set_stale_while_revalidate (ChamplainFileCache *file_cache,
+    gboolean value);
+
 const gchar *champlain_file_cache_get_cache_dir (ChamplainFileCache *file_cache);
 
+ChamplainFileCacheStorage champlain_file_cache_get_storage (ChamplainFileCache *file_cache);
+
+void champlain_file_cache_flush (ChamplainFileCache *file_cache);
+
 void champlain_file_cache_purge (ChamplainFileCache *file_cache);
 void champlain_file_cache_purge_on_idle (ChamplainFileCache *file_cache);
 
@@ -23,9 +23,18 @@
  * #ChamplainImageRenderer renders tiles from binary image data. The rendering
  * is performed using #GdkPixbufLoader so the set of supported image
  * formats is equal to the set of formats supported by #GdkPixbufLoader.
+ *
+ * With #ChamplainImageRenderer:use-atlas set, the decoded tiles are uploaded
+ * into large textures shared by many tiles, which reduces the number of
+ * draw calls needed to paint the map.
+ *
+ * Tiles of a single color, such as the sea, share one small texture per
+ * color.
  */
 
 #include "champlain-image-renderer.h"
+#include "champlain-tile-atlas.h"
+#include "champlain-solid-tile.h"
 #include <gdk/gdk.h>
 
 G_DEFINE_TYPE (ChamplainImageRenderer, champlain_image_renderer, CHAMPLAIN_TYPE_RENDERER)
@@ -33,10 +42,18 @@ G_DEFINE_TYPE (ChamplainImageRenderer, champlain_image_renderer, CHAMPLAIN_TYPE_
 #define GET_PRIVATE(o) \
   (G_TYPE_INSTANCE_GET_PRIVATE ((o), CHAMPLAIN_TYPE_IMAGE_RENDERER, ChamplainImageRendererPrivate))
 
+enum
+{
+  PROP_0,
+  PROP_USE_ATLAS
+};
+
 struct _ChamplainImageRendererPrivate
 {
   gchar *data;
   guint size;
+  gboolean use_atlas;
+  ChamplainTileAtlas *atlas;
 };
 
 static void set_data (ChamplainRenderer *renderer,
@@ -46,9 +63,58 @@ static void render (ChamplainRenderer *renderer,
     ChamplainTile *tile);
 
 
+static void
+champlain_image_renderer_get_property (GObject *object,
+    guint property_id,
+    GValue *value,
+    GParamSpec *pspec)
+{
+  ChamplainImageRenderer *renderer = CHAMPLAIN_IMAGE_RENDERER (object);
+
+  switch (property_id)
+    {
+    case PROP_USE_ATLAS:
+      g_value_set_boolean (value, champlain_image_renderer_get_use_atlas (renderer));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+
+static void
+champlain_image_renderer_set_property (GObject *object,
+    guint property_id,
+    const GValue *value,
+    GParamSpec *pspec)
+{
+  ChamplainImageRenderer *renderer = CHAMPLAIN_IMAGE_RENDERER (object);
+
+  switch (property_id)
+    {
+    case PROP_USE_ATLAS:
+      champlain_image_renderer_set_use_atlas (renderer, g_value_get_boolean (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+
 static void
 champlain_image_renderer_dispose (GObject *object)
 {
+  ChamplainImageRendererPrivate *priv = GET_PRIVATE (object);
+
+  /* the tiles in the atlas keep it alive as long as needed */
+  if (priv->atlas)
+    {
+      g_object_unref (priv->atlas);
+      priv->atlas = NULL;
+    }
+
   G_OBJECT_CLASS (champlain_image_renderer_parent_class)->dispose (object);
 }
 
@@ -74,6 +140,26 @@ champlain_image_renderer_class_init (ChamplainImageRendererClass *klass)
 
   object_class->finalize = champlain_image_renderer_finalize;
   object_class->dispose = champlain_image_renderer_dispose;
+  object_class->get_property = champlain_image_renderer_get_property;
+  object_class->set_property = champlain_image_renderer_set_property;
+
+  /**
+   * ChamplainImageRenderer:use-atlas:
+   *
+   * Upload the tiles into textures shared by many tiles instead of creating
+   * a texture per tile. This reduces the number of draw calls, which matters
+   * mostly with software OpenGL implementations. Only tiles of the size of
+   * the first rendered tile are stored in the atlas.
+   *
+   * Since: 0.14
+   */
+  g_object_class_install_property (object_class,
+      PROP_USE_ATLAS,
+      g_param_spec_boolean ("use-atlas",
+          "Use atlas",
+          "Store the tiles in shared textures",
+          FALSE,
+          G_PARAM_READWRITE));
 
   renderer_class->set_data = set_data;
   renderer_class->render = render;
@@ -88,6 +174,8 @@ champlain_image_renderer_init (ChamplainImageRenderer *self)
   self->priv = priv;
 
   priv->data = NULL;
+  priv->use_atlas = FALSE;
+  priv->atlas = NULL;
 }
 
 
@@ -107,6 +195,77 @@ champlain_image_renderer_new (void)
 }
 
 
+/**
+ * champlain_image_renderer_set_use_atlas:
+ * @renderer: a #ChamplainImageRenderer
+ * @use_atlas: TRUE to store the tiles in shared textures
+ *
+ * Sets whether the rendered tiles are stored in shared textures. Only
+ * tiles rendered afterwards are affected.
+ *
+ * Since: 0.14
+ */
+void
+champlain_image_renderer_set_use_atlas (ChamplainImageRenderer *renderer,
+    gboolean use_atlas)
+{
+  g_return_if_fail (CHAMPLAIN_IS_IMAGE_RENDERER (renderer));
+
+  ChamplainImageRendererPrivate *priv = renderer->priv;
+
+  priv->use_atlas = use_atlas;
+  if (!use_atlas && priv->atlas)
+    {
+      g_object_unref (priv->atlas);
+      priv->atlas = NULL;
+    }
+
+  g_object_notify (G_OBJECT (renderer), "use-atlas");
+}
+
+
+/**
+ * champlain_image_renderer_get_use_atlas:
+ * @renderer: a #ChamplainImageRenderer
+ *
+ * Checks whether the rendered tiles are stored in shared textures.
+ *
+ * Returns: TRUE if the atlas is used, FALSE otherwise
+ *
+ * Since: 0.14
+ */
+gboolean
+champlain_image_renderer_get_use_atlas (ChamplainImageRenderer *renderer)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_IMAGE_RENDERER (renderer), FALSE);
+
+  return renderer->priv->use_atlas;
+}
+
+
+static ClutterActor *
+atlas_actor_new (ChamplainImageRenderer *renderer,
+    GdkPixbuf *pixbuf)
+{
+  ChamplainImageRendererPrivate *priv = renderer->priv;
+  gint width = gdk_pixbuf_get_width (pixbuf);
+
+  if (gdk_pixbuf_get_bits_per_sample (pixbuf) != 8 ||
+      gdk_pixbuf_get_height (pixbuf) != width)
+    return NULL;
+
+  if (!priv->atlas)
+    priv->atlas = champlain_tile_atlas_new (width);
+  else if (champlain_tile_atlas_get_tile_size (priv->atlas) != (guint) width)
+    return NULL;
+
+  return champlain_tile_atlas_add_tile (priv->atlas,
+      gdk_pixbuf_get_pixels (pixbuf),
+      gdk_pixbuf_get_has_alpha (pixbuf),
+      gdk_pixbuf_get_rowstride (pixbuf));
+}
+
+
 static void
 set_data (ChamplainRenderer *renderer, const gchar *data, guint size)
 {
@@ -129,6 +288,7 @@ render (ChamplainRenderer *renderer, ChamplainTile *tile)
   GError *gerror = NULL;
   ClutterActor *actor = NULL;
   GdkPixbuf *pixbuf;
+  guint32 color;
 
   if (!priv->data || priv->size == 0)
     goto finish;
@@ -157,6 +317,31 @@ render (ChamplainRenderer *renderer, ChamplainTile *tile)
 
   /* Load the image into clutter */
   pixbuf = gdk_pixbuf_loader_get_pixbuf (loader);
+
+  if (gdk_pixbuf_get_bits_per_sample (pixbuf) == 8 &&
+      gdk_pixbuf_get_width (pixbuf) == gdk_pixbuf_get_height (pixbuf) &&
+      champlain_solid_tile_detect (gdk_pixbuf_get_pixels (pixbuf),
+          gdk_pixbuf_get_width (pixbuf),
+          gdk_pixbuf_get_height (pixbuf),
+          gdk_pixbuf_get_rowstride (pixbuf),
+          gdk_pixbuf_get_has_alpha (pixbuf),
+          &color))
+    {
+      actor = champlain_solid_tile_new (color, gdk_pixbuf_get_width (pixbuf));
+      error = FALSE;
+      goto finish;
+    }
+
+  if (priv->use_atlas)
+    {
+      actor = atlas_actor_new (CHAMPLAIN_IMAGE_RENDERER (renderer), pixbuf);
+      if (actor)
+        {
+          error = FALSE;
+          goto finish;
+        }
+    }
+
   actor = clutter_texture_new ();
   if (!clutter_texture_set_from_rgb_data (CLUTTER_TEXTURE (actor),
           gdk_pixbuf_get_pixels (pixbuf),
@@ -74,6 +74,10 @@ GType champlain_image_renderer_get_type (void);
 
 ChamplainImageRenderer *champlain_image_renderer_new (void);
 
+void champlain_image_renderer_set_use_atlas (ChamplainImageRenderer *renderer,
+    gboolean use_atlas);
+gboolean champlain_image_renderer_get_use_atlas (ChamplainImageRenderer *renderer);
+
 G_END_DECLS
 
 #endif /* __CHAMPLAIN_IMAGE_RENDERER_H__ */
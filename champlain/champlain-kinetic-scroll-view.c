@@ -21,6 +21,7 @@
  */
 
 #include "champlain-kinetic-scroll-view.h"
+#include "champlain-private.h"
 #include "champlain-enum-types.h"
 #include "champlain-marshal.h"
 #include "champlain-adjustment.h"
@@ -921,3 +922,45 @@ champlain_kinetic_scroll_view_stop (ChamplainKineticScrollView *scroll)
       priv->deceleration_timeline = NULL;
     }
 }
+
+
+/* Projects where the running deceleration comes to rest. The remaining
+ * motion is the geometric series applied by deceleration_new_frame_cb(),
+ * dx + dx / rate + dx / rate^2 + ... = dx * rate / (rate - 1).
+ * Returns FALSE when the view isn't decelerating.
+ */
+gboolean
+champlain_kinetic_scroll_view_get_deceleration_target (ChamplainKineticScrollView *scroll,
+    gdouble *x,
+    gdouble *y)
+{
+  ChamplainKineticScrollViewPrivate *priv;
+  ChamplainAdjustment *hadjust, *vadjust;
+  gdouble value, lower, upper, page_size;
+  gdouble factor;
+
+  g_return_val_if_fail (CHAMPLAIN_IS_KINETIC_SCROLL_VIEW (scroll), FALSE);
+
+  priv = scroll->priv;
+
+  if (!priv->deceleration_timeline || !priv->child)
+    return FALSE;
+
+  champlain_viewport_get_adjustments (CHAMPLAIN_VIEWPORT (priv->child),
+      &hadjust,
+      &vadjust);
+
+  factor = priv->decel_rate / (priv->decel_rate - 1.0);
+
+  champlain_adjustment_get_values (hadjust, &value, &lower, &upper,
+      NULL, NULL, &page_size);
+  if (x)
+    *x = CLAMP (value + priv->dx * factor, lower, MAX (lower, upper - page_size));
+
+  champlain_adjustment_get_values (vadjust, &value, &lower, &upper,
+      NULL, NULL, &page_size);
+  if (y)
+    *y = CLAMP (value + priv->dy * factor, lower, MAX (lower, upper - page_size));
+
+  return TRUE;
+}
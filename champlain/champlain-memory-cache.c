@@ -24,12 +24,34 @@
  * memory. The cache contents is not preserved between application restarts
  * so this cache serves mostly as a quick access temporary cache to the
  * most recently used tiles.
+ *
+ * When #ChamplainMemoryCache:synthesize-parents is set, a missing tile
+ * whose four children are cached decoded is shown downsampled from the
+ * children until the real tile arrives.
+ *
+ * With #ChamplainMemoryCache:store-decoded the cache keeps the textures of
+ * the rendered tiles instead of the encoded image data so a cache hit only
+ * needs a new texture actor sharing the cached texture, without decoding the
+ * image again. Decoded tiles take much more memory than the encoded ones;
+ * #ChamplainMemoryCache:byte-limit can be used to bound the memory used by
+ * the cache. Tiles rendered as a single color are always kept as just the
+ * color.
+ *
+ * By default the least recently used tiles are evicted first. With the
+ * %CHAMPLAIN_EVICTION_POLICY_2Q #ChamplainMemoryCache:eviction-policy new
+ * tiles first enter a short FIFO and only tiles requested again after
+ * having dropped out of it make it to the main LRU queue. Long pans then
+ * only cycle through the FIFO and don't flush the frequently used tiles.
  */
 
 #define DEBUG_FLAG CHAMPLAIN_DEBUG_CACHE
 #include "champlain-debug.h"
 
 #include "champlain-memory-cache.h"
+#include "champlain-marshal.h"
+#include "champlain-enum-types.h"
+#include "champlain-private.h"
+#include "champlain-solid-tile.h"
 
 #include <glib.h>
 #include <string.h>
@@ -42,26 +64,86 @@ G_DEFINE_TYPE (ChamplainMemoryCache, champlain_memory_cache, CHAMPLAIN_TYPE_TILE
 enum
 {
   PROP_0,
-  PROP_SIZE_LIMIT
+  PROP_SIZE_LIMIT,
+  PROP_SYNTHESIZE_PARENTS,
+  PROP_STORE_DECODED,
+  PROP_BYTE_LIMIT,
+  PROP_EVICTION_POLICY
+};
+
+enum
+{
+  /* normal signals */
+  TILES_EVICTED,
+  LAST_SIGNAL
 };
 
+static guint champlain_memory_cache_signals[LAST_SIGNAL] = { 0, };
+
 struct _ChamplainMemoryCachePrivate
 {
   guint size_limit;
-  GQueue *queue;
+  gboolean synthesize_parents;
+  gboolean store_decoded;
+  gsize byte_limit;
+  gsize total_bytes;
+  guint hits;
+  guint misses;
+  guint evictions;
+  ChamplainEvictionPolicy eviction_policy;
+  GQueue *queue; /* the LRU queue, or the main queue of 2Q */
   GHashTable *hash_table;
+
+  /* 2Q only */
+  GQueue *in_queue; /* FIFO of the tiles seen only recently */
+  gsize in_bytes;
+  GQueue *ghost_queue; /* keys of the tiles evicted from in_queue */
+  GHashTable *ghost_table;
+
+  GHashTable *missing_table; /* tiles the tile source has no data for */
 };
 
 typedef struct
 {
-  gchar *key;
+  ChamplainTileKey key;
   gchar *data;
   guint size;
+  CoglHandle texture;
+  gboolean solid; /* only the color of the tile is stored */
+  guint32 color;
+  gsize bytes;
+  gboolean in_fifo;
 } QueueMember;
 
+/* Estimated memory used by a member besides its contents: the member
+ * itself, its queue link and its hash table entry. GHashTable keeps between
+ * a third and nearly all of its key, value and hash slots used; two slots
+ * per entry are taken as the average. The overhead of the allocator itself
+ * isn't counted. */
+#define MEMBER_OVERHEAD (sizeof (QueueMember) + sizeof (GList) + \
+                         2 * (2 * sizeof (gpointer) + sizeof (guint)))
+
+/* The number of missing tiles remembered at most, not counted in
+ * total_bytes */
+#define MAX_MISSING_TILES 4096
+
+typedef struct
+{
+  ChamplainTileKey key;
+  glong expires;
+} MissingTile;
+
 
 static void fill_tile (ChamplainMapSource *map_source,
     ChamplainTile *tile);
+static void add_queue_member (ChamplainMemoryCache *memory_cache,
+    const ChamplainTileKey *key,
+    const gchar *contents,
+    gsize size);
+static void evict_tiles (ChamplainMemoryCache *memory_cache,
+    guint n_tiles,
+    gsize target_bytes);
+static void clear_ghosts (ChamplainMemoryCachePrivate *priv);
 
 static void store_tile (ChamplainTileCache *tile_cache,
     ChamplainTile *tile,
@@ -71,6 +153,8 @@ static void refresh_tile_time (ChamplainTileCache *tile_cache,
     ChamplainTile *tile);
 static void on_tile_filled (ChamplainTileCache *tile_cache,
     ChamplainTile *tile);
+static void store_missing_tile (ChamplainTileCache *tile_cache,
+    ChamplainTile *tile);
 
 
 static void
@@ -87,6 +171,22 @@ champlain_memory_cache_get_property (GObject *object,
       g_value_set_uint (value, champlain_memory_cache_get_size_limit (memory_cache));
       break;
 
+    case PROP_SYNTHESIZE_PARENTS:
+      g_value_set_boolean (value, champlain_memory_cache_get_synthesize_parents (memory_cache));
+      break;
+
+    case PROP_STORE_DECODED:
+      g_value_set_boolean (value, champlain_memory_cache_get_store_decoded (memory_cache));
+      break;
+
+    case PROP_BYTE_LIMIT:
+      g_value_set_ulong (value, champlain_memory_cache_get_byte_limit (memory_cache));
+      break;
+
+    case PROP_EVICTION_POLICY:
+      g_value_set_enum (value, champlain_memory_cache_get_eviction_policy (memory_cache));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -107,6 +207,22 @@ champlain_memory_cache_set_property (GObject *object,
       champlain_memory_cache_set_size_limit (memory_cache, g_value_get_uint (value));
       break;
 
+    case PROP_SYNTHESIZE_PARENTS:
+      champlain_memory_cache_set_synthesize_parents (memory_cache, g_value_get_boolean (value));
+      break;
+
+    case PROP_STORE_DECODED:
+      champlain_memory_cache_set_store_decoded (memory_cache, g_value_get_boolean (value));
+      break;
+
+    case PROP_BYTE_LIMIT:
+      champlain_memory_cache_set_byte_limit (memory_cache, g_value_get_ulong (value));
+      break;
+
+    case PROP_EVICTION_POLICY:
+      champlain_memory_cache_set_eviction_policy (memory_cache, g_value_get_enum (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -128,6 +244,10 @@ champlain_memory_cache_finalize (GObject *object)
   champlain_memory_cache_clean (memory_cache);
   g_queue_free (memory_cache->priv->queue);
   g_hash_table_destroy (memory_cache->priv->hash_table);
+  g_queue_free (memory_cache->priv->in_queue);
+  g_queue_free (memory_cache->priv->ghost_queue);
+  g_hash_table_destroy (memory_cache->priv->ghost_table);
+  g_hash_table_destroy (memory_cache->priv->missing_table);
 
   G_OBJECT_CLASS (champlain_memory_cache_parent_class)->finalize (object);
 }
@@ -164,9 +284,108 @@ champlain_memory_cache_class_init (ChamplainMemoryCacheClass *klass)
         G_PARAM_CONSTRUCT | G_PARAM_READWRITE);
   g_object_class_install_property (object_class, PROP_SIZE_LIMIT, pspec);
 
+  /**
+   * ChamplainMemoryCache:synthesize-parents:
+   *
+   * Show missing tiles downsampled from their four cached children as
+   * placeholders, which makes zooming out look instant. The children are
+   * used only when they are cached decoded, see
+   * #ChamplainMemoryCache:store-decoded. The real tile is still requested
+   * from the next source and replaces the approximation, which is never
+   * cached.
+   *
+   * Since: 0.14
+   */
+  pspec = g_param_spec_boolean ("synthesize-parents",
+        "Synthesize parents",
+        "Build missing tiles from their cached children",
+        FALSE,
+        G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_SYNTHESIZE_PARENTS, pspec);
+
+  /**
+   * ChamplainMemoryCache:store-decoded:
+   *
+   * Keep the textures of the rendered tiles instead of the encoded image
+   * data. Cache hits then don't have to decode and upload the image again.
+   * Tiles whose content isn't a #ClutterTexture are still stored encoded.
+   *
+   * Since: 0.14
+   */
+  pspec = g_param_spec_boolean ("store-decoded",
+        "Store decoded",
+        "Keep decoded textures instead of encoded image data",
+        FALSE,
+        G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_STORE_DECODED, pspec);
+
+  /**
+   * ChamplainMemoryCache:byte-limit:
+   *
+   * The maximum number of bytes used by the stored tiles, 0 for no limit.
+   * The limit covers the tile data (decoded textures are counted as 4 bytes
+   * per pixel) and an estimate of the keys and bookkeeping structures of the
+   * stored tiles; tiles bigger than the limit are not stored at all. The
+   * #ChamplainMemoryCache:size-limit applies as well.
+   *
+   * The keys of tiles recently evicted by the %CHAMPLAIN_EVICTION_POLICY_2Q
+   * policy (at most half the number of stored tiles) and the tiles known to
+   * be missing in the tile source (at most 4096) are kept outside of the
+   * limit, a few dozen bytes each.
+   *
+   * Since: 0.14
+   */
+  pspec = g_param_spec_ulong ("byte-limit",
+        "Byte limit",
+        "Maximal number of bytes used by the stored tiles",
+        0,
+        G_MAXULONG,
+        0,
+        G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_BYTE_LIMIT, pspec);
+
+  /**
+   * ChamplainMemoryCache:eviction-policy:
+   *
+   * The policy deciding which tiles are removed when the cache is full.
+   *
+   * Since: 0.14
+   */
+  pspec = g_param_spec_enum ("eviction-policy",
+        "Eviction policy",
+        "The policy deciding which tiles are removed",
+        CHAMPLAIN_TYPE_EVICTION_POLICY,
+        CHAMPLAIN_EVICTION_POLICY_LRU,
+        G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_EVICTION_POLICY, pspec);
+
+  /**
+   * ChamplainMemoryCache::tiles-evicted:
+   * @memory_cache: a #ChamplainMemoryCache
+   * @n_tiles: the number of removed tiles
+   * @n_bytes: the number of freed bytes
+   *
+   * Emitted when the least recently used tiles were removed to stay within
+   * the cache limits or because of champlain_memory_cache_shrink().
+   *
+   * Since: 0.14
+   */
+  champlain_memory_cache_signals[TILES_EVICTED] =
+    g_signal_new ("tiles-evicted",
+        G_OBJECT_CLASS_TYPE (object_class),
+        G_SIGNAL_RUN_LAST,
+        0,
+        NULL,
+        NULL,
+        _champlain_marshal_VOID__UINT_UINT,
+        G_TYPE_NONE,
+        2,
+        G_TYPE_UINT, G_TYPE_UINT);
+
   tile_cache_class->store_tile = store_tile;
   tile_cache_class->refresh_tile_time = refresh_tile_time;
   tile_cache_class->on_tile_filled = on_tile_filled;
+  champlain_tile_cache_class_set_store_missing_tile (tile_cache_class, store_missing_tile);
 
   map_source_class->fill_tile = fill_tile;
 }
@@ -198,6 +417,13 @@ champlain_memory_cache_new_full (guint size_limit,
 }
 
 
+static void
+free_missing_tile (MissingTile *missing)
+{
+  g_slice_free (MissingTile, missing);
+}
+
+
 static void
 champlain_memory_cache_init (ChamplainMemoryCache *memory_cache)
 {
@@ -205,8 +431,22 @@ champlain_memory_cache_init (ChamplainMemoryCache *memory_cache)
 
   memory_cache->priv = priv;
 
+  priv->synthesize_parents = FALSE;
+  priv->store_decoded = FALSE;
+  priv->byte_limit = 0;
+  priv->total_bytes = 0;
+  priv->hits = 0;
+  priv->misses = 0;
+  priv->evictions = 0;
+  priv->eviction_policy = CHAMPLAIN_EVICTION_POLICY_LRU;
   priv->queue = g_queue_new ();
-  priv->hash_table = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  priv->hash_table = g_hash_table_new (champlain_tile_key_hash, champlain_tile_key_equal);
+  priv->in_queue = g_queue_new ();
+  priv->in_bytes = 0;
+  priv->ghost_queue = g_queue_new ();
+  priv->ghost_table = g_hash_table_new (champlain_tile_key_hash, champlain_tile_key_equal);
+  priv->missing_table = g_hash_table_new_full (champlain_tile_key_hash, champlain_tile_key_equal,
+        NULL, (GDestroyNotify) free_missing_tile);
 }
 
 
@@ -251,30 +491,426 @@ champlain_memory_cache_set_size_limit (ChamplainMemoryCache *memory_cache,
 }
 
 
-static gchar *
+/**
+ * champlain_memory_cache_get_synthesize_parents:
+ * @memory_cache: a #ChamplainMemoryCache
+ *
+ * Checks whether missing tiles are built from their cached children.
+ *
+ * Returns: TRUE if parent tiles are synthesized, FALSE otherwise
+ *
+ * Since: 0.14
+ */
+gboolean
+champlain_memory_cache_get_synthesize_parents (ChamplainMemoryCache *memory_cache)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_MEMORY_CACHE (memory_cache), FALSE);
+
+  return memory_cache->priv->synthesize_parents;
+}
+
+
+/**
+ * champlain_memory_cache_set_synthesize_parents:
+ * @memory_cache: a #ChamplainMemoryCache
+ * @synthesize: TRUE to build missing tiles from their cached children
+ *
+ * Sets whether missing tiles should be shown downsampled from their four
+ * cached children. See #ChamplainMemoryCache:synthesize-parents.
+ *
+ * Since: 0.14
+ */
+void
+champlain_memory_cache_set_synthesize_parents (ChamplainMemoryCache *memory_cache,
+    gboolean synthesize)
+{
+  g_return_if_fail (CHAMPLAIN_IS_MEMORY_CACHE (memory_cache));
+
+  memory_cache->priv->synthesize_parents = synthesize;
+  g_object_notify (G_OBJECT (memory_cache), "synthesize-parents");
+}
+
+
+/**
+ * champlain_memory_cache_get_store_decoded:
+ * @memory_cache: a #ChamplainMemoryCache
+ *
+ * Checks whether the cache keeps decoded textures.
+ *
+ * Returns: TRUE if decoded textures are stored, FALSE otherwise
+ *
+ * Since: 0.14
+ */
+gboolean
+champlain_memory_cache_get_store_decoded (ChamplainMemoryCache *memory_cache)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_MEMORY_CACHE (memory_cache), FALSE);
+
+  return memory_cache->priv->store_decoded;
+}
+
+
+/**
+ * champlain_memory_cache_set_store_decoded:
+ * @memory_cache: a #ChamplainMemoryCache
+ * @store_decoded: TRUE to keep decoded textures
+ *
+ * Sets whether the cache keeps the textures of the rendered tiles instead of
+ * the encoded image data. Tiles already in the cache are converted when they
+ * are used next time. See #ChamplainMemoryCache:store-decoded.
+ *
+ * Since: 0.14
+ */
+void
+champlain_memory_cache_set_store_decoded (ChamplainMemoryCache *memory_cache,
+    gboolean store_decoded)
+{
+  g_return_if_fail (CHAMPLAIN_IS_MEMORY_CACHE (memory_cache));
+
+  memory_cache->priv->store_decoded = store_decoded;
+  g_object_notify (G_OBJECT (memory_cache), "store-decoded");
+}
+
+
+/**
+ * champlain_memory_cache_get_byte_limit:
+ * @memory_cache: a #ChamplainMemoryCache
+ *
+ * Gets the maximum number of bytes used by the stored tiles.
+ *
+ * Returns: maximum number of bytes, 0 if unlimited
+ *
+ * Since: 0.14
+ */
+gsize
+champlain_memory_cache_get_byte_limit (ChamplainMemoryCache *memory_cache)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_MEMORY_CACHE (memory_cache), 0);
+
+  return memory_cache->priv->byte_limit;
+}
+
+
+/**
+ * champlain_memory_cache_set_byte_limit:
+ * @memory_cache: a #ChamplainMemoryCache
+ * @byte_limit: maximum number of bytes, 0 for no limit
+ *
+ * Sets the maximum number of bytes used by the stored tiles. The least
+ * recently used tiles are removed immediately when the cache is over the
+ * new limit.
+ *
+ * Since: 0.14
+ */
+void
+champlain_memory_cache_set_byte_limit (ChamplainMemoryCache *memory_cache,
+    gsize byte_limit)
+{
+  g_return_if_fail (CHAMPLAIN_IS_MEMORY_CACHE (memory_cache));
+
+  memory_cache->priv->byte_limit = byte_limit;
+  if (byte_limit > 0)
+    evict_tiles (memory_cache, G_MAXUINT, byte_limit);
+  g_object_notify (G_OBJECT (memory_cache), "byte-limit");
+}
+
+
+/**
+ * champlain_memory_cache_get_used_bytes:
+ * @memory_cache: a #ChamplainMemoryCache
+ *
+ * Gets the number of bytes used by the stored tiles, including the
+ * estimated bookkeeping overhead. This is the value compared against
+ * #ChamplainMemoryCache:byte-limit; like the limit, it doesn't include the
+ * remembered keys of evicted and missing tiles.
+ *
+ * Returns: the number of used bytes
+ *
+ * Since: 0.14
+ */
+gsize
+champlain_memory_cache_get_used_bytes (ChamplainMemoryCache *memory_cache)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_MEMORY_CACHE (memory_cache), 0);
+
+  return memory_cache->priv->total_bytes;
+}
+
+
+/**
+ * champlain_memory_cache_shrink:
+ * @memory_cache: a #ChamplainMemoryCache
+ * @target_bytes: the number of bytes the cache may use afterwards
+ *
+ * Removes the least recently used tiles until the cache uses at most
+ * @target_bytes bytes. Useful to release memory when the system runs low
+ * on it; the limits of the cache stay unchanged so it grows again when new
+ * tiles are loaded.
+ *
+ * Since: 0.14
+ */
+void
+champlain_memory_cache_shrink (ChamplainMemoryCache *memory_cache,
+    gsize target_bytes)
+{
+  g_return_if_fail (CHAMPLAIN_IS_MEMORY_CACHE (memory_cache));
+
+  evict_tiles (memory_cache, G_MAXUINT, target_bytes);
+}
+
+
+/**
+ * champlain_memory_cache_get_stats:
+ * @memory_cache: a #ChamplainMemoryCache
+ * @hits: (out) (allow-none): return location for the number of cache hits
+ * @misses: (out) (allow-none): return location for the number of cache misses
+ * @evictions: (out) (allow-none): return location for the number of evicted tiles
+ *
+ * Gets the cache statistics collected since the cache was created or since
+ * the last call of champlain_memory_cache_reset_stats().
+ *
+ * Since: 0.14
+ */
+void
+champlain_memory_cache_get_stats (ChamplainMemoryCache *memory_cache,
+    guint *hits,
+    guint *misses,
+    guint *evictions)
+{
+  g_return_if_fail (CHAMPLAIN_IS_MEMORY_CACHE (memory_cache));
+
+  ChamplainMemoryCachePrivate *priv = memory_cache->priv;
+
+  if (hits)
+    *hits = priv->hits;
+  if (misses)
+    *misses = priv->misses;
+  if (evictions)
+    *evictions = priv->evictions;
+}
+
+
+/**
+ * champlain_memory_cache_reset_stats:
+ * @memory_cache: a #ChamplainMemoryCache
+ *
+ * Resets the counters returned by champlain_memory_cache_get_stats().
+ *
+ * Since: 0.14
+ */
+void
+champlain_memory_cache_reset_stats (ChamplainMemoryCache *memory_cache)
+{
+  g_return_if_fail (CHAMPLAIN_IS_MEMORY_CACHE (memory_cache));
+
+  ChamplainMemoryCachePrivate *priv = memory_cache->priv;
+
+  priv->hits = 0;
+  priv->misses = 0;
+  priv->evictions = 0;
+}
+
+
+/**
+ * champlain_memory_cache_get_eviction_policy:
+ * @memory_cache: a #ChamplainMemoryCache
+ *
+ * Gets the policy deciding which tiles are removed when the cache is full.
+ *
+ * Returns: the eviction policy
+ *
+ * Since: 0.14
+ */
+ChamplainEvictionPolicy
+champlain_memory_cache_get_eviction_policy (ChamplainMemoryCache *memory_cache)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_MEMORY_CACHE (memory_cache), CHAMPLAIN_EVICTION_POLICY_LRU);
+
+  return memory_cache->priv->eviction_policy;
+}
+
+
+/**
+ * champlain_memory_cache_set_eviction_policy:
+ * @memory_cache: a #ChamplainMemoryCache
+ * @policy: the eviction policy
+ *
+ * Sets the policy deciding which tiles are removed when the cache is full.
+ * The tiles already in the cache are kept.
+ *
+ * Since: 0.14
+ */
+void
+champlain_memory_cache_set_eviction_policy (ChamplainMemoryCache *memory_cache,
+    ChamplainEvictionPolicy policy)
+{
+  g_return_if_fail (CHAMPLAIN_IS_MEMORY_CACHE (memory_cache));
+
+  ChamplainMemoryCachePrivate *priv = memory_cache->priv;
+  GList *link;
+
+  if (priv->eviction_policy == policy)
+    return;
+
+  /* The FIFO tiles are the most recent ones, LRU keeps them at the head */
+  while ((link = g_queue_pop_tail_link (priv->in_queue)) != NULL)
+    {
+      QueueMember *member = link->data;
+
+      member->in_fifo = FALSE;
+      g_queue_push_head_link (priv->queue, link);
+    }
+  priv->in_bytes = 0;
+  clear_ghosts (priv);
+
+  priv->eviction_policy = policy;
+  g_object_notify (G_OBJECT (memory_cache), "eviction-policy");
+}
+
+
+static void
+generate_key (ChamplainMemoryCache *memory_cache,
+    guint zoom_level,
+    guint x,
+    guint y,
+    ChamplainTileKey *key)
+{
+  champlain_tile_key_init (key,
+      champlain_tile_cache_get_source_id (CHAMPLAIN_TILE_CACHE (memory_cache)),
+      zoom_level,
+      x,
+      y);
+}
+
+
+static void
 generate_queue_key (ChamplainMemoryCache *memory_cache,
-    ChamplainTile *tile)
+    ChamplainTile *tile,
+    ChamplainTileKey *key)
 {
-  g_return_val_if_fail (CHAMPLAIN_IS_MEMORY_CACHE (memory_cache), NULL);
-  g_return_val_if_fail (CHAMPLAIN_IS_TILE (tile), NULL);
+  generate_key (memory_cache,
+      champlain_tile_get_zoom_level (tile),
+      champlain_tile_get_x (tile),
+      champlain_tile_get_y (tile),
+      key);
+}
+
+
+static guint
+n_cached_tiles (ChamplainMemoryCachePrivate *priv)
+{
+  return priv->queue->length + priv->in_queue->length;
+}
+
+
+static GQueue *
+member_queue (ChamplainMemoryCachePrivate *priv,
+    QueueMember *member)
+{
+  return member->in_fifo ? priv->in_queue : priv->queue;
+}
+
+
+/* Marks the tile of the link as used */
+static void
+touch_queue_member (ChamplainMemoryCachePrivate *priv,
+    GList *link)
+{
+  QueueMember *member = link->data;
+
+  /* A tile in the 2Q FIFO stays where it is, a repeated request in a short
+   * time doesn't make it popular */
+  if (member->in_fifo)
+    return;
+
+  g_queue_unlink (priv->queue, link);
+  g_queue_push_head_link (priv->queue, link);
+}
+
+
+static void
+clear_ghosts (ChamplainMemoryCachePrivate *priv)
+{
+  ChamplainTileKey *key;
+
+  g_hash_table_remove_all (priv->ghost_table);
+  while ((key = g_queue_pop_head (priv->ghost_queue)) != NULL)
+    g_slice_free (ChamplainTileKey, key);
+}
+
+
+/* Remembers the key of a tile evicted from the 2Q FIFO. The ghosts are
+ * bounded by the number of cached tiles and not counted in total_bytes. */
+static void
+add_ghost (ChamplainMemoryCachePrivate *priv,
+    const ChamplainTileKey *key)
+{
+  guint limit = MAX (n_cached_tiles (priv) / 2, 1);
+  ChamplainTileKey *ghost_key = g_slice_dup (ChamplainTileKey, key);
+
+  g_queue_push_head (priv->ghost_queue, ghost_key);
+  g_hash_table_insert (priv->ghost_table, ghost_key, g_queue_peek_head_link (priv->ghost_queue));
+
+  while (priv->ghost_queue->length > limit)
+    {
+      ChamplainTileKey *old_key = g_queue_pop_tail (priv->ghost_queue);
+
+      g_hash_table_remove (priv->ghost_table, old_key);
+      g_slice_free (ChamplainTileKey, old_key);
+    }
+}
 
-  ChamplainMapSource *map_source = CHAMPLAIN_MAP_SOURCE (memory_cache);
-  gchar *key;
 
-  key = g_strdup_printf ("%d/%d/%d/%s",
-        champlain_tile_get_zoom_level (tile),
-        champlain_tile_get_x (tile),
-        champlain_tile_get_y (tile),
-        champlain_map_source_get_id (map_source));
-  return key;
+/* Puts a new or re-added member at the head of the queue it belongs to */
+static void
+push_queue_member (ChamplainMemoryCachePrivate *priv,
+    GList *link)
+{
+  QueueMember *member = link->data;
+
+  if (member->in_fifo)
+    {
+      g_queue_push_head_link (priv->in_queue, link);
+      priv->in_bytes += member->bytes;
+    }
+  else
+    g_queue_push_head_link (priv->queue, link);
 }
 
 
 static void
-move_queue_member_to_head (GQueue *queue, GList *link)
+unlink_queue_member (ChamplainMemoryCachePrivate *priv,
+    GList *link)
 {
-  g_queue_unlink (queue, link);
-  g_queue_push_head_link (queue, link);
+  QueueMember *member = link->data;
+
+  g_queue_unlink (member_queue (priv, member), link);
+  if (member->in_fifo)
+    priv->in_bytes -= member->bytes;
+}
+
+
+/* Removes the member which should be evicted first from its queue */
+static QueueMember *
+pop_victim (ChamplainMemoryCachePrivate *priv)
+{
+  QueueMember *member;
+
+  /* 2Q: the FIFO gets about a quarter of the cache, the main queue is only
+   * evicted when the FIFO is within its share */
+  if (priv->in_queue->length > 0 &&
+      (priv->queue->length == 0 ||
+       priv->in_queue->length * 4 > n_cached_tiles (priv) ||
+       priv->in_bytes * 4 > priv->total_bytes))
+    {
+      member = g_queue_pop_tail (priv->in_queue);
+      priv->in_bytes -= member->bytes;
+      add_ghost (priv, &member->key);
+    }
+  else
+    member = g_queue_pop_tail (priv->queue);
+
+  return member;
 }
 
 
@@ -283,13 +919,162 @@ delete_queue_member (QueueMember *member, gpointer user_data)
 {
   if (member)
     {
-      g_free (member->key);
       g_free (member->data);
+      if (member->texture != COGL_INVALID_HANDLE)
+        cogl_handle_unref (member->texture);
       g_slice_free (QueueMember, member);
     }
 }
 
 
+static gsize
+member_bytes (guint size,
+    CoglHandle texture)
+{
+  gsize bytes = MEMBER_OVERHEAD;
+
+  if (texture != COGL_INVALID_HANDLE)
+    bytes += (gsize) cogl_texture_get_width (texture) *
+      cogl_texture_get_height (texture) * 4;
+  else
+    bytes += size;
+
+  return bytes;
+}
+
+
+static void
+evict_tiles (ChamplainMemoryCache *memory_cache,
+    guint n_tiles,
+    gsize target_bytes)
+{
+  ChamplainMemoryCachePrivate *priv = memory_cache->priv;
+  QueueMember *member;
+  gsize freed = 0;
+  guint count = 0;
+
+  while (n_cached_tiles (priv) > 0 &&
+         (n_cached_tiles (priv) > n_tiles || priv->total_bytes > target_bytes))
+    {
+      member = pop_victim (priv);
+      g_hash_table_remove (priv->hash_table, &member->key);
+      priv->total_bytes -= member->bytes;
+      freed += member->bytes;
+      count++;
+      delete_queue_member (member, NULL);
+    }
+
+  if (count > 0)
+    {
+      DEBUG ("Evicted %u tiles, %" G_GSIZE_FORMAT " bytes", count, freed);
+
+      priv->evictions += count;
+      g_signal_emit (memory_cache, champlain_memory_cache_signals[TILES_EVICTED], 0,
+          count, (guint) MIN (freed, G_MAXUINT));
+    }
+}
+
+
+/* Evicts tiles so that a new member of the given size fits into the cache.
+ * Returns FALSE when it can never fit. */
+static gboolean
+make_room (ChamplainMemoryCache *memory_cache,
+    gsize bytes)
+{
+  ChamplainMemoryCachePrivate *priv = memory_cache->priv;
+
+  if (priv->byte_limit > 0 && bytes > priv->byte_limit)
+    return FALSE;
+
+  evict_tiles (memory_cache,
+      priv->size_limit > 0 ? priv->size_limit - 1 : 0,
+      priv->byte_limit > 0 ? priv->byte_limit - bytes : G_MAXSIZE);
+
+  return TRUE;
+}
+
+
+/* Replaces the encoded data of a cached tile with its color when it was
+ * rendered as a single color, or with the texture of its content when the
+ * cache stores decoded tiles */
+static void
+store_texture (ChamplainMemoryCache *memory_cache,
+    ChamplainTile *tile)
+{
+  ChamplainMemoryCachePrivate *priv = memory_cache->priv;
+  ClutterActor *content;
+  QueueMember *member;
+  CoglHandle texture = COGL_INVALID_HANDLE;
+  ChamplainTileKey key;
+  gboolean solid;
+  guint32 color = 0;
+  GList *link;
+  gsize bytes;
+
+  content = champlain_tile_get_content (tile);
+  solid = champlain_solid_tile_get_color (content, &color);
+  if (!solid)
+    {
+      if (!priv->store_decoded || !CLUTTER_IS_TEXTURE (content))
+        return;
+
+      texture = clutter_texture_get_cogl_texture (CLUTTER_TEXTURE (content));
+      if (texture == COGL_INVALID_HANDLE)
+        return;
+    }
+
+  generate_queue_key (memory_cache, tile, &key);
+  link = g_hash_table_lookup (priv->hash_table, &key);
+  if (!link)
+    return;
+
+  member = link->data;
+  if (member->solid || (!solid && member->texture != COGL_INVALID_HANDLE))
+    return;
+
+  bytes = member_bytes (0, texture);
+
+  /* Keep the member out of the queue so it isn't evicted to make room
+   * for itself */
+  unlink_queue_member (priv, link);
+  priv->total_bytes -= member->bytes;
+
+  if (make_room (memory_cache, bytes))
+    {
+      g_free (member->data);
+      member->data = NULL;
+      member->size = 0;
+      if (member->texture != COGL_INVALID_HANDLE)
+        cogl_handle_unref (member->texture);
+      member->texture = solid ? COGL_INVALID_HANDLE : cogl_handle_ref (texture);
+      member->solid = solid;
+      member->color = color;
+      member->bytes = bytes;
+    }
+  else
+    /* The texture doesn't fit, keep the encoded data */
+    make_room (memory_cache, member->bytes);
+
+  priv->total_bytes += member->bytes;
+  push_queue_member (priv, link);
+}
+
+
+static void
+tile_filled (ChamplainMapSource *map_source,
+    ChamplainTile *tile)
+{
+  ChamplainMapSource *next_source = champlain_map_source_get_next_source (map_source);
+
+  if (CHAMPLAIN_IS_TILE_CACHE (next_source))
+    champlain_tile_cache_on_tile_filled (CHAMPLAIN_TILE_CACHE (next_source), tile);
+
+  champlain_tile_set_fade_in (tile, FALSE);
+  champlain_tile_set_state (tile, CHAMPLAIN_STATE_DONE);
+  champlain_tile_display_content (tile);
+}
+
+
 static void
 tile_rendered_cb (ChamplainTile *tile,
     gpointer data,
@@ -305,12 +1090,8 @@ tile_rendered_cb (ChamplainTile *tile,
 
   if (!error)
     {
-      if (CHAMPLAIN_IS_TILE_CACHE (next_source))
-        champlain_tile_cache_on_tile_filled (CHAMPLAIN_TILE_CACHE (next_source), tile);
-
-      champlain_tile_set_fade_in (tile, FALSE);
-      champlain_tile_set_state (tile, CHAMPLAIN_STATE_DONE);
-      champlain_tile_display_content (tile);
+      store_texture (CHAMPLAIN_MEMORY_CACHE (map_source), tile);
+      tile_filled (map_source, tile);
     }
   else if (next_source)
     champlain_map_source_fill_tile (next_source, tile);
@@ -320,6 +1101,125 @@ tile_rendered_cb (ChamplainTile *tile,
 }
 
 
+static void
+render_tile (ChamplainMapSource *map_source,
+    ChamplainTile *tile,
+    const gchar *data,
+    guint size)
+{
+  ChamplainRenderer *renderer;
+
+  renderer = champlain_map_source_get_renderer (map_source);
+
+  g_return_if_fail (CHAMPLAIN_IS_RENDERER (renderer));
+
+  g_object_ref (map_source);
+  g_object_ref (tile);
+
+  g_signal_connect (tile, "render-complete", G_CALLBACK (tile_rendered_cb), map_source);
+
+  champlain_renderer_set_data (renderer, data, size);
+  champlain_renderer_render (renderer, tile);
+}
+
+
+/* Shows the four children of a tile at the next zoom level, if they are
+ * all cached decoded, as a placeholder of the tile. The children share the
+ * cached textures and are drawn at half size, the linear texture filter
+ * averaging every 2x2 block of texels like a box filter. */
+static gboolean
+synthesize_from_children (ChamplainMemoryCache *memory_cache,
+    ChamplainTile *tile)
+{
+  ChamplainMemoryCachePrivate *priv = memory_cache->priv;
+  ChamplainMapSource *map_source = CHAMPLAIN_MAP_SOURCE (memory_cache);
+  QueueMember *children[4];
+  ClutterActor *placeholder;
+  guint zoom_level, x, y, half;
+  gint i;
+
+  zoom_level = champlain_tile_get_zoom_level (tile);
+  if (zoom_level >= champlain_map_source_get_max_zoom_level (map_source))
+    return FALSE;
+
+  x = champlain_tile_get_x (tile);
+  y = champlain_tile_get_y (tile);
+  half = champlain_tile_get_size (tile) / 2;
+
+  /* Encoded children would have to be decoded here, on the main loop */
+  for (i = 0; i < 4; i++)
+    {
+      ChamplainTileKey key;
+      GList *link;
+
+      generate_key (memory_cache, zoom_level + 1, 2 * x + i % 2, 2 * y + i / 2, &key);
+      link = g_hash_table_lookup (priv->hash_table, &key);
+      if (!link)
+        return FALSE;
+
+      children[i] = link->data;
+      if (!children[i]->solid && children[i]->texture == COGL_INVALID_HANDLE)
+        return FALSE;
+    }
+
+  placeholder = clutter_group_new ();
+
+  for (i = 0; i < 4; i++)
+    {
+      ClutterActor *actor;
+
+      if (children[i]->solid)
+        actor = champlain_solid_tile_new (children[i]->color, half);
+      else
+        {
+          actor = clutter_texture_new ();
+          clutter_texture_set_cogl_texture (CLUTTER_TEXTURE (actor), children[i]->texture);
+          clutter_actor_set_size (actor, half, half);
+        }
+
+      clutter_actor_set_position (actor, (i % 2) * half, (i / 2) * half);
+      clutter_container_add_actor (CLUTTER_CONTAINER (placeholder), actor);
+    }
+
+  /* The real content replaces it through champlain_tile_display_content() */
+  champlain_tile_set_content (tile, placeholder);
+  champlain_tile_display_content (tile);
+
+  return TRUE;
+}
+
+
+/* Whether the tile source reported the tile missing and the report is still
+ * valid */
+static gboolean
+is_missing (ChamplainMemoryCachePrivate *priv,
+    const ChamplainTileKey *key)
+{
+  MissingTile *missing;
+  GTimeVal now;
+
+  missing = g_hash_table_lookup (priv->missing_table, key);
+  if (!missing)
+    return FALSE;
+
+  g_get_current_time (&now);
+  if (missing->expires > now.tv_sec)
+    return TRUE;
+
+  g_hash_table_remove (priv->missing_table, key);
+  return FALSE;
+}
+
+
+static gboolean
+missing_tile_expired (G_GNUC_UNUSED gpointer key,
+    MissingTile *missing,
+    GTimeVal *now)
+{
+  return missing->expires <= now->tv_sec;
+}
+
+
 static void
 fill_tile (ChamplainMapSource *map_source,
     ChamplainTile *tile)
@@ -336,32 +1236,62 @@ fill_tile (ChamplainMapSource *map_source,
     {
       ChamplainMemoryCache *memory_cache = CHAMPLAIN_MEMORY_CACHE (map_source);
       ChamplainMemoryCachePrivate *priv = memory_cache->priv;
-      ChamplainRenderer *renderer;
+      ChamplainTileKey key;
       GList *link;
-      gchar *key;
 
-      key = generate_queue_key (memory_cache, tile);
-      link = g_hash_table_lookup (priv->hash_table, key);
-      g_free (key);
+      generate_queue_key (memory_cache, tile, &key);
+      link = g_hash_table_lookup (priv->hash_table, &key);
       if (link)
         {
           QueueMember *member = link->data;
 
-          move_queue_member_to_head (priv->queue, link);
+          touch_queue_member (priv, link);
+          priv->hits++;
+
+          if (member->solid)
+            {
+              champlain_tile_set_content (tile,
+                  champlain_solid_tile_new (member->color, champlain_tile_get_size (tile)));
+              tile_filled (map_source, tile);
+            }
+          else if (member->texture != COGL_INVALID_HANDLE)
+            {
+              ClutterActor *actor = clutter_texture_new ();
+
+              clutter_texture_set_cogl_texture (CLUTTER_TEXTURE (actor), member->texture);
+              champlain_tile_set_content (tile, actor);
+              tile_filled (map_source, tile);
+            }
+          else
+            render_tile (map_source, tile, member->data, member->size);
 
-          renderer = champlain_map_source_get_renderer (map_source);
+          return;
+        }
 
-          g_return_if_fail (CHAMPLAIN_IS_RENDERER (renderer));
+      if (is_missing (priv, &key))
+        {
+          DEBUG ("Tile %d/%d/%d is missing in the tile source",
+              champlain_tile_get_zoom_level (tile),
+              champlain_tile_get_x (tile),
+              champlain_tile_get_y (tile));
 
-          g_object_ref (map_source);
-          g_object_ref (tile);
+          priv->hits++;
+          champlain_tile_cache_fill_missing_tile (CHAMPLAIN_TILE_CACHE (map_source), tile);
+          return;
+        }
 
-          g_signal_connect (tile, "render-complete", G_CALLBACK (tile_rendered_cb), map_source);
+      priv->misses++;
 
-          champlain_renderer_set_data (renderer, member->data, member->size);
-          champlain_renderer_render (renderer, tile);
+      if (priv->synthesize_parents &&
+          synthesize_from_children (memory_cache, tile))
+        {
+          DEBUG ("Tile %d/%d/%d synthesized from its children",
+              champlain_tile_get_zoom_level (tile),
+              champlain_tile_get_x (tile),
+              champlain_tile_get_y (tile));
 
-          return;
+          /* The approximation isn't cached, the real tile replaces it once
+           * the rest of the chain delivers it */
         }
     }
 
@@ -376,6 +1306,58 @@ fill_tile (ChamplainMapSource *map_source,
 }
 
 
+static void
+add_queue_member (ChamplainMemoryCache *memory_cache,
+    const ChamplainTileKey *key,
+    const gchar *contents,
+    gsize size)
+{
+  ChamplainMemoryCachePrivate *priv = memory_cache->priv;
+  QueueMember *member;
+  GList *link;
+  gsize bytes;
+
+  bytes = member_bytes (size, COGL_INVALID_HANDLE);
+  if (!make_room (memory_cache, bytes))
+    {
+      DEBUG ("Tile of %" G_GSIZE_FORMAT " bytes is bigger than the cache byte limit", size);
+      return;
+    }
+
+  member = g_slice_new (QueueMember);
+  member->key = *key;
+  member->data = g_memdup (contents, size);
+  member->size = size;
+  member->texture = COGL_INVALID_HANDLE;
+  member->solid = FALSE;
+  member->color = 0;
+  member->bytes = bytes;
+  member->in_fifo = FALSE;
+  priv->total_bytes += bytes;
+
+  if (priv->eviction_policy == CHAMPLAIN_EVICTION_POLICY_2Q)
+    {
+      GList *ghost = g_hash_table_lookup (priv->ghost_table, key);
+
+      /* Tiles requested again after dropping out of the FIFO go to the
+       * main queue */
+      if (ghost)
+        {
+          g_hash_table_remove (priv->ghost_table, key);
+          g_slice_free (ChamplainTileKey, ghost->data);
+          g_queue_delete_link (priv->ghost_queue, ghost);
+        }
+      else
+        member->in_fifo = TRUE;
+    }
+
+  link = g_list_alloc ();
+  link->data = member;
+  push_queue_member (priv, link);
+  g_hash_table_insert (priv->hash_table, &member->key, link);
+}
+
+
 static void
 store_tile (ChamplainTileCache *tile_cache,
     ChamplainTile *tile,
@@ -388,35 +1370,19 @@ store_tile (ChamplainTileCache *tile_cache,
   ChamplainMapSource *next_source = champlain_map_source_get_next_source (map_source);
   ChamplainMemoryCache *memory_cache = CHAMPLAIN_MEMORY_CACHE (tile_cache);
   ChamplainMemoryCachePrivate *priv = memory_cache->priv;
+  ChamplainTileKey key;
   GList *link;
-  gchar *key;
 
-  key = generate_queue_key (memory_cache, tile);
-  link = g_hash_table_lookup (priv->hash_table, key);
+  generate_queue_key (memory_cache, tile, &key);
+  g_hash_table_remove (priv->missing_table, &key);
+
+  link = g_hash_table_lookup (priv->hash_table, &key);
   if (link)
-    {
-      move_queue_member_to_head (priv->queue, link);
-      g_free (key);
-    }
+    touch_queue_member (priv, link);
   else
-    {
-      QueueMember *member;
+    add_queue_member (memory_cache, &key, contents, size);
 
-      if (priv->queue->length >= priv->size_limit)
-        {
-          member = g_queue_pop_tail (priv->queue);
-          g_hash_table_remove (priv->hash_table, member->key);
-          delete_queue_member (member, NULL);
-        }
-
-      member = g_slice_new (QueueMember);
-      member->key = key;
-      member->data = g_memdup (contents, size);
-      member->size = size;
-
-      g_queue_push_head (priv->queue, member);
-      g_hash_table_insert (priv->hash_table, g_strdup (key), g_queue_peek_head_link (priv->queue));
-    }
+  store_texture (memory_cache, tile);
 
   if (CHAMPLAIN_IS_TILE_CACHE (next_source))
     champlain_tile_cache_store_tile (CHAMPLAIN_TILE_CACHE (next_source), tile, contents, size);
@@ -452,8 +1418,13 @@ champlain_memory_cache_clean (ChamplainMemoryCache *memory_cache)
 
   g_queue_foreach (priv->queue, (GFunc) delete_queue_member, NULL);
   g_queue_clear (priv->queue);
-  g_hash_table_destroy (memory_cache->priv->hash_table);
-  priv->hash_table = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_queue_foreach (priv->in_queue, (GFunc) delete_queue_member, NULL);
+  g_queue_clear (priv->in_queue);
+  clear_ghosts (priv);
+  priv->total_bytes = 0;
+  priv->in_bytes = 0;
+  g_hash_table_remove_all (priv->hash_table);
+  g_hash_table_remove_all (priv->missing_table);
 }
 
 
@@ -468,15 +1439,52 @@ on_tile_filled (ChamplainTileCache *tile_cache,
   ChamplainMapSource *next_source = champlain_map_source_get_next_source (map_source);
   ChamplainMemoryCache *memory_cache = CHAMPLAIN_MEMORY_CACHE (tile_cache);
   ChamplainMemoryCachePrivate *priv = memory_cache->priv;
+  ChamplainTileKey key;
   GList *link;
-  gchar *key;
 
-  key = generate_queue_key (memory_cache, tile);
-  link = g_hash_table_lookup (priv->hash_table, key);
-  g_free (key);
+  generate_queue_key (memory_cache, tile, &key);
+  link = g_hash_table_lookup (priv->hash_table, &key);
   if (link)
-    move_queue_member_to_head (priv->queue, link);
+    touch_queue_member (priv, link);
 
   if (CHAMPLAIN_IS_TILE_CACHE (next_source))
     champlain_tile_cache_on_tile_filled (CHAMPLAIN_TILE_CACHE (next_source), tile);
 }
+
+
+static void
+store_missing_tile (ChamplainTileCache *tile_cache,
+    ChamplainTile *tile)
+{
+  g_return_if_fail (CHAMPLAIN_IS_MEMORY_CACHE (tile_cache));
+  g_return_if_fail (CHAMPLAIN_IS_TILE (tile));
+
+  ChamplainMapSource *map_source = CHAMPLAIN_MAP_SOURCE (tile_cache);
+  ChamplainMapSource *next_source = champlain_map_source_get_next_source (map_source);
+  ChamplainMemoryCache *memory_cache = CHAMPLAIN_MEMORY_CACHE (tile_cache);
+  ChamplainMemoryCachePrivate *priv = memory_cache->priv;
+  const GTimeVal *expire_time = champlain_tile_get_expire_time (tile);
+  GTimeVal now;
+
+  g_get_current_time (&now);
+
+  if (expire_time && expire_time->tv_sec > now.tv_sec)
+    {
+      MissingTile *missing = g_slice_new (MissingTile);
+
+      generate_queue_key (memory_cache, tile, &missing->key);
+      missing->expires = expire_time->tv_sec;
+
+      /* Make room by dropping the expired entries first, everything when
+       * the source is missing that many tiles */
+      if (g_hash_table_size (priv->missing_table) >= MAX_MISSING_TILES)
+        g_hash_table_foreach_remove (priv->missing_table, (GHRFunc) missing_tile_expired, &now);
+      if (g_hash_table_size (priv->missing_table) >= MAX_MISSING_TILES)
+        g_hash_table_remove_all (priv->missing_table);
+
+      g_hash_table_replace (priv->missing_table, &missing->key, missing);
+    }
+
+  if (CHAMPLAIN_IS_TILE_CACHE (next_source))
+    champlain_tile_cache_store_missing_tile (CHAMPLAIN_TILE_CACHE (next_source), tile);
+}
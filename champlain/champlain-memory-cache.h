@@ -45,6 +45,24 @@ G_BEGIN_DECLS
 #define CHAMPLAIN_MEMORY_CACHE_GET_CLASS(obj) \
   (G_TYPE_INSTANCE_GET_CLASS ((obj), CHAMPLAIN_TYPE_MEMORY_CACHE, ChamplainMemoryCacheClass))
 
+/**
+ * ChamplainEvictionPolicy:
+ * @CHAMPLAIN_EVICTION_POLICY_LRU: remove the least recently used tiles
+ * @CHAMPLAIN_EVICTION_POLICY_2Q: scan resistant 2Q policy - new tiles are
+ *     kept in a short FIFO, only tiles requested again after leaving it are
+ *     kept in the main LRU queue
+ *
+ * Policies deciding which tiles are removed from a #ChamplainMemoryCache
+ * when it is full.
+ *
+ * Since: 0.14
+ */
+typedef enum
+{
+  CHAMPLAIN_EVICTION_POLICY_LRU,
+  CHAMPLAIN_EVICTION_POLICY_2Q
+} ChamplainEvictionPolicy;
+
 typedef struct _ChamplainMemoryCachePrivate ChamplainMemoryCachePrivate;
 
 typedef struct _ChamplainMemoryCache ChamplainMemoryCache;
@@ -79,6 +97,32 @@ guint champlain_memory_cache_get_size_limit (ChamplainMemoryCache *memory_cache)
 void champlain_memory_cache_set_size_limit (ChamplainMemoryCache *memory_cache,
     guint size_limit);
 
+gboolean champlain_memory_cache_get_synthesize_parents (ChamplainMemoryCache *memory_cache);
+void champlain_memory_cache_set_synthesize_parents (ChamplainMemoryCache *memory_cache,
+    gboolean synthesize);
+
+gboolean champlain_memory_cache_get_store_decoded (ChamplainMemoryCache *memory_cache);
+void champlain_memory_cache_set_store_decoded (ChamplainMemoryCache *memory_cache,
+    gboolean store_decoded);
+
+gsize champlain_memory_cache_get_byte_limit (ChamplainMemoryCache *memory_cache);
+void champlain_memory_cache_set_byte_limit (ChamplainMemoryCache *memory_cache,
+    gsize byte_limit);
+
+gsize champlain_memory_cache_get_used_bytes (ChamplainMemoryCache *memory_cache);
+void champlain_memory_cache_shrink (ChamplainMemoryCache *memory_cache,
+    gsize target_bytes);
+
+void champlain_memory_cache_get_stats (ChamplainMemoryCache *memory_cache,
+    guint *hits,
+    guint *misses,
+    guint *evictions);
+void champlain_memory_cache_reset_stats (ChamplainMemoryCache *memory_cache);
+
+ChamplainEvictionPolicy champlain_memory_cache_get_eviction_policy (ChamplainMemoryCache *memory_cache);
+void champlain_memory_cache_set_eviction_policy (ChamplainMemoryCache *memory_cache,
+    ChamplainEvictionPolicy policy);
+
 void champlain_memory_cache_clean (ChamplainMemoryCache *memory_cache);
 
 G_END_DECLS
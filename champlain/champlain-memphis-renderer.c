@@ -43,6 +43,7 @@
 #include "champlain-private.h"
 #include "champlain-memphis-renderer.h"
 #include "champlain-bounding-box.h"
+#include "champlain-solid-tile.h"
 
 #include <gdk/gdk.h>
 
@@ -89,6 +90,13 @@ struct _ChamplainMemphisRendererPrivate
   GThreadPool *thpool;
   guint tile_size;
   ChamplainBoundingBox *bbox;
+
+  /* The PNG of the tiles with only the background, encoded once per color
+   * and size */
+  gchar *empty_data;
+  gsize empty_data_size;
+  guint32 empty_color;
+  guint empty_size;
 };
 
 typedef struct _WorkerThreadData WorkerThreadData;
@@ -103,6 +111,7 @@ struct _WorkerThreadData
   ChamplainRenderer *renderer;
   ChamplainTile *tile;
   cairo_surface_t *cst;
+  gboolean has_data;
 };
 
 /* lock to protect the renderer state while rendering */
@@ -194,6 +203,7 @@ champlain_memphis_renderer_finalize (GObject *object)
   ChamplainMemphisRendererPrivate *priv = renderer->priv;
 
   champlain_bounding_box_free (priv->bbox);
+  g_free (priv->empty_data);
 
   G_OBJECT_CLASS (champlain_memphis_renderer_parent_class)->finalize (object);
 }
@@ -259,6 +269,10 @@ champlain_memphis_renderer_init (ChamplainMemphisRenderer *renderer)
         MAX_THREADS, FALSE, NULL);
 
   priv->bbox = NULL;
+  priv->empty_data = NULL;
+  priv->empty_data_size = 0;
+  priv->empty_color = 0;
+  priv->empty_size = 0;
 }
 
 
@@ -295,6 +309,40 @@ argb_to_rgba (guchar *data,
 }
 
 
+/* Returns the PNG of a tile of the background color, encoding it only when
+ * the color or the size changed */
+static gboolean
+get_empty_data (ChamplainMemphisRenderer *renderer,
+    guint32 color,
+    guint size)
+{
+  ChamplainMemphisRendererPrivate *priv = renderer->priv;
+  GdkPixbuf *pixbuf;
+  gboolean success;
+
+  if (priv->empty_data && priv->empty_color == color && priv->empty_size == size)
+    return TRUE;
+
+  g_free (priv->empty_data);
+  priv->empty_data = NULL;
+  priv->empty_data_size = 0;
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, size, size);
+  gdk_pixbuf_fill (pixbuf, color);
+  success = gdk_pixbuf_save_to_buffer (pixbuf, &priv->empty_data, &priv->empty_data_size,
+        "png", NULL, NULL);
+  g_object_unref (pixbuf);
+
+  if (!success)
+    return FALSE;
+
+  priv->empty_color = color;
+  priv->empty_size = size;
+
+  return TRUE;
+}
+
+
 static gboolean
 tile_loaded_cb (gpointer worker_data)
 {
@@ -308,6 +356,7 @@ tile_loaded_cb (gpointer worker_data)
   cairo_t *cr_clutter;
   ClutterActor *actor;
   guint size = data->size;
+  gboolean has_data = data->has_data;
   GdkPixbuf *pixbuf = NULL;
   gchar *buffer = NULL;
   gsize buffer_size;
@@ -320,6 +369,29 @@ tile_loaded_cb (gpointer worker_data)
       goto finish;
     }
 
+  if (!has_data)
+    {
+      /* Only the background - all such tiles share one texture */
+      ClutterColor *bg_color;
+      guint32 color;
+
+      bg_color = champlain_memphis_renderer_get_background_color (CHAMPLAIN_MEMPHIS_RENDERER (renderer));
+      color = ((guint32) bg_color->red << 24) | (bg_color->green << 16) |
+        (bg_color->blue << 8) | bg_color->alpha;
+      clutter_color_free (bg_color);
+
+      if (!get_empty_data (CHAMPLAIN_MEMPHIS_RENDERER (renderer), color, size))
+        goto finish;
+
+      champlain_tile_set_content (tile, champlain_solid_tile_new (color, size));
+
+      /* Owned by the renderer */
+      ret_data = CHAMPLAIN_MEMPHIS_RENDERER (renderer)->priv->empty_data;
+      ret_size = CHAMPLAIN_MEMPHIS_RENDERER (renderer)->priv->empty_data_size;
+      ret_error = FALSE;
+      goto finish;
+    }
+
   if (!cst)
     goto finish;
 
@@ -379,6 +451,8 @@ memphis_worker_thread (gpointer worker_data,
   has_data = memphis_renderer_tile_has_data (renderer->priv->renderer, data->x, data->y, data->z);
   g_static_rw_lock_reader_unlock (&MemphisLock);
 
+  data->has_data = has_data;
+
   if (has_data)
     {
       cairo_t *cr;
@@ -59,13 +59,21 @@
 #include <math.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <time.h>
+
+/* The lifetime of tiles the server sends no caching headers for */
+#define DEFAULT_LIFETIME (7 * 24 * 60 * 60)
+/* How long a tile the server reported missing is not requested again */
+#define MISSING_LIFETIME (60 * 60)
 
 enum
 {
   PROP_0,
   PROP_URI_FORMAT,
   PROP_OFFLINE,
-  PROP_PROXY_URI
+  PROP_PROXY_URI,
+  PROP_MIN_LIFETIME,
+  PROP_MAX_LIFETIME
 };
 
 G_DEFINE_TYPE (ChamplainNetworkTileSource, champlain_network_tile_source, CHAMPLAIN_TYPE_TILE_SOURCE);
@@ -78,6 +86,8 @@ struct _ChamplainNetworkTileSourcePrivate
   gboolean offline;
   gchar *uri_format;
   gchar *proxy_uri;
+  guint min_lifetime;
+  guint max_lifetime;
   SoupSession *soup_session;
 };
 
@@ -98,6 +108,7 @@ typedef struct
 {
   ChamplainMapSource *map_source;
   gchar *etag;
+  GTimeVal expire_time;
 } TileRenderedData;
 
 
@@ -134,6 +145,14 @@ champlain_network_tile_source_get_property (GObject *object,
       g_value_set_string (value, priv->proxy_uri);
       break;
 
+    case PROP_MIN_LIFETIME:
+      g_value_set_uint (value, priv->min_lifetime);
+      break;
+
+    case PROP_MAX_LIFETIME:
+      g_value_set_uint (value, priv->max_lifetime);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -162,6 +181,14 @@ champlain_network_tile_source_set_property (GObject *object,
       champlain_network_tile_source_set_proxy_uri (tile_source, g_value_get_string (value));
       break;
 
+    case PROP_MIN_LIFETIME:
+      champlain_network_tile_source_set_min_lifetime (tile_source, g_value_get_uint (value));
+      break;
+
+    case PROP_MAX_LIFETIME:
+      champlain_network_tile_source_set_max_lifetime (tile_source, g_value_get_uint (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -261,6 +288,40 @@ champlain_network_tile_source_class_init (ChamplainNetworkTileSourceClass *klass
         "",
         G_PARAM_READWRITE);
   g_object_class_install_property (object_class, PROP_PROXY_URI, pspec);
+
+  /**
+   * ChamplainNetworkTileSource:min-lifetime
+   *
+   * The minimum time in seconds a downloaded tile is considered fresh,
+   * regardless of the caching headers sent by the server
+   *
+   * Since: 0.14
+   */
+  pspec = g_param_spec_uint ("min-lifetime",
+        "Minimum lifetime",
+        "The minimum time in seconds a tile is fresh",
+        0,
+        G_MAXUINT,
+        0,
+        G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_MIN_LIFETIME, pspec);
+
+  /**
+   * ChamplainNetworkTileSource:max-lifetime
+   *
+   * The maximum time in seconds a downloaded tile is considered fresh,
+   * regardless of the caching headers sent by the server
+   *
+   * Since: 0.14
+   */
+  pspec = g_param_spec_uint ("max-lifetime",
+        "Maximum lifetime",
+        "The maximum time in seconds a tile is fresh",
+        0,
+        G_MAXUINT,
+        G_MAXUINT,
+        G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_MAX_LIFETIME, pspec);
 }
 
 
@@ -274,6 +335,8 @@ champlain_network_tile_source_init (ChamplainNetworkTileSource *tile_source)
   priv->proxy_uri = NULL;
   priv->uri_format = NULL;
   priv->offline = FALSE;
+  priv->min_lifetime = 0;
+  priv->max_lifetime = G_MAXUINT;
 
   priv->soup_session = soup_session_async_new_with_options (
         "proxy-uri", NULL,
@@ -484,6 +547,89 @@ champlain_network_tile_source_set_offline (ChamplainNetworkTileSource *tile_sour
 }
 
 
+/**
+ * champlain_network_tile_source_get_min_lifetime:
+ * @tile_source: the #ChamplainNetworkTileSource
+ *
+ * Gets the minimum time downloaded tiles are considered fresh.
+ *
+ * Returns: the minimum lifetime in seconds
+ *
+ * Since: 0.14
+ */
+guint
+champlain_network_tile_source_get_min_lifetime (ChamplainNetworkTileSource *tile_source)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source), 0);
+
+  return tile_source->priv->min_lifetime;
+}
+
+
+/**
+ * champlain_network_tile_source_set_min_lifetime:
+ * @tile_source: the #ChamplainNetworkTileSource
+ * @min_lifetime: the minimum lifetime in seconds
+ *
+ * Sets the minimum time downloaded tiles are considered fresh. Tiles the
+ * server marks as expiring sooner are not validated again before.
+ *
+ * Since: 0.14
+ */
+void
+champlain_network_tile_source_set_min_lifetime (ChamplainNetworkTileSource *tile_source,
+    guint min_lifetime)
+{
+  g_return_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source));
+
+  tile_source->priv->min_lifetime = min_lifetime;
+
+  g_object_notify (G_OBJECT (tile_source), "min-lifetime");
+}
+
+
+/**
+ * champlain_network_tile_source_get_max_lifetime:
+ * @tile_source: the #ChamplainNetworkTileSource
+ *
+ * Gets the maximum time downloaded tiles are considered fresh.
+ *
+ * Returns: the maximum lifetime in seconds
+ *
+ * Since: 0.14
+ */
+guint
+champlain_network_tile_source_get_max_lifetime (ChamplainNetworkTileSource *tile_source)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source), G_MAXUINT);
+
+  return tile_source->priv->max_lifetime;
+}
+
+
+/**
+ * champlain_network_tile_source_set_max_lifetime:
+ * @tile_source: the #ChamplainNetworkTileSource
+ * @max_lifetime: the maximum lifetime in seconds
+ *
+ * Sets the maximum time downloaded tiles are considered fresh. Tiles the
+ * server marks as expiring later, or sends no caching headers for, are
+ * validated again after this time.
+ *
+ * Since: 0.14
+ */
+void
+champlain_network_tile_source_set_max_lifetime (ChamplainNetworkTileSource *tile_source,
+    guint max_lifetime)
+{
+  g_return_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source));
+
+  tile_source->priv->max_lifetime = max_lifetime;
+
+  g_object_notify (G_OBJECT (tile_source), "max-lifetime");
+}
+
+
 #define SIZE 8
 static gchar *
 get_tile_uri (ChamplainNetworkTileSource *tile_source,
@@ -533,6 +679,67 @@ get_tile_uri (ChamplainNetworkTileSource *tile_source,
 }
 
 
+/* Computes when the response gets stale from its Cache-Control or Expires
+ * header, clamped to the lifetime limits of the source */
+static void
+get_expire_time (ChamplainNetworkTileSource *tile_source,
+    SoupMessage *msg,
+    gint64 default_lifetime,
+    GTimeVal *expire_time)
+{
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+  const gchar *cache_control, *expires;
+  gint64 lifetime = default_lifetime;
+
+  cache_control = soup_message_headers_get (msg->response_headers, "Cache-Control");
+  expires = soup_message_headers_get (msg->response_headers, "Expires");
+
+  if (cache_control)
+    {
+      GHashTable *params = soup_header_parse_param_list (cache_control);
+      const gchar *max_age = g_hash_table_lookup (params, "max-age");
+
+      if (g_hash_table_lookup_extended (params, "no-cache", NULL, NULL) ||
+          g_hash_table_lookup_extended (params, "no-store", NULL, NULL))
+        lifetime = 0;
+      else if (max_age)
+        lifetime = g_ascii_strtoll (max_age, NULL, 10);
+      else
+        cache_control = NULL;
+
+      soup_header_free_param_list (params);
+    }
+
+  /* max-age takes precedence over Expires */
+  if (!cache_control && expires)
+    {
+      SoupDate *expires_date = soup_date_new_from_string (expires);
+      const gchar *date = soup_message_headers_get (msg->response_headers, "Date");
+      SoupDate *server_date = date ? soup_date_new_from_string (date) : NULL;
+
+      /* Invalid dates such as "0" mean already expired; relative to the
+       * server's clock when possible to be immune to clock skew */
+      if (!expires_date)
+        lifetime = 0;
+      else if (server_date)
+        lifetime = (gint64) soup_date_to_time_t (expires_date) - soup_date_to_time_t (server_date);
+      else
+        lifetime = (gint64) soup_date_to_time_t (expires_date) - time (NULL);
+
+      if (expires_date)
+        soup_date_free (expires_date);
+      if (server_date)
+        soup_date_free (server_date);
+    }
+
+  lifetime = CLAMP (lifetime, (gint64) priv->min_lifetime, (gint64) priv->max_lifetime);
+  DEBUG ("Tile lifetime %" G_GINT64_FORMAT " s", lifetime);
+
+  g_get_current_time (expire_time);
+  expire_time->tv_sec += MIN (lifetime, (gint64) (G_MAXINT - expire_time->tv_sec));
+}
+
+
 static void
 tile_rendered_cb (ChamplainTile *tile,
     gpointer data,
@@ -543,6 +750,7 @@ tile_rendered_cb (ChamplainTile *tile,
   ChamplainMapSource *map_source = user_data->map_source;
   ChamplainMapSource *next_source;
   gchar *etag = user_data->etag;
+  GTimeVal expire_time = user_data->expire_time;
 
   g_signal_handlers_disconnect_by_func (tile, tile_rendered_cb, user_data);
   g_slice_free (TileRenderedData, user_data);
@@ -556,6 +764,7 @@ tile_rendered_cb (ChamplainTile *tile,
 
       if (etag != NULL)
         champlain_tile_set_etag (tile, etag);
+      champlain_tile_set_expire_time (tile, &expire_time);
 
       if (tile_cache && data)
         champlain_tile_cache_store_tile (tile_cache, tile, data, size);
@@ -602,11 +811,43 @@ tile_loaded_cb (G_GNUC_UNUSED SoupSession *session,
 
   if (msg->status_code == SOUP_STATUS_NOT_MODIFIED)
     {
+      GTimeVal expire_time;
+
+      /* The server may send new caching headers with the validation */
+      get_expire_time (CHAMPLAIN_NETWORK_TILE_SOURCE (map_source), msg,
+          DEFAULT_LIFETIME, &expire_time);
+      champlain_tile_set_expire_time (tile, &expire_time);
+
       if (tile_cache)
         champlain_tile_cache_refresh_tile_time (tile_cache, tile);
       goto finish;
     }
 
+  /* The tile doesn't exist - remember it so that the caches don't ask the
+   * server again until the negative answer expires. Server and network
+   * errors are transient and never cached. */
+  if (msg->status_code == SOUP_STATUS_NOT_FOUND ||
+      msg->status_code == SOUP_STATUS_GONE ||
+      msg->status_code == SOUP_STATUS_NO_CONTENT)
+    {
+      DEBUG ("Tile %d, %d is missing: %s",
+          champlain_tile_get_x (tile),
+          champlain_tile_get_y (tile),
+          soup_status_get_phrase (msg->status_code));
+
+      if (tile_cache)
+        {
+          GTimeVal expire_time;
+
+          get_expire_time (CHAMPLAIN_NETWORK_TILE_SOURCE (map_source), msg,
+              MISSING_LIFETIME, &expire_time);
+          champlain_tile_set_expire_time (tile, &expire_time);
+          champlain_tile_cache_store_missing_tile (tile_cache, tile);
+        }
+
+      goto load_next;
+    }
+
   if (!SOUP_STATUS_IS_SUCCESSFUL (msg->status_code))
     {
       DEBUG ("Unable to download tile %d, %d: %s",
@@ -627,6 +868,8 @@ tile_loaded_cb (G_GNUC_UNUSED SoupSession *session,
   data = g_slice_new (TileRenderedData);
   data->map_source = map_source;
   data->etag = g_strdup (etag);
+  get_expire_time (CHAMPLAIN_NETWORK_TILE_SOURCE (map_source), msg,
+      DEFAULT_LIFETIME, &data->expire_time);
 
   g_signal_connect (tile, "render-complete", G_CALLBACK (tile_rendered_cb), data);
 
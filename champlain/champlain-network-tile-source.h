@@ -96,6 +96,14 @@ const gchar *champlain_network_tile_source_get_proxy_uri (ChamplainNetworkTileSo
 void champlain_network_tile_source_set_proxy_uri (ChamplainNetworkTileSource *tile_source,
     const gchar *proxy_uri);
 
+guint champlain_network_tile_source_get_min_lifetime (ChamplainNetworkTileSource *tile_source);
+void champlain_network_tile_source_set_min_lifetime (ChamplainNetworkTileSource *tile_source,
+    guint min_lifetime);
+
+guint champlain_network_tile_source_get_max_lifetime (ChamplainNetworkTileSource *tile_source);
+void champlain_network_tile_source_set_max_lifetime (ChamplainNetworkTileSource *tile_source,
+    guint max_lifetime);
+
 G_END_DECLS
 
 #endif /* _CHAMPLAIN_NETWORK_TILE_SOURCE_H_ */
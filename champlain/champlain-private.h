@@ -22,6 +22,10 @@
 #include <glib.h>
 #include <clutter/clutter.h>
 
+#include "champlain-tile.h"
+#include "champlain-tile-cache.h"
+#include "champlain-kinetic-scroll-view.h"
+
 
 #define CHAMPLAIN_PARAM_READABLE     \
   (G_PARAM_READABLE |     \
@@ -31,4 +35,49 @@
   (G_PARAM_READABLE | G_PARAM_WRITABLE | \
    G_PARAM_STATIC_NICK | G_PARAM_STATIC_NAME | G_PARAM_STATIC_BLURB)
 
+/* Brings a recycled tile back to the state of a newly created one */
+void champlain_tile_reset (ChamplainTile *self);
+
+/* Identifies a cached tile without allocating a string: zoom, x and y
+ * packed into 64 bits plus the interned id of the map source */
+typedef struct
+{
+  guint64 zxy;
+  const gchar *source_id;
+} ChamplainTileKey;
+
+/* source_id must already be interned, see
+ * champlain_tile_cache_get_source_id() */
+void champlain_tile_key_init (ChamplainTileKey *key,
+    const gchar *source_id,
+    guint zoom_level,
+    guint x,
+    guint y);
+guint champlain_tile_key_hash (gconstpointer key);
+gboolean champlain_tile_key_equal (gconstpointer a,
+    gconstpointer b);
+
+/* Interned id of the source behind a tile cache, refreshed only when the
+ * id changes */
+const gchar *champlain_tile_cache_get_source_id (ChamplainTileCache *tile_cache);
+
+/* Negative caching support of a ChamplainTileCache subclass, kept out of the
+ * public class structure so that its size doesn't change */
+typedef void (*ChamplainStoreMissingTileFunc)(ChamplainTileCache *tile_cache,
+    ChamplainTile *tile);
+
+void champlain_tile_cache_class_set_store_missing_tile (ChamplainTileCacheClass *klass,
+    ChamplainStoreMissingTileFunc func);
+
+/* Fills a tile the cache knows to be missing in the tile source from the
+ * source following the tile source, without asking the tile source */
+void champlain_tile_cache_fill_missing_tile (ChamplainTileCache *tile_cache,
+    ChamplainTile *tile);
+
+/* Where the running kinetic deceleration of the scroll view comes to rest,
+ * FALSE when it isn't decelerating */
+gboolean champlain_kinetic_scroll_view_get_deceleration_target (ChamplainKineticScrollView *scroll,
+    gdouble *x,
+    gdouble *y);
+
 #endif
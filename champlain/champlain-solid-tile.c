@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors (see AUTHORS)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * SECTION:champlain-solid-tile
+ * @short_description: Shares textures between tiles of a single color
+ *
+ * Sea, land without features and empty overlay tiles consist of a single
+ * color. Instead of a texture per tile, all the tiles of a color display
+ * the same 1x1 texture scaled to the tile size. Colors are stored as
+ * 0xRRGGBBAA like in gdk_pixbuf_fill().
+ */
+
+#define DEBUG_FLAG CHAMPLAIN_DEBUG_LOADING
+#include "champlain-debug.h"
+
+#include "champlain-solid-tile.h"
+
+#include <string.h>
+
+/* The number of colors whose textures are kept; tiles of other colors get
+ * their own texture */
+#define MAX_SHARED_COLORS 64
+
+/* color -> CoglHandle, used from the main loop only */
+static GHashTable *textures = NULL;
+
+static GQuark color_quark = 0;
+
+
+/*
+ * champlain_solid_tile_detect:
+ * @pixels: 8 bits per sample RGB or RGBA pixels
+ * @width: the width of the image
+ * @height: the height of the image
+ * @rowstride: the distance between the rows in bytes
+ * @has_alpha: whether the pixels have an alpha channel
+ * @color: (out): the color of the image
+ *
+ * Checks whether all the pixels of the image have the same color. Returns
+ * early at the first different pixel, which is usually in the first row of
+ * images with some content.
+ *
+ * Returns: TRUE if the image has a single color
+ */
+gboolean
+champlain_solid_tile_detect (const guchar *pixels,
+    gint width,
+    gint height,
+    gint rowstride,
+    gboolean has_alpha,
+    guint32 *color)
+{
+  gint n_channels = has_alpha ? 4 : 3;
+  gint row_bytes = width * n_channels;
+  gint row, col;
+
+  if (width <= 0 || height <= 0)
+    return FALSE;
+
+  for (col = n_channels; col < row_bytes; col += n_channels)
+    {
+      if (memcmp (pixels, pixels + col, n_channels) != 0)
+        return FALSE;
+    }
+
+  for (row = 1; row < height; row++)
+    {
+      if (memcmp (pixels, pixels + row * rowstride, row_bytes) != 0)
+        return FALSE;
+    }
+
+  *color = ((guint32) pixels[0] << 24) | ((guint32) pixels[1] << 16) |
+    ((guint32) pixels[2] << 8) | (has_alpha ? pixels[3] : 0xff);
+
+  return TRUE;
+}
+
+
+static CoglHandle
+create_texture (guint32 color)
+{
+  guchar pixel[4];
+
+  pixel[0] = color >> 24;
+  pixel[1] = (color >> 16) & 0xff;
+  pixel[2] = (color >> 8) & 0xff;
+  pixel[3] = color & 0xff;
+
+  return cogl_texture_new_from_data (1, 1, COGL_TEXTURE_NONE,
+      COGL_PIXEL_FORMAT_RGBA_8888, COGL_PIXEL_FORMAT_ANY,
+      4, pixel);
+}
+
+
+/*
+ * champlain_solid_tile_new:
+ * @color: the color of the tile
+ * @size: the width and height of the tile
+ *
+ * Creates a tile actor of a single color sharing its texture with the other
+ * tiles of the color.
+ *
+ * Returns: a new floating #ClutterActor
+ */
+ClutterActor *
+champlain_solid_tile_new (guint32 color,
+    guint size)
+{
+  ClutterActor *actor;
+  CoglHandle texture;
+  guint32 *data;
+
+  if (!textures)
+    {
+      textures = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+            NULL, (GDestroyNotify) cogl_handle_unref);
+      color_quark = g_quark_from_static_string ("champlain-solid-tile-color");
+    }
+
+  texture = g_hash_table_lookup (textures, GUINT_TO_POINTER (color));
+  if (texture)
+    cogl_handle_ref (texture);
+  else
+    {
+      texture = create_texture (color);
+      if (g_hash_table_size (textures) < MAX_SHARED_COLORS)
+        {
+          DEBUG ("New shared texture for color %08x", color);
+          g_hash_table_insert (textures, GUINT_TO_POINTER (color), cogl_handle_ref (texture));
+        }
+    }
+
+  actor = clutter_texture_new ();
+  clutter_texture_set_cogl_texture (CLUTTER_TEXTURE (actor), texture);
+  cogl_handle_unref (texture);
+  clutter_actor_set_size (actor, size, size);
+
+  data = g_new (guint32, 1);
+  *data = color;
+  g_object_set_qdata_full (G_OBJECT (actor), color_quark, data, g_free);
+
+  return actor;
+}
+
+
+/*
+ * champlain_solid_tile_get_color:
+ * @actor: a tile actor
+ * @color: (out): the color of the tile
+ *
+ * Checks whether the actor was created by champlain_solid_tile_new().
+ *
+ * Returns: TRUE if the actor is a single color tile
+ */
+gboolean
+champlain_solid_tile_get_color (ClutterActor *actor,
+    guint32 *color)
+{
+  guint32 *data;
+
+  if (!actor || !color_quark)
+    return FALSE;
+
+  data = g_object_get_qdata (G_OBJECT (actor), color_quark);
+  if (!data)
+    return FALSE;
+
+  *color = *data;
+
+  return TRUE;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors (see AUTHORS)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __CHAMPLAIN_SOLID_TILE_H__
+#define __CHAMPLAIN_SOLID_TILE_H__
+
+#include <glib.h>
+#include <clutter/clutter.h>
+
+G_BEGIN_DECLS
+
+gboolean champlain_solid_tile_detect (const guchar *pixels,
+    gint width,
+    gint height,
+    gint rowstride,
+    gboolean has_alpha,
+    guint32 *color);
+
+ClutterActor *champlain_solid_tile_new (guint32 color,
+    guint size);
+
+gboolean champlain_solid_tile_get_color (ClutterActor *actor,
+    guint32 *color);
+
+G_END_DECLS
+
+#endif /* __CHAMPLAIN_SOLID_TILE_H__ */
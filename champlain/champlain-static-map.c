@@ -0,0 +1,1213 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors (see AUTHORS)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * SECTION:champlain-static-map
+ * @short_description: Renders maps into images without a stage
+ *
+ * #ChamplainStaticMap renders a part of a map into a cairo image surface.
+ * The tiles are loaded through the given #ChamplainMapSource (usually a
+ * chain of caches and a network source) and composited with cairo, so no
+ * #ChamplainView or visible stage is needed. Clutter still has to be
+ * initialized as the map sources create their tiles as Clutter actors.
+ *
+ * The map is positioned either with champlain_static_map_center_on() or
+ * champlain_static_map_ensure_visible(). The content of #ChamplainPathLayer
+ * and of the #ChamplainPoint and #ChamplainLabel markers of
+ * #ChamplainMarkerLayer added with champlain_static_map_add_layer() is drawn
+ * over the tiles. Other markers and the images of labels are not drawn.
+ *
+ * Every call of champlain_static_map_render_async() works on a snapshot of
+ * the current settings, so several images can be rendered at the same time,
+ * from one or more #ChamplainStaticMap objects sharing the same map source.
+ */
+
+#define DEBUG_FLAG CHAMPLAIN_DEBUG_LOADING
+#include "champlain-debug.h"
+
+#include "champlain-static-map.h"
+
+#include "champlain-private.h"
+#include "champlain-tile.h"
+#include "champlain-solid-tile.h"
+#include "champlain-path-layer.h"
+#include "champlain-marker-layer.h"
+#include "champlain-point.h"
+#include "champlain-label.h"
+
+#include <clutter/clutter.h>
+#include <gdk/gdk.h>
+#include <pango/pangocairo.h>
+#include <math.h>
+#include <string.h>
+
+G_DEFINE_TYPE (ChamplainStaticMap, champlain_static_map, G_TYPE_OBJECT)
+
+#define GET_PRIVATE(obj) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), CHAMPLAIN_TYPE_STATIC_MAP, ChamplainStaticMapPrivate))
+
+/* The layout of cairo's ARGB32 format in memory */
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define CAIRO_COGL_FORMAT COGL_PIXEL_FORMAT_BGRA_8888_PRE
+#else
+#define CAIRO_COGL_FORMAT COGL_PIXEL_FORMAT_ARGB_8888_PRE
+#endif
+
+/* Same as in ChamplainLabel */
+#define RADIUS 10
+#define PADDING (RADIUS / 2)
+
+#define TILE_DATA_KEY "champlain-static-map-data"
+
+enum
+{
+  PROP_0,
+  PROP_MAP_SOURCE,
+  PROP_WIDTH,
+  PROP_HEIGHT,
+  PROP_LATITUDE,
+  PROP_LONGITUDE,
+  PROP_ZOOM_LEVEL
+};
+
+struct _ChamplainStaticMapPrivate
+{
+  ChamplainMapSource *map_source;
+  guint width;
+  guint height;
+  gdouble latitude;
+  gdouble longitude;
+  guint zoom_level;
+  GList *layers;
+};
+
+/* State of a single champlain_static_map_render_async() call */
+typedef struct
+{
+  ChamplainMapSource *map_source;
+  GSimpleAsyncResult *result;
+  GCancellable *cancellable;
+  gulong cancelled_id;
+  GList *layers;
+  guint zoom_level;
+  /* absolute position of the top left corner of the image */
+  gint origin_x;
+  gint origin_y;
+  cairo_surface_t *surface;
+  cairo_t *cr;
+  GList *tiles;
+  /* also counts the job being set up */
+  guint tiles_pending;
+} RenderJob;
+
+
+static void
+champlain_static_map_get_property (GObject *object,
+    guint prop_id,
+    GValue *value,
+    GParamSpec *pspec)
+{
+  ChamplainStaticMapPrivate *priv = CHAMPLAIN_STATIC_MAP (object)->priv;
+
+  switch (prop_id)
+    {
+    case PROP_MAP_SOURCE:
+      g_value_set_object (value, priv->map_source);
+      break;
+
+    case PROP_WIDTH:
+      g_value_set_uint (value, priv->width);
+      break;
+
+    case PROP_HEIGHT:
+      g_value_set_uint (value, priv->height);
+      break;
+
+    case PROP_LATITUDE:
+      g_value_set_double (value, priv->latitude);
+      break;
+
+    case PROP_LONGITUDE:
+      g_value_set_double (value, priv->longitude);
+      break;
+
+    case PROP_ZOOM_LEVEL:
+      g_value_set_uint (value, priv->zoom_level);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+
+static void
+champlain_static_map_set_property (GObject *object,
+    guint prop_id,
+    const GValue *value,
+    GParamSpec *pspec)
+{
+  ChamplainStaticMap *map = CHAMPLAIN_STATIC_MAP (object);
+  ChamplainStaticMapPrivate *priv = map->priv;
+
+  switch (prop_id)
+    {
+    case PROP_MAP_SOURCE:
+      priv->map_source = g_value_dup_object (value);
+      break;
+
+    case PROP_WIDTH:
+      champlain_static_map_set_size (map, g_value_get_uint (value), priv->height);
+      break;
+
+    case PROP_HEIGHT:
+      champlain_static_map_set_size (map, priv->width, g_value_get_uint (value));
+      break;
+
+    case PROP_LATITUDE:
+      champlain_static_map_center_on (map, g_value_get_double (value),
+          priv->longitude, priv->zoom_level);
+      break;
+
+    case PROP_LONGITUDE:
+      champlain_static_map_center_on (map, priv->latitude,
+          g_value_get_double (value), priv->zoom_level);
+      break;
+
+    case PROP_ZOOM_LEVEL:
+      champlain_static_map_center_on (map, priv->latitude,
+          priv->longitude, g_value_get_uint (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+
+static void
+champlain_static_map_dispose (GObject *object)
+{
+  ChamplainStaticMapPrivate *priv = CHAMPLAIN_STATIC_MAP (object)->priv;
+
+  if (priv->map_source)
+    {
+      g_object_unref (priv->map_source);
+      priv->map_source = NULL;
+    }
+
+  g_list_foreach (priv->layers, (GFunc) g_object_unref, NULL);
+  g_list_free (priv->layers);
+  priv->layers = NULL;
+
+  G_OBJECT_CLASS (champlain_static_map_parent_class)->dispose (object);
+}
+
+
+static void
+champlain_static_map_class_init (ChamplainStaticMapClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  g_type_class_add_private (klass, sizeof (ChamplainStaticMapPrivate));
+
+  object_class->get_property = champlain_static_map_get_property;
+  object_class->set_property = champlain_static_map_set_property;
+  object_class->dispose = champlain_static_map_dispose;
+
+  /**
+   * ChamplainStaticMap:map-source:
+   *
+   * The map source the tiles are loaded from
+   *
+   * Since: 0.14
+   */
+  g_object_class_install_property (object_class,
+      PROP_MAP_SOURCE,
+      g_param_spec_object ("map-source",
+          "Map source",
+          "The map source the tiles are loaded from",
+          CHAMPLAIN_TYPE_MAP_SOURCE,
+          G_PARAM_CONSTRUCT_ONLY | CHAMPLAIN_PARAM_READWRITE));
+
+  /**
+   * ChamplainStaticMap:width:
+   *
+   * The width of the rendered image in pixels
+   *
+   * Since: 0.14
+   */
+  g_object_class_install_property (object_class,
+      PROP_WIDTH,
+      g_param_spec_uint ("width",
+          "Width",
+          "The width of the rendered image",
+          1, G_MAXINT16, 256,
+          CHAMPLAIN_PARAM_READWRITE));
+
+  /**
+   * ChamplainStaticMap:height:
+   *
+   * The height of the rendered image in pixels
+   *
+   * Since: 0.14
+   */
+  g_object_class_install_property (object_class,
+      PROP_HEIGHT,
+      g_param_spec_uint ("height",
+          "Height",
+          "The height of the rendered image",
+          1, G_MAXINT16, 256,
+          CHAMPLAIN_PARAM_READWRITE));
+
+  /**
+   * ChamplainStaticMap:latitude:
+   *
+   * The latitude of the center of the image
+   *
+   * Since: 0.14
+   */
+  g_object_class_install_property (object_class,
+      PROP_LATITUDE,
+      g_param_spec_double ("latitude",
+          "Latitude",
+          "The latitude of the center of the image",
+          -90.0f, 90.0f, 0.0f,
+          CHAMPLAIN_PARAM_READWRITE));
+
+  /**
+   * ChamplainStaticMap:longitude:
+   *
+   * The longitude of the center of the image
+   *
+   * Since: 0.14
+   */
+  g_object_class_install_property (object_class,
+      PROP_LONGITUDE,
+      g_param_spec_double ("longitude",
+          "Longitude",
+          "The longitude of the center of the image",
+          -180.0f, 180.0f, 0.0f,
+          CHAMPLAIN_PARAM_READWRITE));
+
+  /**
+   * ChamplainStaticMap:zoom-level:
+   *
+   * The zoom level of the image
+   *
+   * Since: 0.14
+   */
+  g_object_class_install_property (object_class,
+      PROP_ZOOM_LEVEL,
+      g_param_spec_uint ("zoom-level",
+          "Zoom level",
+          "The zoom level of the image",
+          0, 20, 0,
+          CHAMPLAIN_PARAM_READWRITE));
+}
+
+
+static void
+champlain_static_map_init (ChamplainStaticMap *map)
+{
+  ChamplainStaticMapPrivate *priv = GET_PRIVATE (map);
+
+  map->priv = priv;
+
+  priv->map_source = NULL;
+  priv->width = 256;
+  priv->height = 256;
+  priv->latitude = 0.0;
+  priv->longitude = 0.0;
+  priv->zoom_level = 0;
+  priv->layers = NULL;
+}
+
+
+/**
+ * champlain_static_map_new:
+ * @map_source: the #ChamplainMapSource the tiles are loaded from
+ * @width: the width of the rendered image
+ * @height: the height of the rendered image
+ *
+ * Creates an instance of #ChamplainStaticMap.
+ *
+ * Returns: a new #ChamplainStaticMap
+ *
+ * Since: 0.14
+ */
+ChamplainStaticMap *
+champlain_static_map_new (ChamplainMapSource *map_source,
+    guint width,
+    guint height)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_MAP_SOURCE (map_source), NULL);
+
+  return g_object_new (CHAMPLAIN_TYPE_STATIC_MAP,
+      "map-source", map_source,
+      "width", width,
+      "height", height,
+      NULL);
+}
+
+
+/**
+ * champlain_static_map_get_map_source:
+ * @map: a #ChamplainStaticMap
+ *
+ * Gets the map source the tiles are loaded from.
+ *
+ * Returns: (transfer none): the map source
+ *
+ * Since: 0.14
+ */
+ChamplainMapSource *
+champlain_static_map_get_map_source (ChamplainStaticMap *map)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_STATIC_MAP (map), NULL);
+
+  return map->priv->map_source;
+}
+
+
+/**
+ * champlain_static_map_set_size:
+ * @map: a #ChamplainStaticMap
+ * @width: the width of the rendered image
+ * @height: the height of the rendered image
+ *
+ * Sets the size of the rendered images.
+ *
+ * Since: 0.14
+ */
+void
+champlain_static_map_set_size (ChamplainStaticMap *map,
+    guint width,
+    guint height)
+{
+  g_return_if_fail (CHAMPLAIN_IS_STATIC_MAP (map));
+  g_return_if_fail (width > 0 && height > 0);
+
+  ChamplainStaticMapPrivate *priv = map->priv;
+
+  g_object_freeze_notify (G_OBJECT (map));
+
+  if (priv->width != width)
+    {
+      priv->width = width;
+      g_object_notify (G_OBJECT (map), "width");
+    }
+
+  if (priv->height != height)
+    {
+      priv->height = height;
+      g_object_notify (G_OBJECT (map), "height");
+    }
+
+  g_object_thaw_notify (G_OBJECT (map));
+}
+
+
+/**
+ * champlain_static_map_get_size:
+ * @map: a #ChamplainStaticMap
+ * @width: (out) (allow-none): return location for the width
+ * @height: (out) (allow-none): return location for the height
+ *
+ * Gets the size of the rendered images.
+ *
+ * Since: 0.14
+ */
+void
+champlain_static_map_get_size (ChamplainStaticMap *map,
+    guint *width,
+    guint *height)
+{
+  g_return_if_fail (CHAMPLAIN_IS_STATIC_MAP (map));
+
+  if (width)
+    *width = map->priv->width;
+  if (height)
+    *height = map->priv->height;
+}
+
+
+/**
+ * champlain_static_map_center_on:
+ * @map: a #ChamplainStaticMap
+ * @latitude: the latitude of the center of the image
+ * @longitude: the longitude of the center of the image
+ * @zoom_level: the zoom level
+ *
+ * Positions the map so that the given coordinates are in the center of
+ * the image. The zoom level is clamped to the zoom levels supported by the
+ * map source.
+ *
+ * Since: 0.14
+ */
+void
+champlain_static_map_center_on (ChamplainStaticMap *map,
+    gdouble latitude,
+    gdouble longitude,
+    guint zoom_level)
+{
+  g_return_if_fail (CHAMPLAIN_IS_STATIC_MAP (map));
+
+  ChamplainStaticMapPrivate *priv = map->priv;
+  guint min_zoom = champlain_map_source_get_min_zoom_level (priv->map_source);
+  guint max_zoom = champlain_map_source_get_max_zoom_level (priv->map_source);
+
+  g_object_freeze_notify (G_OBJECT (map));
+
+  priv->latitude = CLAMP (latitude, -90.0, 90.0);
+  priv->longitude = CLAMP (longitude, -180.0, 180.0);
+  priv->zoom_level = CLAMP (zoom_level, min_zoom, max_zoom);
+
+  g_object_notify (G_OBJECT (map), "latitude");
+  g_object_notify (G_OBJECT (map), "longitude");
+  g_object_notify (G_OBJECT (map), "zoom-level");
+
+  g_object_thaw_notify (G_OBJECT (map));
+}
+
+
+/**
+ * champlain_static_map_ensure_visible:
+ * @map: a #ChamplainStaticMap
+ * @bbox: the bounding box to show
+ *
+ * Centers the map on the bounding box and uses the highest zoom level at
+ * which the whole bounding box fits in the image.
+ *
+ * Since: 0.14
+ */
+void
+champlain_static_map_ensure_visible (ChamplainStaticMap *map,
+    ChamplainBoundingBox *bbox)
+{
+  g_return_if_fail (CHAMPLAIN_IS_STATIC_MAP (map));
+  g_return_if_fail (bbox != NULL);
+
+  ChamplainStaticMapPrivate *priv = map->priv;
+  guint min_zoom = champlain_map_source_get_min_zoom_level (priv->map_source);
+  guint zoom_level = champlain_map_source_get_max_zoom_level (priv->map_source);
+  gdouble latitude, longitude;
+
+  if (!champlain_bounding_box_is_valid (bbox))
+    return;
+
+  for (; zoom_level > min_zoom; zoom_level--)
+    {
+      gdouble width, height;
+
+      width = champlain_map_source_get_x (priv->map_source, zoom_level, bbox->right) -
+        champlain_map_source_get_x (priv->map_source, zoom_level, bbox->left);
+      height = champlain_map_source_get_y (priv->map_source, zoom_level, bbox->bottom) -
+        champlain_map_source_get_y (priv->map_source, zoom_level, bbox->top);
+
+      if (width <= priv->width && height <= priv->height)
+        break;
+    }
+
+  champlain_bounding_box_get_center (bbox, &latitude, &longitude);
+  champlain_static_map_center_on (map, latitude, longitude, zoom_level);
+}
+
+
+/**
+ * champlain_static_map_get_latitude:
+ * @map: a #ChamplainStaticMap
+ *
+ * Gets the latitude of the center of the image.
+ *
+ * Returns: the latitude
+ *
+ * Since: 0.14
+ */
+gdouble
+champlain_static_map_get_latitude (ChamplainStaticMap *map)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_STATIC_MAP (map), 0.0);
+
+  return map->priv->latitude;
+}
+
+
+/**
+ * champlain_static_map_get_longitude:
+ * @map: a #ChamplainStaticMap
+ *
+ * Gets the longitude of the center of the image.
+ *
+ * Returns: the longitude
+ *
+ * Since: 0.14
+ */
+gdouble
+champlain_static_map_get_longitude (ChamplainStaticMap *map)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_STATIC_MAP (map), 0.0);
+
+  return map->priv->longitude;
+}
+
+
+/**
+ * champlain_static_map_get_zoom_level:
+ * @map: a #ChamplainStaticMap
+ *
+ * Gets the zoom level of the image.
+ *
+ * Returns: the zoom level
+ *
+ * Since: 0.14
+ */
+guint
+champlain_static_map_get_zoom_level (ChamplainStaticMap *map)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_STATIC_MAP (map), 0);
+
+  return map->priv->zoom_level;
+}
+
+
+/**
+ * champlain_static_map_add_layer:
+ * @map: a #ChamplainStaticMap
+ * @layer: a #ChamplainPathLayer or #ChamplainMarkerLayer
+ *
+ * Adds a layer drawn over the tiles. Layers are drawn in the order they
+ * were added. The layer must not be modified while an image is being
+ * rendered.
+ *
+ * Since: 0.14
+ */
+void
+champlain_static_map_add_layer (ChamplainStaticMap *map,
+    ChamplainLayer *layer)
+{
+  g_return_if_fail (CHAMPLAIN_IS_STATIC_MAP (map));
+  g_return_if_fail (CHAMPLAIN_IS_LAYER (layer));
+
+  map->priv->layers = g_list_append (map->priv->layers, g_object_ref_sink (layer));
+}
+
+
+/**
+ * champlain_static_map_remove_layer:
+ * @map: a #ChamplainStaticMap
+ * @layer: a #ChamplainLayer added with champlain_static_map_add_layer()
+ *
+ * Removes a layer from the map.
+ *
+ * Since: 0.14
+ */
+void
+champlain_static_map_remove_layer (ChamplainStaticMap *map,
+    ChamplainLayer *layer)
+{
+  g_return_if_fail (CHAMPLAIN_IS_STATIC_MAP (map));
+  g_return_if_fail (CHAMPLAIN_IS_LAYER (layer));
+
+  ChamplainStaticMapPrivate *priv = map->priv;
+  GList *link = g_list_find (priv->layers, layer);
+
+  if (!link)
+    return;
+
+  priv->layers = g_list_delete_link (priv->layers, link);
+  g_object_unref (layer);
+}
+
+
+static void
+set_source_color (cairo_t *cr,
+    const ClutterColor *color)
+{
+  cairo_set_source_rgba (cr,
+      color->red / 255.0,
+      color->green / 255.0,
+      color->blue / 255.0,
+      color->alpha / 255.0);
+}
+
+
+static void
+draw_path_layer (RenderJob *job,
+    ChamplainPathLayer *layer)
+{
+  cairo_t *cr = job->cr;
+  GList *nodes, *elem, *dash;
+  gdouble *dashes;
+  guint num_dashes, i;
+
+  if (!champlain_path_layer_get_visible (layer))
+    return;
+
+  nodes = champlain_path_layer_get_nodes (layer);
+  for (elem = nodes; elem != NULL; elem = elem->next)
+    {
+      ChamplainLocation *location = CHAMPLAIN_LOCATION (elem->data);
+      gdouble x, y;
+
+      x = champlain_map_source_get_x (job->map_source, job->zoom_level,
+            champlain_location_get_longitude (location)) - job->origin_x;
+      y = champlain_map_source_get_y (job->map_source, job->zoom_level,
+            champlain_location_get_latitude (location)) - job->origin_y;
+
+      cairo_line_to (job->cr, x, y);
+    }
+  g_list_free (nodes);
+
+  if (champlain_path_layer_get_closed (layer))
+    cairo_close_path (cr);
+
+  set_source_color (cr, champlain_path_layer_get_fill_color (layer));
+  if (champlain_path_layer_get_fill (layer))
+    cairo_fill_preserve (cr);
+
+  dash = champlain_path_layer_get_dash (layer);
+  num_dashes = g_list_length (dash);
+  dashes = g_new (gdouble, num_dashes);
+  for (elem = dash, i = 0; elem != NULL; elem = elem->next, i++)
+    dashes[i] = GPOINTER_TO_UINT (elem->data);
+  g_list_free (dash);
+
+  set_source_color (cr, champlain_path_layer_get_stroke_color (layer));
+  cairo_set_line_width (cr, champlain_path_layer_get_stroke_width (layer));
+  cairo_set_dash (cr, dashes, num_dashes, 0);
+  g_free (dashes);
+
+  if (champlain_path_layer_get_stroke (layer))
+    cairo_stroke (cr);
+
+  cairo_new_path (cr);
+  cairo_set_dash (cr, NULL, 0, 0);
+}
+
+
+static void
+draw_point (cairo_t *cr,
+    ChamplainPoint *point,
+    gdouble x,
+    gdouble y)
+{
+  gdouble radius = champlain_point_get_size (point) / 2.0;
+
+  if (champlain_marker_get_selected (CHAMPLAIN_MARKER (point)))
+    set_source_color (cr, champlain_marker_get_selection_color ());
+  else
+    set_source_color (cr, champlain_point_get_color (point));
+
+  cairo_arc (cr, x, y, radius, 0, 2 * M_PI);
+  cairo_fill (cr);
+}
+
+
+/* Same shape as the background of ChamplainLabel */
+static void
+draw_label_box (cairo_t *cr,
+    gint width,
+    gint height,
+    gint point,
+    gboolean mirror)
+{
+  if (mirror)
+    {
+      cairo_move_to (cr, RADIUS, 0);
+      cairo_line_to (cr, width - RADIUS, 0);
+      cairo_arc (cr, width - RADIUS, RADIUS, RADIUS - 1, 3 * M_PI / 2.0, 0);
+      cairo_line_to (cr, width, height - RADIUS);
+      cairo_arc (cr, width - RADIUS, height - RADIUS, RADIUS - 1, 0, M_PI / 2.0);
+      cairo_line_to (cr, point, height);
+      cairo_line_to (cr, 0, height + point);
+      cairo_arc (cr, RADIUS, RADIUS, RADIUS - 1, M_PI, 3 * M_PI / 2.0);
+      cairo_close_path (cr);
+    }
+  else
+    {
+      cairo_move_to (cr, RADIUS, 0);
+      cairo_line_to (cr, width - RADIUS, 0);
+      cairo_arc (cr, width - RADIUS, RADIUS, RADIUS - 1, 3 * M_PI / 2.0, 0);
+      cairo_line_to (cr, width, height + point);
+      cairo_line_to (cr, width - point, height);
+      cairo_line_to (cr, RADIUS, height);
+      cairo_arc (cr, RADIUS, height - RADIUS, RADIUS - 1, M_PI / 2.0, M_PI);
+      cairo_line_to (cr, 0, RADIUS);
+      cairo_arc (cr, RADIUS, RADIUS, RADIUS - 1, M_PI, 3 * M_PI / 2.0);
+      cairo_close_path (cr);
+    }
+}
+
+
+static void
+draw_label (cairo_t *cr,
+    ChamplainLabel *label,
+    gdouble x,
+    gdouble y)
+{
+  gboolean selected = champlain_marker_get_selected (CHAMPLAIN_MARKER (label));
+  const gchar *text = champlain_label_get_text (label);
+  PangoAlignment alignment = champlain_label_get_alignment (label);
+  PangoFontDescription *font;
+  PangoLayout *layout;
+  ClutterColor darker_color;
+  const ClutterColor *color;
+  gint text_width, text_height;
+  gint width, height, point;
+
+  if (text == NULL || strlen (text) == 0)
+    return;
+
+  layout = pango_cairo_create_layout (cr);
+  font = pango_font_description_from_string (champlain_label_get_font_name (label));
+  pango_layout_set_font_description (layout, font);
+  pango_font_description_free (font);
+
+  if (champlain_label_get_use_markup (label))
+    pango_layout_set_markup (layout, text, -1);
+  else
+    pango_layout_set_text (layout, text, -1);
+  pango_layout_set_alignment (layout, alignment);
+  pango_layout_set_ellipsize (layout, champlain_label_get_ellipsize (label));
+  if (champlain_label_get_wrap (label))
+    pango_layout_set_wrap (layout, champlain_label_get_wrap_mode (label));
+  if (champlain_label_get_attributes (label))
+    pango_layout_set_attributes (layout, champlain_label_get_attributes (label));
+  pango_layout_get_pixel_size (layout, &text_width, &text_height);
+
+  width = text_width + 4 * PADDING;
+  height = text_height + 2 * PADDING;
+  point = (height + 2 * PADDING) / 4.0;
+
+  cairo_save (cr);
+
+  /* The anchor points of ChamplainLabel */
+  if (champlain_label_get_draw_background (label))
+    {
+      if (alignment == PANGO_ALIGN_RIGHT)
+        cairo_translate (cr, x - width, y - height - point);
+      else
+        cairo_translate (cr, x, y - height - point);
+
+      color = selected ? champlain_marker_get_selection_color () :
+        champlain_label_get_color (label);
+      clutter_color_darken (color, &darker_color);
+
+      draw_label_box (cr, width, height, point, alignment == PANGO_ALIGN_LEFT);
+      set_source_color (cr, color);
+      cairo_fill_preserve (cr);
+      cairo_set_line_width (cr, 1.0);
+      set_source_color (cr, &darker_color);
+      cairo_stroke (cr);
+    }
+  else
+    cairo_translate (cr, x - 2 * PADDING, y - text_height / 2.0 - PADDING);
+
+  color = selected ? champlain_marker_get_selection_text_color () :
+    champlain_label_get_text_color (label);
+  set_source_color (cr, color);
+  cairo_move_to (cr, 2 * PADDING, PADDING);
+  pango_cairo_show_layout (cr, layout);
+
+  cairo_restore (cr);
+  g_object_unref (layout);
+}
+
+
+static void
+draw_marker_layer (RenderJob *job,
+    ChamplainMarkerLayer *layer)
+{
+  GList *markers, *elem;
+
+  markers = champlain_marker_layer_get_markers (layer);
+
+  /* The list is in the reverse stacking order */
+  for (elem = g_list_last (markers); elem != NULL; elem = elem->prev)
+    {
+      ChamplainLocation *location = CHAMPLAIN_LOCATION (elem->data);
+      gdouble x, y;
+
+      if (!CLUTTER_ACTOR_IS_VISIBLE (CLUTTER_ACTOR (location)))
+        continue;
+
+      x = champlain_map_source_get_x (job->map_source, job->zoom_level,
+            champlain_location_get_longitude (location)) - job->origin_x;
+      y = champlain_map_source_get_y (job->map_source, job->zoom_level,
+            champlain_location_get_latitude (location)) - job->origin_y;
+
+      if (CHAMPLAIN_IS_POINT (location))
+        draw_point (job->cr, CHAMPLAIN_POINT (location), x, y);
+      else if (CHAMPLAIN_IS_LABEL (location))
+        draw_label (job->cr, CHAMPLAIN_LABEL (location), x, y);
+    }
+
+  g_list_free (markers);
+}
+
+
+static void
+render_job_free (RenderJob *job)
+{
+  if (job->cancellable)
+    {
+      /* g_cancellable_disconnect() deadlocks when called from the
+         cancelled handler, which is where cancelled jobs finish */
+      if (job->cancelled_id != 0 && g_cancellable_is_cancelled (job->cancellable))
+        g_signal_handler_disconnect (job->cancellable, job->cancelled_id);
+      else
+        g_cancellable_disconnect (job->cancellable, job->cancelled_id);
+      g_object_unref (job->cancellable);
+    }
+
+  g_list_foreach (job->layers, (GFunc) g_object_unref, NULL);
+  g_list_free (job->layers);
+
+  if (job->cr)
+    cairo_destroy (job->cr);
+  if (job->surface)
+    cairo_surface_destroy (job->surface);
+
+  g_object_unref (job->result);
+  g_object_unref (job->map_source);
+  g_slice_free (RenderJob, job);
+}
+
+
+static void
+render_job_finish (RenderJob *job)
+{
+  GError *error = NULL;
+  GList *elem;
+
+  if (g_cancellable_set_error_if_cancelled (job->cancellable, &error))
+    {
+      g_simple_async_result_set_from_error (job->result, error);
+      g_error_free (error);
+    }
+  else
+    {
+      for (elem = job->layers; elem != NULL; elem = elem->next)
+        {
+          if (CHAMPLAIN_IS_PATH_LAYER (elem->data))
+            draw_path_layer (job, CHAMPLAIN_PATH_LAYER (elem->data));
+          else if (CHAMPLAIN_IS_MARKER_LAYER (elem->data))
+            draw_marker_layer (job, CHAMPLAIN_MARKER_LAYER (elem->data));
+        }
+
+      cairo_surface_flush (job->surface);
+      g_simple_async_result_set_op_res_gpointer (job->result,
+          cairo_surface_reference (job->surface),
+          (GDestroyNotify) cairo_surface_destroy);
+    }
+
+  /* the tiles may be done before render_async() returns */
+  g_simple_async_result_complete_in_idle (job->result);
+  render_job_free (job);
+}
+
+
+static gboolean
+paint_image_data (RenderJob *job,
+    GByteArray *data,
+    gint x,
+    gint y)
+{
+  GdkPixbufLoader *loader;
+  GdkPixbuf *pixbuf = NULL;
+
+  loader = gdk_pixbuf_loader_new ();
+  if (gdk_pixbuf_loader_write (loader, data->data, data->len, NULL) &&
+      gdk_pixbuf_loader_close (loader, NULL))
+    pixbuf = gdk_pixbuf_loader_get_pixbuf (loader);
+  else
+    gdk_pixbuf_loader_close (loader, NULL);
+
+  if (pixbuf)
+    {
+      gdk_cairo_set_source_pixbuf (job->cr, pixbuf, x, y);
+      cairo_paint (job->cr);
+    }
+
+  g_object_unref (loader);
+
+  return pixbuf != NULL;
+}
+
+
+/* Used for tiles without image data, e.g. error tiles, single color tiles
+   or tiles decoded by the memory cache */
+static void
+paint_content (RenderJob *job,
+    ClutterActor *content,
+    gint x,
+    gint y,
+    guint size)
+{
+  cairo_surface_t *surface;
+  CoglHandle texture;
+  guint width, height;
+  guint32 color;
+
+  if (!content || !CLUTTER_IS_TEXTURE (content))
+    return;
+
+  /* Single color tiles share a 1x1 texture */
+  if (champlain_solid_tile_get_color (content, &color))
+    {
+      cairo_set_source_rgba (job->cr,
+          (color >> 24) / 255.0,
+          ((color >> 16) & 0xff) / 255.0,
+          ((color >> 8) & 0xff) / 255.0,
+          (color & 0xff) / 255.0);
+      cairo_rectangle (job->cr, x, y, size, size);
+      cairo_fill (job->cr);
+      return;
+    }
+
+  texture = clutter_texture_get_cogl_texture (CLUTTER_TEXTURE (content));
+  if (texture == COGL_INVALID_HANDLE)
+    return;
+
+  width = cogl_texture_get_width (texture);
+  height = cogl_texture_get_height (texture);
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+  cairo_surface_flush (surface);
+
+  cogl_texture_get_data (texture,
+      CAIRO_COGL_FORMAT,
+      cairo_image_surface_get_stride (surface),
+      cairo_image_surface_get_data (surface));
+  cairo_surface_mark_dirty (surface);
+
+  /* The texture may be smaller than the tile, scale it to the tile size */
+  cairo_save (job->cr);
+  cairo_translate (job->cr, x, y);
+  if (width > 0 && height > 0 && (width != size || height != size))
+    cairo_scale (job->cr, (gdouble) size / width, (gdouble) size / height);
+  cairo_set_source_surface (job->cr, surface, 0, 0);
+  cairo_paint (job->cr);
+  cairo_restore (job->cr);
+  cairo_surface_destroy (surface);
+}
+
+
+/* Decides per tile how it gets painted: the encoded image is decoded with
+   GdkPixbuf when the renderer delivered one, except for single color tiles
+   which are painted as a rectangle. Everything else is read back from its
+   texture. */
+static void
+tile_rendered_cb (ChamplainTile *tile,
+    gpointer data,
+    guint size,
+    gboolean error,
+    G_GNUC_UNUSED RenderJob *job)
+{
+  GByteArray *bytes;
+  guint32 color;
+
+  if (error || !data || size == 0 ||
+      champlain_solid_tile_get_color (champlain_tile_get_content (tile), &color))
+    return;
+
+  /* keep the encoded image of the last successful render */
+  bytes = g_byte_array_sized_new (size);
+  g_byte_array_append (bytes, data, size);
+  g_object_set_data_full (G_OBJECT (tile), TILE_DATA_KEY, bytes,
+      (GDestroyNotify) g_byte_array_unref);
+}
+
+
+static void
+tile_state_notify (ChamplainTile *tile,
+    G_GNUC_UNUSED GParamSpec *pspec,
+    RenderJob *job)
+{
+  GByteArray *data;
+  gint x, y;
+
+  if (champlain_tile_get_state (tile) != CHAMPLAIN_STATE_DONE)
+    return;
+
+  g_signal_handlers_disconnect_by_func (tile, tile_state_notify, job);
+  g_signal_handlers_disconnect_by_func (tile, tile_rendered_cb, job);
+
+  if (!g_cancellable_is_cancelled (job->cancellable))
+    {
+      x = champlain_tile_get_x (tile) * champlain_tile_get_size (tile) - job->origin_x;
+      y = champlain_tile_get_y (tile) * champlain_tile_get_size (tile) - job->origin_y;
+
+      data = g_object_get_data (G_OBJECT (tile), TILE_DATA_KEY);
+      if (!data || !paint_image_data (job, data, x, y))
+        paint_content (job, champlain_tile_get_content (tile), x, y,
+            champlain_tile_get_size (tile));
+    }
+
+  g_object_set_data (G_OBJECT (tile), TILE_DATA_KEY, NULL);
+  job->tiles = g_list_remove (job->tiles, tile);
+  g_object_unref (tile);
+
+  if (--job->tiles_pending == 0)
+    render_job_finish (job);
+}
+
+
+static void
+render_cancelled_cb (G_GNUC_UNUSED GCancellable *cancellable,
+    RenderJob *job)
+{
+  GList *tiles, *elem;
+
+  /* terminates the loading, the job finishes with the last tile */
+  tiles = g_list_copy (job->tiles);
+  for (elem = tiles; elem != NULL; elem = elem->next)
+    champlain_tile_set_state (CHAMPLAIN_TILE (elem->data), CHAMPLAIN_STATE_DONE);
+  g_list_free (tiles);
+}
+
+
+/**
+ * champlain_static_map_render_async:
+ * @map: a #ChamplainStaticMap
+ * @cancellable: (allow-none): optional #GCancellable object, %NULL to ignore
+ * @callback: (scope async): a #GAsyncReadyCallback to call when the image
+ * is rendered
+ * @user_data: (closure): the data to pass to callback function
+ *
+ * Loads the tiles visible at the current position of the map and renders
+ * them together with the layers of the map. When the image is ready,
+ * @callback is called from the main loop and
+ * champlain_static_map_render_finish() returns the image.
+ *
+ * Since: 0.14
+ */
+void
+champlain_static_map_render_async (ChamplainStaticMap *map,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  g_return_if_fail (CHAMPLAIN_IS_STATIC_MAP (map));
+
+  ChamplainStaticMapPrivate *priv = map->priv;
+  RenderJob *job;
+  GList *tiles, *elem;
+  gint tile_size, x_first, y_first, x_last, y_last, x, y;
+  gint column_count, row_count;
+
+  job = g_slice_new0 (RenderJob);
+  job->map_source = g_object_ref (priv->map_source);
+  job->result = g_simple_async_result_new (G_OBJECT (map), callback, user_data,
+        champlain_static_map_render_async);
+  job->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+  job->layers = g_list_copy (priv->layers);
+  g_list_foreach (job->layers, (GFunc) g_object_ref, NULL);
+  job->zoom_level = priv->zoom_level;
+  job->origin_x = champlain_map_source_get_x (priv->map_source, priv->zoom_level,
+        priv->longitude) - priv->width / 2;
+  job->origin_y = champlain_map_source_get_y (priv->map_source, priv->zoom_level,
+        priv->latitude) - priv->height / 2;
+  job->surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+        priv->width, priv->height);
+  job->cr = cairo_create (job->surface);
+  job->tiles_pending = 1;
+
+  tile_size = champlain_map_source_get_tile_size (priv->map_source);
+  column_count = champlain_map_source_get_column_count (priv->map_source, priv->zoom_level);
+  row_count = champlain_map_source_get_row_count (priv->map_source, priv->zoom_level);
+
+  x_first = MAX (floor ((gdouble) job->origin_x / tile_size), 0);
+  y_first = MAX (floor ((gdouble) job->origin_y / tile_size), 0);
+  x_last = MIN ((job->origin_x + (gint) priv->width - 1) / tile_size, column_count - 1);
+  y_last = MIN ((job->origin_y + (gint) priv->height - 1) / tile_size, row_count - 1);
+
+  DEBUG ("Rendering %ux%u image from tiles %d-%d, %d-%d at zoom level %u",
+      priv->width, priv->height, x_first, x_last, y_first, y_last, priv->zoom_level);
+
+  for (y = y_first; y <= y_last; y++)
+    {
+      for (x = x_first; x <= x_last; x++)
+        {
+          ChamplainTile *tile;
+
+          tile = champlain_tile_new_full (x, y, tile_size, priv->zoom_level);
+          g_object_ref_sink (tile);
+
+          g_signal_connect (tile, "render-complete", G_CALLBACK (tile_rendered_cb), job);
+          g_signal_connect (tile, "notify::state", G_CALLBACK (tile_state_notify), job);
+          champlain_tile_set_state (tile, CHAMPLAIN_STATE_LOADING);
+
+          job->tiles = g_list_prepend (job->tiles, tile);
+          job->tiles_pending++;
+        }
+    }
+
+  if (job->cancellable)
+    job->cancelled_id = g_cancellable_connect (job->cancellable,
+          G_CALLBACK (render_cancelled_cb), job, NULL);
+
+  /* tiles may be removed from job->tiles while being filled */
+  tiles = g_list_copy (job->tiles);
+  g_list_foreach (tiles, (GFunc) g_object_ref, NULL);
+  for (elem = tiles; elem != NULL; elem = elem->next)
+    {
+      ChamplainTile *tile = elem->data;
+
+      if (champlain_tile_get_state (tile) != CHAMPLAIN_STATE_DONE)
+        champlain_map_source_fill_tile (job->map_source, tile);
+      g_object_unref (tile);
+    }
+  g_list_free (tiles);
+
+  if (--job->tiles_pending == 0)
+    render_job_finish (job);
+}
+
+
+/**
+ * champlain_static_map_render_finish:
+ * @map: a #ChamplainStaticMap
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finishes the rendering started with champlain_static_map_render_async().
+ * Tiles which couldn't be loaded are left transparent or contain the tile
+ * of the error source of the map source chain.
+ *
+ * Returns: (transfer full): the rendered image, free it with
+ * cairo_surface_destroy(), or %NULL if the rendering was cancelled
+ *
+ * Since: 0.14
+ */
+cairo_surface_t *
+champlain_static_map_render_finish (ChamplainStaticMap *map,
+    GAsyncResult *result,
+    GError **error)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_STATIC_MAP (map), NULL);
+  g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (map),
+          champlain_static_map_render_async), NULL);
+
+  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
+
+  if (g_simple_async_result_propagate_error (simple, error))
+    return NULL;
+
+  return cairo_surface_reference (g_simple_async_result_get_op_res_gpointer (simple));
+}
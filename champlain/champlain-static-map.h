@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors (see AUTHORS)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#if !defined (__CHAMPLAIN_CHAMPLAIN_H_INSIDE__) && !defined (CHAMPLAIN_COMPILATION)
+#error "Only <champlain/champlain.h> can be included directly."
+#endif
+
+#ifndef _CHAMPLAIN_STATIC_MAP_H_
+#define _CHAMPLAIN_STATIC_MAP_H_
+
+#include <champlain/champlain-map-source.h>
+#include <champlain/champlain-layer.h>
+#include <champlain/champlain-bounding-box.h>
+
+#include <glib-object.h>
+#include <gio/gio.h>
+#include <cairo.h>
+
+G_BEGIN_DECLS
+
+#define CHAMPLAIN_TYPE_STATIC_MAP champlain_static_map_get_type ()
+
+#define CHAMPLAIN_STATIC_MAP(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), CHAMPLAIN_TYPE_STATIC_MAP, ChamplainStaticMap))
+
+#define CHAMPLAIN_STATIC_MAP_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), CHAMPLAIN_TYPE_STATIC_MAP, ChamplainStaticMapClass))
+
+#define CHAMPLAIN_IS_STATIC_MAP(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), CHAMPLAIN_TYPE_STATIC_MAP))
+
+#define CHAMPLAIN_IS_STATIC_MAP_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), CHAMPLAIN_TYPE_STATIC_MAP))
+
+#define CHAMPLAIN_STATIC_MAP_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), CHAMPLAIN_TYPE_STATIC_MAP, ChamplainStaticMapClass))
+
+typedef struct _ChamplainStaticMapPrivate ChamplainStaticMapPrivate;
+
+typedef struct _ChamplainStaticMap ChamplainStaticMap;
+typedef struct _ChamplainStaticMapClass ChamplainStaticMapClass;
+
+/**
+ * ChamplainStaticMap:
+ *
+ * The #ChamplainStaticMap structure contains only private data
+ * and should be accessed using the provided API
+ *
+ * Since: 0.14
+ */
+struct _ChamplainStaticMap
+{
+  GObject parent_instance;
+
+  ChamplainStaticMapPrivate *priv;
+};
+
+struct _ChamplainStaticMapClass
+{
+  GObjectClass parent_class;
+};
+
+GType champlain_static_map_get_type (void);
+
+ChamplainStaticMap *champlain_static_map_new (ChamplainMapSource *map_source,
+    guint width,
+    guint height);
+
+ChamplainMapSource *champlain_static_map_get_map_source (ChamplainStaticMap *map);
+
+void champlain_static_map_set_size (ChamplainStaticMap *map,
+    guint width,
+    guint height);
+void champlain_static_map_get_size (ChamplainStaticMap *map,
+    guint *width,
+    guint *height);
+
+void champlain_static_map_center_on (ChamplainStaticMap *map,
+    gdouble latitude,
+    gdouble longitude,
+    guint zoom_level);
+void champlain_static_map_ensure_visible (ChamplainStaticMap *map,
+    ChamplainBoundingBox *bbox);
+
+gdouble champlain_static_map_get_latitude (ChamplainStaticMap *map);
+gdouble champlain_static_map_get_longitude (ChamplainStaticMap *map);
+guint champlain_static_map_get_zoom_level (ChamplainStaticMap *map);
+
+void champlain_static_map_add_layer (ChamplainStaticMap *map,
+    ChamplainLayer *layer);
+void champlain_static_map_remove_layer (ChamplainStaticMap *map,
+    ChamplainLayer *layer);
+
+void champlain_static_map_render_async (ChamplainStaticMap *map,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+cairo_surface_t *champlain_static_map_render_finish (ChamplainStaticMap *map,
+    GAsyncResult *result,
+    GError **error);
+
+G_END_DECLS
+
+#endif /* _CHAMPLAIN_STATIC_MAP_H_ */
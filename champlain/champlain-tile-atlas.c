@@ -0,0 +1,398 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors (see AUTHORS)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * SECTION:champlain-tile-atlas
+ * @short_description: Shares large textures between tiles
+ *
+ * #ChamplainTileAtlas uploads tile images into fixed-size slots of a few
+ * large textures. The actors it returns paint their slot using the material
+ * of the whole page so that Cogl can batch all the tiles of a page into
+ * a single draw call.
+ *
+ * Every slot is surrounded by a one pixel border repeating the edge pixels
+ * of the tile so that linear filtering of scaled tiles doesn't pick up
+ * the neighbouring slots.
+ */
+
+#define DEBUG_FLAG CHAMPLAIN_DEBUG_LOADING
+#include "champlain-debug.h"
+
+#include "champlain-tile-atlas.h"
+
+#include <clutter/clutter.h>
+
+/* Width and height of the atlas textures */
+#define ATLAS_PAGE_SIZE 2048
+/* Border around each slot */
+#define SLOT_BORDER 1
+
+G_DEFINE_TYPE (ChamplainTileAtlas, champlain_tile_atlas, G_TYPE_OBJECT)
+
+#define GET_PRIVATE(o) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((o), CHAMPLAIN_TYPE_TILE_ATLAS, ChamplainTileAtlasPrivate))
+
+typedef struct
+{
+  CoglHandle texture;
+  CoglHandle material;
+  /* stack of unused slot indices */
+  guint *free_slots;
+  guint n_free;
+} AtlasPage;
+
+struct _ChamplainTileAtlasPrivate
+{
+  guint tile_size;
+  guint slots_per_side;
+  GList *pages;
+};
+
+
+/* The actor displaying a single slot */
+
+#define CHAMPLAIN_TYPE_TILE_ATLAS_ACTOR champlain_tile_atlas_actor_get_type ()
+
+#define CHAMPLAIN_TILE_ATLAS_ACTOR(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), CHAMPLAIN_TYPE_TILE_ATLAS_ACTOR, ChamplainTileAtlasActor))
+
+typedef struct _ChamplainTileAtlasActor ChamplainTileAtlasActor;
+typedef struct _ChamplainTileAtlasActorClass ChamplainTileAtlasActorClass;
+
+struct _ChamplainTileAtlasActor
+{
+  ClutterActor parent;
+
+  ChamplainTileAtlas *atlas;
+  AtlasPage *page;
+  guint slot;
+  /* texture coordinates of the slot */
+  gfloat tx1, ty1, tx2, ty2;
+};
+
+struct _ChamplainTileAtlasActorClass
+{
+  ClutterActorClass parent_class;
+};
+
+G_DEFINE_TYPE (ChamplainTileAtlasActor, champlain_tile_atlas_actor, CLUTTER_TYPE_ACTOR)
+
+static void release_slot (ChamplainTileAtlas *atlas,
+    AtlasPage *page,
+    guint slot);
+
+
+static void
+atlas_actor_paint (ClutterActor *actor)
+{
+  ChamplainTileAtlasActor *self = CHAMPLAIN_TILE_ATLAS_ACTOR (actor);
+  ClutterActorBox box;
+  guint8 opacity;
+
+  clutter_actor_get_allocation_box (actor, &box);
+  opacity = clutter_actor_get_paint_opacity (actor);
+
+  /* The journal stores the color in the vertices so changing it doesn't
+     break the batching of the page */
+  cogl_material_set_color4ub (self->page->material, opacity, opacity, opacity, opacity);
+  cogl_set_source (self->page->material);
+  cogl_rectangle_with_texture_coords (0, 0,
+      box.x2 - box.x1, box.y2 - box.y1,
+      self->tx1, self->ty1, self->tx2, self->ty2);
+}
+
+
+static void
+atlas_actor_get_preferred_width (ClutterActor *actor,
+    G_GNUC_UNUSED gfloat for_height,
+    gfloat *min_width_p,
+    gfloat *natural_width_p)
+{
+  ChamplainTileAtlasActor *self = CHAMPLAIN_TILE_ATLAS_ACTOR (actor);
+  gfloat size = self->atlas ? self->atlas->priv->tile_size : 0;
+
+  if (min_width_p)
+    *min_width_p = 0;
+
+  if (natural_width_p)
+    *natural_width_p = size;
+}
+
+
+static void
+atlas_actor_get_preferred_height (ClutterActor *actor,
+    G_GNUC_UNUSED gfloat for_width,
+    gfloat *min_height_p,
+    gfloat *natural_height_p)
+{
+  ChamplainTileAtlasActor *self = CHAMPLAIN_TILE_ATLAS_ACTOR (actor);
+  gfloat size = self->atlas ? self->atlas->priv->tile_size : 0;
+
+  if (min_height_p)
+    *min_height_p = 0;
+
+  if (natural_height_p)
+    *natural_height_p = size;
+}
+
+
+static void
+atlas_actor_dispose (GObject *object)
+{
+  ChamplainTileAtlasActor *self = CHAMPLAIN_TILE_ATLAS_ACTOR (object);
+
+  if (self->atlas)
+    {
+      release_slot (self->atlas, self->page, self->slot);
+      g_object_unref (self->atlas);
+      self->atlas = NULL;
+      self->page = NULL;
+    }
+
+  G_OBJECT_CLASS (champlain_tile_atlas_actor_parent_class)->dispose (object);
+}
+
+
+static void
+champlain_tile_atlas_actor_class_init (ChamplainTileAtlasActorClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  ClutterActorClass *actor_class = CLUTTER_ACTOR_CLASS (klass);
+
+  object_class->dispose = atlas_actor_dispose;
+
+  actor_class->paint = atlas_actor_paint;
+  actor_class->get_preferred_width = atlas_actor_get_preferred_width;
+  actor_class->get_preferred_height = atlas_actor_get_preferred_height;
+}
+
+
+static void
+champlain_tile_atlas_actor_init (ChamplainTileAtlasActor *self)
+{
+  self->atlas = NULL;
+  self->page = NULL;
+  self->slot = 0;
+}
+
+
+static void
+free_page (AtlasPage *page)
+{
+  cogl_handle_unref (page->material);
+  cogl_handle_unref (page->texture);
+  g_free (page->free_slots);
+  g_slice_free (AtlasPage, page);
+}
+
+
+static void
+champlain_tile_atlas_finalize (GObject *object)
+{
+  ChamplainTileAtlasPrivate *priv = CHAMPLAIN_TILE_ATLAS (object)->priv;
+
+  /* all the actors are gone at this point as they hold a reference */
+  g_list_foreach (priv->pages, (GFunc) free_page, NULL);
+  g_list_free (priv->pages);
+
+  G_OBJECT_CLASS (champlain_tile_atlas_parent_class)->finalize (object);
+}
+
+
+static void
+champlain_tile_atlas_class_init (ChamplainTileAtlasClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  g_type_class_add_private (klass, sizeof (ChamplainTileAtlasPrivate));
+
+  object_class->finalize = champlain_tile_atlas_finalize;
+}
+
+
+static void
+champlain_tile_atlas_init (ChamplainTileAtlas *atlas)
+{
+  ChamplainTileAtlasPrivate *priv = GET_PRIVATE (atlas);
+
+  atlas->priv = priv;
+
+  priv->tile_size = 0;
+  priv->slots_per_side = 0;
+  priv->pages = NULL;
+}
+
+
+/*
+ * champlain_tile_atlas_new:
+ * @tile_size: width and height of the tiles stored in the atlas
+ *
+ * Creates an atlas for square tiles of the given size.
+ *
+ * Returns: a new #ChamplainTileAtlas
+ */
+ChamplainTileAtlas *
+champlain_tile_atlas_new (guint tile_size)
+{
+  ChamplainTileAtlas *atlas = g_object_new (CHAMPLAIN_TYPE_TILE_ATLAS, NULL);
+
+  atlas->priv->tile_size = tile_size;
+  atlas->priv->slots_per_side = ATLAS_PAGE_SIZE / (tile_size + 2 * SLOT_BORDER);
+
+  return atlas;
+}
+
+
+guint
+champlain_tile_atlas_get_tile_size (ChamplainTileAtlas *atlas)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_TILE_ATLAS (atlas), 0);
+
+  return atlas->priv->tile_size;
+}
+
+
+static AtlasPage *
+new_page (ChamplainTileAtlas *atlas)
+{
+  ChamplainTileAtlasPrivate *priv = atlas->priv;
+  guint n_slots = priv->slots_per_side * priv->slots_per_side;
+  CoglHandle texture;
+  AtlasPage *page;
+  guint i;
+
+  texture = cogl_texture_new_with_size (ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE,
+        COGL_TEXTURE_NO_AUTO_MIPMAP | COGL_TEXTURE_NO_ATLAS,
+        COGL_PIXEL_FORMAT_RGBA_8888_PRE);
+  if (texture == COGL_INVALID_HANDLE)
+    return NULL;
+
+  DEBUG ("New atlas page for %u tiles", n_slots);
+
+  page = g_slice_new (AtlasPage);
+  page->texture = texture;
+  page->material = cogl_material_new ();
+  cogl_material_set_layer (page->material, 0, texture);
+
+  /* pop the slots from the beginning of the page */
+  page->free_slots = g_new (guint, n_slots);
+  for (i = 0; i < n_slots; i++)
+    page->free_slots[i] = n_slots - i - 1;
+  page->n_free = n_slots;
+
+  priv->pages = g_list_prepend (priv->pages, page);
+
+  return page;
+}
+
+
+static void
+release_slot (ChamplainTileAtlas *atlas,
+    AtlasPage *page,
+    guint slot)
+{
+  ChamplainTileAtlasPrivate *priv = atlas->priv;
+
+  page->free_slots[page->n_free++] = slot;
+
+  /* give the texture memory back once the page is empty */
+  if (page->n_free == priv->slots_per_side * priv->slots_per_side)
+    {
+      priv->pages = g_list_remove (priv->pages, page);
+      free_page (page);
+    }
+}
+
+
+/*
+ * champlain_tile_atlas_add_tile:
+ * @atlas: a #ChamplainTileAtlas
+ * @pixels: 8 bits per channel RGB or RGBA pixels of a tile of the atlas size
+ * @has_alpha: whether @pixels contain an alpha channel
+ * @rowstride: distance in bytes between row starts
+ *
+ * Uploads the tile into a free slot of the atlas.
+ *
+ * Returns: a floating actor displaying the tile or NULL if the tile
+ * couldn't be stored in the atlas
+ */
+ClutterActor *
+champlain_tile_atlas_add_tile (ChamplainTileAtlas *atlas,
+    const guchar *pixels,
+    gboolean has_alpha,
+    gint rowstride)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_TILE_ATLAS (atlas), NULL);
+
+  ChamplainTileAtlasPrivate *priv = atlas->priv;
+  ChamplainTileAtlasActor *actor;
+  CoglPixelFormat format;
+  AtlasPage *page = NULL;
+  GList *iter;
+  gint size = priv->tile_size;
+  gint stride = size + 2 * SLOT_BORDER;
+  gint x, y;
+  guint slot;
+
+  if (priv->slots_per_side == 0)
+    return NULL;
+
+  for (iter = priv->pages; iter != NULL; iter = iter->next)
+    {
+      if (((AtlasPage *) iter->data)->n_free > 0)
+        {
+          page = iter->data;
+          break;
+        }
+    }
+
+  if (!page)
+    page = new_page (atlas);
+  if (!page)
+    return NULL;
+
+  slot = page->free_slots[--page->n_free];
+  x = (slot % priv->slots_per_side) * stride + SLOT_BORDER;
+  y = (slot / priv->slots_per_side) * stride + SLOT_BORDER;
+
+  format = has_alpha ? COGL_PIXEL_FORMAT_RGBA_8888 : COGL_PIXEL_FORMAT_RGB_888;
+
+  /* the tile and the borders; the corners of the border are never sampled
+     for tiles drawn axis-aligned */
+  cogl_texture_set_region (page->texture, 0, 0, x, y, size, size,
+      size, size, format, rowstride, pixels);
+  cogl_texture_set_region (page->texture, 0, 0, x, y - 1, size, 1,
+      size, size, format, rowstride, pixels);
+  cogl_texture_set_region (page->texture, 0, size - 1, x, y + size, size, 1,
+      size, size, format, rowstride, pixels);
+  cogl_texture_set_region (page->texture, 0, 0, x - 1, y, 1, size,
+      size, size, format, rowstride, pixels);
+  cogl_texture_set_region (page->texture, size - 1, 0, x + size, y, 1, size,
+      size, size, format, rowstride, pixels);
+
+  actor = g_object_new (CHAMPLAIN_TYPE_TILE_ATLAS_ACTOR, NULL);
+  actor->atlas = g_object_ref (atlas);
+  actor->page = page;
+  actor->slot = slot;
+  actor->tx1 = (gfloat) x / ATLAS_PAGE_SIZE;
+  actor->ty1 = (gfloat) y / ATLAS_PAGE_SIZE;
+  actor->tx2 = (gfloat) (x + size) / ATLAS_PAGE_SIZE;
+  actor->ty2 = (gfloat) (y + size) / ATLAS_PAGE_SIZE;
+
+  return CLUTTER_ACTOR (actor);
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors (see AUTHORS)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __CHAMPLAIN_TILE_ATLAS_H__
+#define __CHAMPLAIN_TILE_ATLAS_H__
+
+#include <glib-object.h>
+#include <clutter/clutter.h>
+
+G_BEGIN_DECLS
+
+#define CHAMPLAIN_TYPE_TILE_ATLAS champlain_tile_atlas_get_type ()
+
+#define CHAMPLAIN_TILE_ATLAS(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), CHAMPLAIN_TYPE_TILE_ATLAS, ChamplainTileAtlas))
+
+#define CHAMPLAIN_TILE_ATLAS_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), CHAMPLAIN_TYPE_TILE_ATLAS, ChamplainTileAtlasClass))
+
+#define CHAMPLAIN_IS_TILE_ATLAS(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), CHAMPLAIN_TYPE_TILE_ATLAS))
+
+#define CHAMPLAIN_IS_TILE_ATLAS_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), CHAMPLAIN_TYPE_TILE_ATLAS))
+
+#define CHAMPLAIN_TILE_ATLAS_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), CHAMPLAIN_TYPE_TILE_ATLAS, ChamplainTileAtlasClass))
+
+typedef struct _ChamplainTileAtlasPrivate ChamplainTileAtlasPrivate;
+
+typedef struct _ChamplainTileAtlas ChamplainTileAtlas;
+typedef struct _ChamplainTileAtlasClass ChamplainTileAtlasClass;
+
+struct _ChamplainTileAtlas
+{
+  GObject parent;
+
+  ChamplainTileAtlasPrivate *priv;
+};
+
+struct _ChamplainTileAtlasClass
+{
+  GObjectClass parent_class;
+};
+
+GType champlain_tile_atlas_get_type (void);
+
+ChamplainTileAtlas *champlain_tile_atlas_new (guint tile_size);
+
+guint champlain_tile_atlas_get_tile_size (ChamplainTileAtlas *atlas);
+
+ClutterActor *champlain_tile_atlas_add_tile (ChamplainTileAtlas *atlas,
+    const guchar *pixels,
+    gboolean has_alpha,
+    gint rowstride);
+
+G_END_DECLS
+
+#endif /* __CHAMPLAIN_TILE_ATLAS_H__ */
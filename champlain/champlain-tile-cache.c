@@ -26,12 +26,19 @@
  */
 
 #include "champlain-tile-cache.h"
+#include "champlain-private.h"
 
 G_DEFINE_ABSTRACT_TYPE (ChamplainTileCache, champlain_tile_cache, CHAMPLAIN_TYPE_MAP_SOURCE)
 
 #define GET_PRIVATE(obj) \
   (G_TYPE_INSTANCE_GET_PRIVATE ((obj), CHAMPLAIN_TYPE_TILE_CACHE, ChamplainTileCachePrivate))
 
+struct _ChamplainTileCachePrivate
+{
+  /* interned id of the next source, used in tile keys */
+  const gchar *source_id;
+};
+
 
 static const gchar *get_id (ChamplainMapSource * map_source);
 static const gchar *get_name (ChamplainMapSource *map_source);
@@ -71,6 +78,8 @@ champlain_tile_cache_class_init (ChamplainTileCacheClass *klass)
   ChamplainMapSourceClass *map_source_class = CHAMPLAIN_MAP_SOURCE_CLASS (klass);
   ChamplainTileCacheClass *tile_cache_class = CHAMPLAIN_TILE_CACHE_CLASS (klass);
 
+  g_type_class_add_private (klass, sizeof (ChamplainTileCachePrivate));
+
   object_class->finalize = champlain_tile_cache_finalize;
   object_class->dispose = champlain_tile_cache_dispose;
   object_class->constructed = champlain_tile_cache_constructed;
@@ -95,6 +104,11 @@ champlain_tile_cache_class_init (ChamplainTileCacheClass *klass)
 static void
 champlain_tile_cache_init (ChamplainTileCache *tile_cache)
 {
+  ChamplainTileCachePrivate *priv = GET_PRIVATE (tile_cache);
+
+  tile_cache->priv = priv;
+
+  priv->source_id = NULL;
 }
 
 
@@ -165,6 +179,85 @@ champlain_tile_cache_on_tile_filled (ChamplainTileCache *tile_cache,
 }
 
 
+static GQuark
+store_missing_tile_quark (void)
+{
+  static GQuark quark = 0;
+
+  if (!quark)
+    quark = g_quark_from_static_string ("champlain-store-missing-tile");
+
+  return quark;
+}
+
+
+void
+champlain_tile_cache_class_set_store_missing_tile (ChamplainTileCacheClass *klass,
+    ChamplainStoreMissingTileFunc func)
+{
+  g_type_set_qdata (G_TYPE_FROM_CLASS (klass), store_missing_tile_quark (), func);
+}
+
+
+/**
+ * champlain_tile_cache_store_missing_tile:
+ * @tile_cache: a #ChamplainTileCache
+ * @tile: a #ChamplainTile
+ *
+ * Remembers that the tile source has no data for the tile until the expire
+ * time of the tile. Until then, filling the tile from the cache skips the
+ * tile source and fills it from the source following the tile source in the
+ * chain, usually the error tile source. Like
+ * champlain_tile_cache_on_tile_filled(), the call should be chained to the
+ * next source when it is a tile cache. Caches not implementing negative
+ * caching ignore the call.
+ *
+ * Since: 0.14
+ */
+void
+champlain_tile_cache_store_missing_tile (ChamplainTileCache *tile_cache,
+    ChamplainTile *tile)
+{
+  g_return_if_fail (CHAMPLAIN_IS_TILE_CACHE (tile_cache));
+
+  GType type;
+
+  /* The implementation of the closest class providing one */
+  for (type = G_OBJECT_TYPE (tile_cache); type != G_TYPE_INVALID; type = g_type_parent (type))
+    {
+      ChamplainStoreMissingTileFunc func = g_type_get_qdata (type, store_missing_tile_quark ());
+
+      if (func)
+        {
+          func (tile_cache, tile);
+          return;
+        }
+    }
+}
+
+
+void
+champlain_tile_cache_fill_missing_tile (ChamplainTileCache *tile_cache,
+    ChamplainTile *tile)
+{
+  ChamplainMapSource *source = CHAMPLAIN_MAP_SOURCE (tile_cache);
+
+  /* Skip the remaining caches and the tile source which has no data for
+   * the tile */
+  do
+    source = champlain_map_source_get_next_source (source);
+  while (CHAMPLAIN_IS_TILE_CACHE (source));
+
+  if (source)
+    source = champlain_map_source_get_next_source (source);
+
+  if (source)
+    champlain_map_source_fill_tile (source, tile);
+  else
+    champlain_tile_set_state (tile, CHAMPLAIN_STATE_DONE);
+}
+
+
 static const gchar *
 get_id (ChamplainMapSource *map_source)
 {
@@ -267,3 +360,57 @@ get_projection (ChamplainMapSource *map_source)
 
   return champlain_map_source_get_projection (next_source);
 }
+
+
+const gchar *
+champlain_tile_cache_get_source_id (ChamplainTileCache *tile_cache)
+{
+  ChamplainTileCachePrivate *priv = tile_cache->priv;
+  const gchar *id = champlain_map_source_get_id (CHAMPLAIN_MAP_SOURCE (tile_cache));
+
+  /* Comparing the short id is cheaper than g_intern_string(), which hashes
+   * it under a global lock; intern again only when the next source or its
+   * id has changed */
+  if (G_UNLIKELY (g_strcmp0 (id, priv->source_id) != 0))
+    priv->source_id = g_intern_string (id);
+
+  return priv->source_id;
+}
+
+
+void
+champlain_tile_key_init (ChamplainTileKey *key,
+    const gchar *source_id,
+    guint zoom_level,
+    guint x,
+    guint y)
+{
+  /* x and y are smaller than 2^zoom_level so 29 bits suffice for them up
+   * to zoom level 29, far beyond what any map source provides */
+  key->zxy = ((guint64) zoom_level << 58) |
+    ((guint64) (x & 0x1fffffff) << 29) |
+    (guint64) (y & 0x1fffffff);
+  key->source_id = source_id;
+}
+
+
+guint
+champlain_tile_key_hash (gconstpointer key)
+{
+  const ChamplainTileKey *tile_key = key;
+
+  return (guint) (tile_key->zxy ^ (tile_key->zxy >> 32)) ^
+    g_direct_hash (tile_key->source_id);
+}
+
+
+gboolean
+champlain_tile_key_equal (gconstpointer a,
+    gconstpointer b)
+{
+  const ChamplainTileKey *key_a = a;
+  const ChamplainTileKey *key_b = b;
+
+  /* Interned strings can be compared by their address */
+  return key_a->zxy == key_b->zxy && key_a->source_id == key_b->source_id;
+}
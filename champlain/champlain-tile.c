@@ -78,6 +78,7 @@ struct _ChamplainTilePrivate
   gboolean fade_in;
 
   GTimeVal *modified_time; /* The last modified time of the cache */
+  GTimeVal *expire_time; /* When the server says the tile gets stale */
   gchar *etag; /* The HTTP ETag sent by the server */
   gboolean content_displayed;
 };
@@ -298,6 +299,7 @@ champlain_tile_finalize (GObject *object)
   ChamplainTilePrivate *priv = CHAMPLAIN_TILE (object)->priv;
 
   g_free (priv->modified_time);
+  g_free (priv->expire_time);
   g_free (priv->etag);
 
   G_OBJECT_CLASS (champlain_tile_parent_class)->finalize (object);
@@ -496,6 +498,7 @@ champlain_tile_init (ChamplainTile *self)
   priv->zoom_level = 0;
   priv->size = 0;
   priv->modified_time = NULL;
+  priv->expire_time = NULL;
   priv->etag = NULL;
   priv->fade_in = FALSE;
   priv->content_displayed = FALSE;
@@ -797,6 +800,49 @@ champlain_tile_set_modified_time (ChamplainTile *self,
 }
 
 
+/**
+ * champlain_tile_get_expire_time:
+ * @self: the #ChamplainTile
+ *
+ * Gets the time when the tile should be validated again.
+ *
+ * Returns: the tile's expiration time or NULL when unknown
+ *
+ * Since: 0.14
+ */
+G_CONST_RETURN GTimeVal *
+champlain_tile_get_expire_time (ChamplainTile *self)
+{
+  g_return_val_if_fail (CHAMPLAIN_TILE (self), NULL);
+
+  return self->priv->expire_time;
+}
+
+
+/**
+ * champlain_tile_set_expire_time:
+ * @self: the #ChamplainTile
+ * @time: a #GTimeVal, the value will be copied
+ *
+ * Sets the time when the tile should be validated again, usually computed
+ * from the Cache-Control and Expires headers sent by the server.
+ *
+ * Since: 0.14
+ */
+void
+champlain_tile_set_expire_time (ChamplainTile *self,
+    const GTimeVal *time_)
+{
+  g_return_if_fail (CHAMPLAIN_TILE (self));
+  g_return_if_fail (time_ != NULL);
+
+  ChamplainTilePrivate *priv = self->priv;
+
+  g_free (priv->expire_time);
+  priv->expire_time = g_memdup (time_, sizeof (GTimeVal));
+}
+
+
 /**
  * champlain_tile_get_etag:
  * @self: the #ChamplainTile
@@ -929,6 +975,39 @@ champlain_tile_display_content (ChamplainTile *self)
 }
 
 
+/* Used by ChamplainView to reuse tiles instead of creating new ones. The
+ * caller must make sure no map source works on the tile anymore. */
+void
+champlain_tile_reset (ChamplainTile *self)
+{
+  g_return_if_fail (CHAMPLAIN_TILE (self));
+
+  ChamplainTilePrivate *priv = self->priv;
+  ClutterActor *child;
+
+  if (!priv->content_displayed && priv->content_actor)
+    clutter_actor_destroy (priv->content_actor);
+  priv->content_actor = NULL;
+  priv->content_displayed = FALSE;
+
+  if (priv->content_group)
+    {
+      while ((child = clutter_group_get_nth_child (priv->content_group, 0)) != NULL)
+        clutter_actor_destroy (child);
+    }
+
+  g_free (priv->modified_time);
+  priv->modified_time = NULL;
+  g_free (priv->expire_time);
+  priv->expire_time = NULL;
+  g_free (priv->etag);
+  priv->etag = NULL;
+
+  priv->fade_in = FALSE;
+  champlain_tile_set_state (self, CHAMPLAIN_STATE_NONE);
+}
+
+
 /**
  * champlain_tile_get_content:
  * @self: the #ChamplainTile
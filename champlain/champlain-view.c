@@ -101,9 +101,19 @@ enum
   PROP_ZOOM_ON_DOUBLE_CLICK,
   PROP_ANIMATE_ZOOM,
   PROP_STATE,
+  PROP_KINETIC_PREFETCH,
+  PROP_GOTO_PREFETCH,
+  PROP_PREFETCH_RING,
 };
 
 #define PADDING 10
+/* Maximum number of tile requests handed to the map source by one run of
+ * the idle dispatcher. It runs at redraw priority, so while the stage is busy
+ * redrawing this is roughly the number of requests per frame; an idle main
+ * loop may run it several times between two frames. */
+#define MAX_TILE_REQUESTS_PER_DISPATCH 16
+/* Maximum zoom level difference of an ancestor used as a placeholder */
+#define MAX_PLACEHOLDER_ZOOM_DIFF 4
 static guint signals[LAST_SIGNAL] = { 0, };
 
 #define GET_PRIVATE(obj) \
@@ -115,6 +125,16 @@ static guint signals[LAST_SIGNAL] = { 0, };
    level < champlain_map_source_get_min_zoom_level (priv->map_source) || \
            level > champlain_map_source_get_max_zoom_level (priv->map_source))
 
+/* Range of tiles, x_end and y_end excluded */
+typedef struct
+{
+  gint x_first;
+  gint y_first;
+  gint x_end;
+  gint y_end;
+} TileRange;
+
+
 /* Between state values for go_to */
 typedef struct
 {
@@ -125,14 +145,27 @@ typedef struct
   gdouble to_longitude;
   gdouble from_latitude;
   gdouble from_longitude;
+  TileRange prefetch_range; /* tiles around the destination */
 } GoToContext;
 
 
+/* A pending request to fill a tile, owned by the view's tile scheduler */
 typedef struct
 {
   ChamplainTile *tile;
   ChamplainMapSource *map_source;
-} FillTileCallbackData;
+  gdouble distance; /* from the viewport center, updated before dispatch */
+  gboolean prefetch; /* the tile isn't displayed (yet), updated before dispatch */
+} TileRequest;
+
+
+/* Position of a tile in the tile index */
+typedef struct
+{
+  gint x;
+  gint y;
+  guint zoom_level;
+} TileKey;
 
 struct _ChamplainViewPrivate
 {
@@ -181,8 +214,35 @@ struct _ChamplainViewPrivate
   GoToContext *goto_context;
 
   gint tiles_loading;
+
+  /* Tile requests waiting to be dispatched to the map source */
+  GPtrArray *tile_requests;
+  guint tile_requests_source_id;
+
+  /* Tiles of the map_layer indexed by TileKey; they cover tile_index_range
+     at tile_index_zoom_level and are positioned for tile_index_anchor_x/y */
+  GHashTable *tile_index;
+  TileRange tile_index_range;
+  guint tile_index_zoom_level;
+  gint tile_index_anchor_x;
+  gint tile_index_anchor_y;
+
+  /* Unloaded tiles kept for reuse by load_tile(), at most as many as fit
+     in the viewport */
+  GPtrArray *tile_pool;
+
+  /* Tiles requested ahead of time, not part of the map_layer until they
+     become visible, indexed by TileKey */
+  gboolean kinetic_prefetch;
+  gboolean goto_prefetch;
+  guint prefetch_ring;
+  GHashTable *prefetch_index;
+  TileRange kinetic_prefetch_range;
   
   ClutterActor *zoom_overlay_actor;
+  /* Tiles held by the zoom actor indexed by TileKey, used to build the
+     placeholders of the tiles being loaded */
+  GHashTable *zoom_actor_tiles;
   ClutterAnimation *zoom_animation;
   guint anim_start_zoom_level;
   gdouble zoom_actor_longitude;
@@ -234,7 +294,27 @@ static void champlain_view_go_to_with_duration (ChamplainView *view,
     gdouble latitude,
     gdouble longitude,
     guint duration);
-static gboolean fill_tile_cb (FillTileCallbackData *data);
+static void queue_tile_request (ChamplainView *view,
+    ChamplainTile *tile);
+static void clear_tile_requests (ChamplainView *view);
+static void clear_tile_index (ChamplainView *view);
+static guint tile_key_hash (gconstpointer key);
+static gboolean tile_key_equal (gconstpointer a,
+    gconstpointer b);
+static void tile_key_free (gpointer key);
+static void cancel_prefetch (ChamplainView *view);
+static void cancel_prefetch_in_range (ChamplainView *view,
+    const TileRange *range,
+    gboolean inside);
+static void compute_tile_range (ChamplainView *view,
+    gdouble x_coord,
+    gdouble y_coord,
+    gint margin,
+    TileRange *range);
+static void prefetch_tile_range (ChamplainView *view,
+    const TileRange *range);
+static void view_prefetch_kinetic_target (ChamplainView *view);
+static void view_tile_loading_started (ChamplainView *view);
 
 
 /* Updates the internals after the viewport changed */
@@ -449,6 +529,18 @@ champlain_view_get_property (GObject *object,
       g_value_set_enum (value, priv->state);
       break;
 
+    case PROP_KINETIC_PREFETCH:
+      g_value_set_boolean (value, priv->kinetic_prefetch);
+      break;
+
+    case PROP_GOTO_PREFETCH:
+      g_value_set_boolean (value, priv->goto_prefetch);
+      break;
+
+    case PROP_PREFETCH_RING:
+      g_value_set_uint (value, priv->prefetch_ring);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -513,6 +605,18 @@ champlain_view_set_property (GObject *object,
     case PROP_ANIMATE_ZOOM:
       champlain_view_set_animate_zoom (view, g_value_get_boolean (value));
       break;
+
+    case PROP_KINETIC_PREFETCH:
+      champlain_view_set_kinetic_prefetch (view, g_value_get_boolean (value));
+      break;
+
+    case PROP_GOTO_PREFETCH:
+      champlain_view_set_goto_prefetch (view, g_value_get_boolean (value));
+      break;
+
+    case PROP_PREFETCH_RING:
+      champlain_view_set_prefetch_ring (view, g_value_get_uint (value));
+      break;
       
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -531,6 +635,39 @@ champlain_view_dispose (GObject *object)
   if (priv->goto_context != NULL)
     champlain_view_stop_go_to (view);
 
+  if (priv->tile_requests != NULL)
+    {
+      clear_tile_requests (view);
+      g_ptr_array_free (priv->tile_requests, TRUE);
+      priv->tile_requests = NULL;
+    }
+
+  if (priv->tile_index != NULL)
+    {
+      g_hash_table_destroy (priv->tile_index);
+      priv->tile_index = NULL;
+    }
+
+  if (priv->tile_pool != NULL)
+    {
+      g_ptr_array_foreach (priv->tile_pool, (GFunc) g_object_unref, NULL);
+      g_ptr_array_free (priv->tile_pool, TRUE);
+      priv->tile_pool = NULL;
+    }
+
+  if (priv->zoom_actor_tiles != NULL)
+    {
+      g_hash_table_destroy (priv->zoom_actor_tiles);
+      priv->zoom_actor_tiles = NULL;
+    }
+
+  if (priv->prefetch_index != NULL)
+    {
+      cancel_prefetch (view);
+      g_hash_table_destroy (priv->prefetch_index);
+      priv->prefetch_index = NULL;
+    }
+
   if (priv->update_viewport_timer != NULL)
     {
       g_timer_destroy (priv->update_viewport_timer);
@@ -976,6 +1113,58 @@ champlain_view_class_init (ChamplainViewClass *champlainViewClass)
           CHAMPLAIN_STATE_NONE,
           G_PARAM_READABLE));
 
+  /**
+   * ChamplainView:kinetic-prefetch:
+   *
+   * In kinetic mode, start loading the tiles around the position where the
+   * deceleration will come to rest as soon as the view starts decelerating.
+   *
+   * Since: 0.14
+   */
+  g_object_class_install_property (object_class,
+      PROP_KINETIC_PREFETCH,
+      g_param_spec_boolean ("kinetic-prefetch",
+          "Kinetic prefetch",
+          "Prefetch the tiles where the kinetic deceleration ends",
+          FALSE,
+          CHAMPLAIN_PARAM_READWRITE));
+
+  /**
+   * ChamplainView:goto-prefetch:
+   *
+   * Start loading the tiles around the destination of champlain_view_go_to()
+   * as soon as the animation starts. They are requested after the tiles
+   * displayed during the animation, the closest to the destination first.
+   *
+   * Since: 0.14
+   */
+  g_object_class_install_property (object_class,
+      PROP_GOTO_PREFETCH,
+      g_param_spec_boolean ("goto-prefetch",
+          "Go to prefetch",
+          "Prefetch the tiles where a go to animation ends",
+          TRUE,
+          CHAMPLAIN_PARAM_READWRITE));
+
+  /**
+   * ChamplainView:prefetch-ring:
+   *
+   * The number of tiles prefetched in each direction around the predicted
+   * viewport, i.e. where a kinetic deceleration comes to rest or where a
+   * champlain_view_go_to() animation ends.
+   *
+   * Since: 0.14
+   */
+  g_object_class_install_property (object_class,
+      PROP_PREFETCH_RING,
+      g_param_spec_uint ("prefetch-ring",
+          "Prefetch ring",
+          "Number of tiles prefetched around the predicted viewport",
+          0,
+          8,
+          1,
+          CHAMPLAIN_PARAM_READWRITE));
+
   /**
    * ChamplainView::animation-completed:
    *
@@ -1056,6 +1245,23 @@ champlain_view_init (ChamplainView *view)
   priv->longitude = 0.0f;
   priv->goto_context = NULL;
   priv->tiles_loading = 0;
+  priv->tile_requests = g_ptr_array_new ();
+  priv->tile_requests_source_id = 0;
+  priv->tile_index = g_hash_table_new_full (tile_key_hash, tile_key_equal,
+        tile_key_free, g_object_unref);
+  clear_tile_index (view);
+  priv->tile_pool = g_ptr_array_new ();
+  priv->kinetic_prefetch = FALSE;
+  priv->goto_prefetch = TRUE;
+  priv->prefetch_ring = 1;
+  priv->prefetch_index = g_hash_table_new_full (tile_key_hash, tile_key_equal,
+        tile_key_free, g_object_unref);
+  priv->kinetic_prefetch_range.x_first = 0;
+  priv->kinetic_prefetch_range.y_first = 0;
+  priv->kinetic_prefetch_range.x_end = 0;
+  priv->kinetic_prefetch_range.y_end = 0;
+  priv->zoom_actor_tiles = g_hash_table_new_full (tile_key_hash, tile_key_equal,
+        tile_key_free, g_object_unref);
   priv->update_viewport_timer = g_timer_new ();
   priv->zoom_animation = NULL;
 
@@ -1153,6 +1359,9 @@ viewport_pos_changed_cb (G_GNUC_UNUSED GObject *gobject,
 
   champlain_viewport_get_origin (CHAMPLAIN_VIEWPORT (priv->viewport), &x, &y);
 
+  if (priv->kinetic_prefetch && priv->kinetic_mode)
+    view_prefetch_kinetic_target (view);
+
   if (fabs (x - priv->viewport_x) > 100 ||
       fabs (y - priv->viewport_y) > 100 ||
       g_timer_elapsed (priv->update_viewport_timer, NULL) > 0.25)
@@ -1450,13 +1659,39 @@ timeline_new_frame (G_GNUC_UNUSED ClutterTimeline *timeline,
 }
 
 
+static void
+view_stop_go_to (ChamplainView *view,
+    gboolean cancel_destination)
+{
+  ChamplainViewPrivate *priv = view->priv;
+
+  if (priv->goto_context == NULL)
+    return;
+
+  clutter_timeline_stop (priv->goto_context->timeline);
+
+  /* The destination tiles which didn't make it to the screen are useless
+     when the animation doesn't get there */
+  if (cancel_destination)
+    cancel_prefetch_in_range (view, &priv->goto_context->prefetch_range, TRUE);
+
+  g_object_unref (priv->goto_context->timeline);
+  g_object_unref (priv->goto_context->alpha);
+
+  g_signal_emit_by_name (view, "animation-completed::go-to", NULL);
+
+  g_slice_free (GoToContext, priv->goto_context);
+  priv->goto_context = NULL;
+}
+
+
 static void
 timeline_completed (G_GNUC_UNUSED ClutterTimeline *timeline,
     ChamplainView *view)
 {
   DEBUG_LOG ()
 
-  champlain_view_stop_go_to (view);
+  view_stop_go_to (view, FALSE);
 }
 
 
@@ -1476,20 +1711,7 @@ champlain_view_stop_go_to (ChamplainView *view)
 
   g_return_if_fail (CHAMPLAIN_IS_VIEW (view));
 
-  ChamplainViewPrivate *priv = view->priv;
-
-  if (priv->goto_context == NULL)
-    return;
-
-  clutter_timeline_stop (priv->goto_context->timeline);
-
-  g_object_unref (priv->goto_context->timeline);
-  g_object_unref (priv->goto_context->alpha);
-
-  g_signal_emit_by_name (view, "animation-completed::go-to", NULL);
-
-  g_slice_free (GoToContext, priv->goto_context);
-  priv->goto_context = NULL;
+  view_stop_go_to (view, TRUE);
 }
 
 
@@ -1500,7 +1722,8 @@ champlain_view_stop_go_to (ChamplainView *view)
  * @longitude: the longitude to center the map at
  *
  * Move from the current position to these coordinates. All tiles in the
- * intermediate view WILL be loaded!
+ * intermediate view WILL be loaded! The tiles at the destination start
+ * loading in the background when the animation starts.
  *
  * Since: 0.4
  */
@@ -1549,6 +1772,23 @@ champlain_view_go_to_with_duration (ChamplainView *view,
 
   ctx->view = view;
 
+  ctx->prefetch_range.x_first = 0;
+  ctx->prefetch_range.y_first = 0;
+  ctx->prefetch_range.x_end = 0;
+  ctx->prefetch_range.y_end = 0;
+
+  /* Start loading the tiles around the destination right away, they are
+     requested after the tiles displayed during the animation */
+  if (priv->goto_prefetch)
+    {
+      compute_tile_range (view,
+          champlain_map_source_get_x (priv->map_source, priv->zoom_level, ctx->to_longitude) - priv->viewport_width / 2.0,
+          champlain_map_source_get_y (priv->map_source, priv->zoom_level, ctx->to_latitude) - priv->viewport_height / 2.0,
+          priv->prefetch_ring,
+          &ctx->prefetch_range);
+      prefetch_tile_range (view, &ctx->prefetch_range);
+    }
+
   /* We keep a reference for stop */
   priv->goto_context = ctx;
 
@@ -1889,26 +2129,80 @@ champlain_view_get_viewport_origin (ChamplainView *view,
 }
 
 
+static guint
+tile_key_hash (gconstpointer key)
+{
+  const TileKey *tile_key = key;
+
+  return (guint) tile_key->x * 73856093u ^
+         (guint) tile_key->y * 19349663u ^
+         tile_key->zoom_level * 83492791u;
+}
+
+
+static gboolean
+tile_key_equal (gconstpointer a,
+    gconstpointer b)
+{
+  const TileKey *key_a = a;
+  const TileKey *key_b = b;
+
+  return key_a->x == key_b->x &&
+         key_a->y == key_b->y &&
+         key_a->zoom_level == key_b->zoom_level;
+}
+
+
 static void
-view_load_visible_tiles (ChamplainView *view)
+tile_key_free (gpointer key)
 {
-  DEBUG_LOG ()
+  g_slice_free (TileKey, key);
+}
+
+
+static gboolean
+tile_range_contains (const TileRange *range,
+    gint x,
+    gint y)
+{
+  return x >= range->x_first && x < range->x_end &&
+         y >= range->y_first && y < range->y_end;
+}
+
+
+/* Forgets all the indexed tiles without touching the map_layer */
+static void
+clear_tile_index (ChamplainView *view)
+{
+  ChamplainViewPrivate *priv = view->priv;
+
+  g_hash_table_remove_all (priv->tile_index);
+
+  priv->tile_index_range.x_first = 0;
+  priv->tile_index_range.y_first = 0;
+  priv->tile_index_range.x_end = 0;
+  priv->tile_index_range.y_end = 0;
+  priv->tile_index_zoom_level = priv->zoom_level;
+  priv->tile_index_anchor_x = priv->anchor_x;
+  priv->tile_index_anchor_y = priv->anchor_y;
+}
+
 
+/* Computes the range of tiles covering the viewport with its top-left corner
+ * at (x_coord, y_coord), extended by margin tiles in each direction */
+static void
+compute_tile_range (ChamplainView *view,
+    gdouble x_coord,
+    gdouble y_coord,
+    gint margin,
+    TileRange *range)
+{
   ChamplainViewPrivate *priv = view->priv;
   gint size;
-  GList *children, *child;
-  gint x_count, y_count, x_first, y_first, x_end, y_end, max_x_end, max_y_end;
-  gboolean *tile_map;
-  gint arm_size, arm_max, turn;
-  gint dirs[5] = { 0, 1, 0, -1, 0 };
-  int i, x, y;
-  gdouble x_coord, y_coord;
+  gint x_count, y_count, max_x_end, max_y_end;
 
   size = champlain_map_source_get_tile_size (priv->map_source);
 
-  x_coord = priv->viewport_x + priv->anchor_x;
-  y_coord = priv->viewport_y + priv->anchor_y;
-
   if (x_coord < 0)
     x_coord = 0;
   if (y_coord < 0)
@@ -1917,227 +2211,774 @@ view_load_visible_tiles (ChamplainView *view)
   x_count = ceil ((float) priv->viewport_width / size) + 1;
   y_count = ceil ((float) priv->viewport_height / size) + 1;
 
-  x_first = x_coord / size;
-  y_first = y_coord / size;
+  range->x_first = (gint) (x_coord / size) - margin;
+  range->y_first = (gint) (y_coord / size) - margin;
 
-  x_end = x_first + x_count;
-  y_end = y_first + y_count;
+  range->x_end = range->x_first + x_count + 2 * margin;
+  range->y_end = range->y_first + y_count + 2 * margin;
 
   max_x_end = champlain_map_source_get_column_count (priv->map_source, priv->zoom_level);
   max_y_end = champlain_map_source_get_row_count (priv->map_source, priv->zoom_level);
 
-  if (x_end > max_x_end)
-    x_end = max_x_end;
-  if (y_end > max_y_end)
-    y_end = max_y_end;
-  if (x_first > max_x_end)
-    x_first = max_x_end;
-  if (y_first > max_y_end)
-    y_first = max_y_end;
+  if (range->x_first < 0)
+    range->x_first = 0;
+  if (range->y_first < 0)
+    range->y_first = 0;
+  if (range->x_end > max_x_end)
+    range->x_end = max_x_end;
+  if (range->y_end > max_y_end)
+    range->y_end = max_y_end;
+  if (range->x_first > max_x_end)
+    range->x_first = max_x_end;
+  if (range->y_first > max_y_end)
+    range->y_first = max_y_end;
+}
 
-  x_count = x_end - x_first;
-  y_count = y_end - y_first;
 
-  DEBUG ("Range %d, %d to %d, %d", x_first, y_first, x_end, y_end);
+static void
+prefetch_tile_state_notify (ChamplainTile *tile,
+    G_GNUC_UNUSED GParamSpec *pspec,
+    ChamplainView *view)
+{
+  ChamplainViewPrivate *priv = view->priv;
+  TileKey key;
 
-  tile_map = g_slice_alloc0 (sizeof (gboolean) * x_count * y_count);
+  if (champlain_tile_get_state (tile) != CHAMPLAIN_STATE_DONE)
+    return;
 
-  /* Get rid of old tiles first */
-  children = clutter_container_get_children (CLUTTER_CONTAINER (priv->map_layer));
-  for (child = children; child != NULL; child = g_list_next (child))
-    {
-      ChamplainTile *tile = CHAMPLAIN_TILE (child->data);
+  /* The tile is in the caches now (or failed to load), forget about it */
+  g_signal_handlers_disconnect_by_func (tile, prefetch_tile_state_notify, view);
 
-      gint tile_x = champlain_tile_get_x (tile);
-      gint tile_y = champlain_tile_get_y (tile);
-      guint zoom_level = champlain_tile_get_zoom_level (tile);
+  key.x = champlain_tile_get_x (tile);
+  key.y = champlain_tile_get_y (tile);
+  key.zoom_level = champlain_tile_get_zoom_level (tile);
+  g_hash_table_remove (priv->prefetch_index, &key);
+}
 
-      if (tile_x < x_first || tile_x >= x_end ||
-          tile_y < y_first || tile_y >= y_end ||
-          zoom_level != priv->zoom_level)
-        {
-          /* inform map source to terminate loading the tile */
-          champlain_tile_set_state (tile, CHAMPLAIN_STATE_DONE);
-          clutter_container_remove_actor (CLUTTER_CONTAINER (priv->map_layer), CLUTTER_ACTOR (tile));
-        }
-      else
-        {
-          tile_map[(tile_y - y_first) * x_count + (tile_x - x_first)] = TRUE;
-          view_position_tile (view, tile);
-        }
+
+/* Requests a tile which isn't displayed so that it ends up in the caches;
+ * if it becomes visible before it's loaded, load_tile() takes it over */
+static void
+prefetch_tile (ChamplainView *view,
+    gint x,
+    gint y)
+{
+  ChamplainViewPrivate *priv = view->priv;
+  ChamplainTile *tile;
+  TileKey *key;
+
+  key = g_slice_new (TileKey);
+  key->x = x;
+  key->y = y;
+  key->zoom_level = priv->zoom_level;
+
+  if (g_hash_table_lookup (priv->tile_index, key) ||
+      g_hash_table_lookup (priv->prefetch_index, key))
+    {
+      tile_key_free (key);
+      return;
     }
 
-  g_list_free (children);
+  DEBUG ("Prefetching tile %d, %d, %d", priv->zoom_level, x, y);
+  tile = champlain_tile_new ();
+  g_object_ref_sink (tile);
+  champlain_tile_set_x (tile, x);
+  champlain_tile_set_y (tile, y);
+  champlain_tile_set_zoom_level (tile, priv->zoom_level);
+  champlain_tile_set_size (tile, champlain_map_source_get_tile_size (priv->map_source));
+  champlain_tile_set_state (tile, CHAMPLAIN_STATE_LOADING);
+
+  g_signal_connect (tile, "notify::state", G_CALLBACK (prefetch_tile_state_notify), view);
+  g_hash_table_insert (priv->prefetch_index, key, tile);
+
+  queue_tile_request (view, tile);
+}
+
 
-  /* Load new tiles if needed */
-  x = x_first + x_count / 2 - 1;
-  y = y_first + y_count / 2 - 1;
-  arm_max = MAX (x_count, y_count) + 2;
-  arm_size = 1;
+static void
+prefetch_tile_range (ChamplainView *view,
+    const TileRange *range)
+{
+  gint x, y;
+
+  for (y = range->y_first; y < range->y_end; y++)
+    for (x = range->x_first; x < range->x_end; x++)
+      prefetch_tile (view, x, y);
+}
+
+
+/* Stops loading the prefetched tiles of the current zoom level which lie
+ * inside range (or outside of it when inside is FALSE). All of them are
+ * stopped when range is NULL. */
+static void
+cancel_prefetch_in_range (ChamplainView *view,
+    const TileRange *range,
+    gboolean inside)
+{
+  ChamplainViewPrivate *priv = view->priv;
+  GList *tiles, *iter;
 
-  for (turn = 0; arm_size < arm_max; turn++)
+  tiles = g_hash_table_get_values (priv->prefetch_index);
+  for (iter = tiles; iter != NULL; iter = g_list_next (iter))
     {
-      for (i = 0; i < arm_size; i++)
+      ChamplainTile *tile = CHAMPLAIN_TILE (iter->data);
+
+      if (range)
         {
-          if (y >= y_first && y < y_end && x >= x_first && x < x_end &&
-              !tile_map[(y - y_first) * x_count + (x - x_first)])
-            {
-              ChamplainTile *tile;
-              FillTileCallbackData *data;
-
-              DEBUG ("Loading tile %d, %d, %d", priv->zoom_level, x, y);
-              tile = champlain_tile_new ();
-              champlain_tile_set_x (tile, x);
-              champlain_tile_set_y (tile, y);
-              champlain_tile_set_zoom_level (tile, priv->zoom_level);
-              champlain_tile_set_size (tile, size);
-                  
-              g_signal_connect (tile, "notify::state", G_CALLBACK (tile_state_notify), view);
-              clutter_container_add_actor (CLUTTER_CONTAINER (priv->map_layer), CLUTTER_ACTOR (tile));
-              view_position_tile (view, tile);
-
-              /* updates champlain_view state automatically as
-                 notify::state signal is connected  */
-              champlain_tile_set_state (tile, CHAMPLAIN_STATE_LOADING);
-
-              data = g_slice_new (FillTileCallbackData);
-              data->tile = tile;
-              data->map_source = priv->map_source;
-
-              g_object_ref (tile);
-              g_object_ref (priv->map_source);
-
-              g_idle_add_full (CLUTTER_PRIORITY_REDRAW, (GSourceFunc) fill_tile_cb, data, NULL);
-            }
-
-          x += dirs[turn % 4 + 1];
-          y += dirs[turn % 4];
+          gboolean in_range = champlain_tile_get_zoom_level (tile) == priv->zoom_level &&
+            tile_range_contains (range, champlain_tile_get_x (tile), champlain_tile_get_y (tile));
+
+          if (in_range != inside)
+            continue;
         }
 
-      if (turn % 2 == 1)
-        arm_size++;
+      /* removes the tile from prefetch_index through prefetch_tile_state_notify */
+      champlain_tile_set_state (tile, CHAMPLAIN_STATE_DONE);
     }
 
-  g_slice_free1 (sizeof (gboolean) * x_count * y_count, tile_map);
+  g_list_free (tiles);
 }
 
 
-static gboolean
-fill_tile_cb (FillTileCallbackData *data)
+static void
+cancel_prefetch (ChamplainView *view)
 {
-  DEBUG_LOG ()
-
-  ChamplainTile *tile = data->tile;
-  ChamplainMapSource *map_source = data->map_source;
-
-  champlain_map_source_fill_tile (map_source, tile);
+  ChamplainViewPrivate *priv = view->priv;
 
-  g_slice_free (FillTileCallbackData, data);
-  g_object_unref (map_source);
-  g_object_unref (tile);
+  cancel_prefetch_in_range (view, NULL, FALSE);
 
-  return FALSE;
+  priv->kinetic_prefetch_range.x_first = 0;
+  priv->kinetic_prefetch_range.y_first = 0;
+  priv->kinetic_prefetch_range.x_end = 0;
+  priv->kinetic_prefetch_range.y_end = 0;
 }
 
 
 static void
-view_position_tile (ChamplainView *view,
-    ChamplainTile *tile)
+view_prefetch_kinetic_target (ChamplainView *view)
 {
-  DEBUG_LOG ()
-
   ChamplainViewPrivate *priv = view->priv;
+  TileRange range;
+  gdouble x, y;
 
-  ClutterActor *actor;
-  gint x;
-  gint y;
-  guint size;
+  if (!champlain_kinetic_scroll_view_get_deceleration_target (
+          CHAMPLAIN_KINETIC_SCROLL_VIEW (priv->kinetic_scroll), &x, &y))
+    return;
 
-  actor = CLUTTER_ACTOR (tile);
+  /* The target is expressed as the viewport origin */
+  compute_tile_range (view, x + priv->anchor_x, y + priv->anchor_y,
+      priv->prefetch_ring, &range);
 
-  x = champlain_tile_get_x (tile);
-  y = champlain_tile_get_y (tile);
-  size = champlain_tile_get_size (tile);
+  if (range.x_first == priv->kinetic_prefetch_range.x_first &&
+      range.y_first == priv->kinetic_prefetch_range.y_first &&
+      range.x_end == priv->kinetic_prefetch_range.x_end &&
+      range.y_end == priv->kinetic_prefetch_range.y_end)
+    return;
 
-  clutter_actor_set_position (actor,
-      (x * size) - priv->anchor_x,
-      (y * size) - priv->anchor_y);
+  DEBUG ("Kinetic prefetch %d, %d to %d, %d", range.x_first, range.y_first,
+      range.x_end, range.y_end);
+
+  cancel_prefetch_in_range (view, &range, FALSE);
+  prefetch_tile_range (view, &range);
+
+  priv->kinetic_prefetch_range = range;
 }
 
 
-static void
-remove_all_tiles (ChamplainView *view)
+static guint
+tile_pool_limit (ChamplainView *view)
 {
-  DEBUG_LOG ()
-
   ChamplainViewPrivate *priv = view->priv;
-  GList *children, *child;
+  gint size = champlain_map_source_get_tile_size (priv->map_source);
 
-  children = clutter_container_get_children (CLUTTER_CONTAINER (priv->map_layer));
-  for (child = children; child != NULL; child = g_list_next (child))
-    {
-      ChamplainTile *tile = CHAMPLAIN_TILE (child->data);
+  if (size <= 0)
+    return 0;
 
-      champlain_tile_set_state (tile, CHAMPLAIN_STATE_DONE);
-    }
-  champlain_group_remove_all (CHAMPLAIN_GROUP (priv->map_layer));
-  g_list_free (children);
+  return (priv->viewport_width / size + 2) * (priv->viewport_height / size + 2);
 }
 
 
-/**
- * champlain_view_reload_tiles:
- * @view: a #ChamplainView
- *
- * Reloads all visible tiles.
- *
- * Since: 0.8
- */
-void
-champlain_view_reload_tiles (ChamplainView *view)
+/* Marks tiles requested from the map source until it sets them DONE */
+static GQuark
+tile_in_flight_quark (void)
 {
-  DEBUG_LOG ()
+  static GQuark quark = 0;
 
-  remove_all_tiles (view);
+  if (!quark)
+    quark = g_quark_from_static_string ("champlain-view-tile-in-flight");
 
-  view_load_visible_tiles (view);
+  return quark;
+}
+
+
+static gboolean
+tile_in_flight (ChamplainTile *tile)
+{
+  return g_object_get_qdata (G_OBJECT (tile), tile_in_flight_quark ()) != NULL;
 }
 
 
 static void
-tile_state_notify (ChamplainTile *tile,
+tile_in_flight_state_notify (ChamplainTile *tile,
     G_GNUC_UNUSED GParamSpec *pspec,
     ChamplainView *view)
 {
-  DEBUG_LOG ()
-
-  ChamplainState tile_state = champlain_tile_get_state (tile);
-  ChamplainViewPrivate *priv = view->priv;
+  if (champlain_tile_get_state (tile) != CHAMPLAIN_STATE_DONE)
+    return;
 
-  if (tile_state == CHAMPLAIN_STATE_LOADING)
-    {
-      if (priv->tiles_loading == 0)
-        {
-          priv->state = CHAMPLAIN_STATE_LOADING;
-          g_object_notify (G_OBJECT (view), "state");
-        }
-      priv->tiles_loading++;
-    }
-  else if (tile_state == CHAMPLAIN_STATE_DONE)
-    {
-      if (priv->tiles_loading > 0)
-        priv->tiles_loading--;
-      if (priv->tiles_loading == 0)
-        {
-          priv->state = CHAMPLAIN_STATE_DONE;
-          g_object_notify (G_OBJECT (view), "state");
-        }
-    }
+  g_object_set_qdata (G_OBJECT (tile), tile_in_flight_quark (), NULL);
+  g_signal_handlers_disconnect_by_func (tile, tile_in_flight_state_notify, view);
 }
 
 
-/**
- * champlain_view_set_map_source:
+static void
+set_tile_in_flight (ChamplainView *view,
+    ChamplainTile *tile)
+{
+  if (tile_in_flight (tile))
+    return;
+
+  g_object_set_qdata (G_OBJECT (tile), tile_in_flight_quark (), GINT_TO_POINTER (TRUE));
+  g_signal_connect (tile, "notify::state", G_CALLBACK (tile_in_flight_state_notify), view);
+}
+
+
+/* Takes over the reference to tile; in_flight tells whether the map source
+ * still had the tile when the view let it go */
+static void
+recycle_tile (ChamplainView *view,
+    ChamplainTile *tile,
+    gboolean in_flight)
+{
+  ChamplainViewPrivate *priv = view->priv;
+  guint limit = tile_pool_limit (view);
+
+  /* the viewport may have shrunk since the tiles were pooled */
+  while (priv->tile_pool->len > limit)
+    g_object_unref (g_ptr_array_remove_index_fast (priv->tile_pool, priv->tile_pool->len - 1));
+
+  /* the map source may finish a cancelled tile any time later, only
+     tiles it has completed can be reused */
+  if (in_flight || priv->tile_pool->len >= limit)
+    {
+      g_object_unref (tile);
+      return;
+    }
+
+  champlain_tile_reset (tile);
+  g_ptr_array_add (priv->tile_pool, tile);
+}
+
+
+static ChamplainTile *
+new_tile (ChamplainView *view)
+{
+  ChamplainViewPrivate *priv = view->priv;
+
+  if (priv->tile_pool->len > 0)
+    return g_ptr_array_remove_index_fast (priv->tile_pool, priv->tile_pool->len - 1);
+
+  return g_object_ref_sink (champlain_tile_new ());
+}
+
+
+static void
+unload_tile (ChamplainView *view,
+    gint x,
+    gint y)
+{
+  ChamplainViewPrivate *priv = view->priv;
+  ChamplainTile *tile;
+  TileKey key;
+  gboolean in_flight;
+
+  key.x = x;
+  key.y = y;
+  key.zoom_level = priv->tile_index_zoom_level;
+
+  tile = g_hash_table_lookup (priv->tile_index, &key);
+  if (!tile)
+    return;
+
+  g_object_ref (tile);
+
+  in_flight = tile_in_flight (tile);
+
+  /* inform map source to terminate loading the tile */
+  champlain_tile_set_state (tile, CHAMPLAIN_STATE_DONE);
+  g_signal_handlers_disconnect_matched (tile, G_SIGNAL_MATCH_DATA,
+      0, 0, NULL, NULL, view);
+  clutter_container_remove_actor (CLUTTER_CONTAINER (priv->map_layer), CLUTTER_ACTOR (tile));
+  g_hash_table_remove (priv->tile_index, &key);
+
+  recycle_tile (view, tile, in_flight);
+}
+
+
+/* Shows the matching part of the nearest ancestor held by the zoom actor,
+ * scaled up, until the tile's own content gets displayed */
+static void
+view_set_tile_placeholder (ChamplainView *view,
+    ChamplainTile *tile)
+{
+  ChamplainViewPrivate *priv = view->priv;
+  ChamplainTile *ancestor;
+  ClutterActor *content;
+  ClutterActor *placeholder, *texture;
+  CoglHandle cogl_texture = COGL_INVALID_HANDLE;
+  TileKey key;
+  gint x, y, size, scale;
+  guint zoom_diff;
+
+  if (g_hash_table_size (priv->zoom_actor_tiles) == 0)
+    return;
+
+  x = champlain_tile_get_x (tile);
+  y = champlain_tile_get_y (tile);
+  size = champlain_tile_get_size (tile);
+
+  for (zoom_diff = 1; zoom_diff <= MAX_PLACEHOLDER_ZOOM_DIFF && zoom_diff <= priv->zoom_level; zoom_diff++)
+    {
+      key.x = x >> zoom_diff;
+      key.y = y >> zoom_diff;
+      key.zoom_level = priv->zoom_level - zoom_diff;
+
+      ancestor = g_hash_table_lookup (priv->zoom_actor_tiles, &key);
+      if (!ancestor)
+        continue;
+
+      /* Ancestors showing a placeholder or a rendered group can't be
+         scaled up, a texture may still be found further up */
+      content = champlain_tile_get_content (ancestor);
+      if (!content || !CLUTTER_IS_TEXTURE (content))
+        continue;
+
+      /* Share the ancestor's texture so that the placeholder outlives the
+         zoom actor */
+      cogl_texture = clutter_texture_get_cogl_texture (CLUTTER_TEXTURE (content));
+      if (cogl_texture != COGL_INVALID_HANDLE)
+        break;
+    }
+
+  if (cogl_texture == COGL_INVALID_HANDLE)
+    return;
+
+  DEBUG ("Placeholder for tile %d, %d, %d from zoom level %d", x, y,
+      priv->zoom_level, key.zoom_level);
+
+  scale = 1 << zoom_diff;
+
+  texture = clutter_texture_new ();
+  clutter_texture_set_cogl_texture (CLUTTER_TEXTURE (texture), cogl_texture);
+  clutter_actor_set_size (texture, size * scale, size * scale);
+  clutter_actor_set_position (texture,
+      -(x - (key.x << zoom_diff)) * size,
+      -(y - (key.y << zoom_diff)) * size);
+
+  placeholder = clutter_group_new ();
+  clutter_container_add_actor (CLUTTER_CONTAINER (placeholder), texture);
+  clutter_actor_set_clip (placeholder, 0, 0, size, size);
+
+  /* The real content replaces it through champlain_tile_display_content() */
+  champlain_tile_set_content (tile, placeholder);
+  champlain_tile_display_content (tile);
+}
+
+
+static void
+load_tile (ChamplainView *view,
+    gint x,
+    gint y,
+    gint size)
+{
+  ChamplainViewPrivate *priv = view->priv;
+  ChamplainTile *tile;
+  TileKey *key;
+
+  key = g_slice_new (TileKey);
+  key->x = x;
+  key->y = y;
+  key->zoom_level = priv->zoom_level;
+
+  tile = g_hash_table_lookup (priv->prefetch_index, key);
+  if (tile)
+    {
+      /* The tile is already on its way, just start displaying it */
+      DEBUG ("Adopting prefetched tile %d, %d, %d", priv->zoom_level, x, y);
+      g_object_ref (tile);
+      g_signal_handlers_disconnect_by_func (tile, prefetch_tile_state_notify, view);
+      g_hash_table_remove (priv->prefetch_index, key);
+
+      g_signal_connect (tile, "notify::state", G_CALLBACK (tile_state_notify), view);
+      clutter_container_add_actor (CLUTTER_CONTAINER (priv->map_layer), CLUTTER_ACTOR (tile));
+      view_position_tile (view, tile);
+      g_hash_table_insert (priv->tile_index, key, tile);
+
+      view_tile_loading_started (view);
+      return;
+    }
+
+  DEBUG ("Loading tile %d, %d, %d", priv->zoom_level, x, y);
+  tile = new_tile (view);
+  champlain_tile_set_x (tile, x);
+  champlain_tile_set_y (tile, y);
+  champlain_tile_set_zoom_level (tile, priv->zoom_level);
+  champlain_tile_set_size (tile, size);
+
+  g_signal_connect (tile, "notify::state", G_CALLBACK (tile_state_notify), view);
+  clutter_container_add_actor (CLUTTER_CONTAINER (priv->map_layer), CLUTTER_ACTOR (tile));
+  view_position_tile (view, tile);
+
+  g_hash_table_insert (priv->tile_index, key, tile);
+
+  /* updates champlain_view state automatically as
+     notify::state signal is connected  */
+  champlain_tile_set_state (tile, CHAMPLAIN_STATE_LOADING);
+
+  view_set_tile_placeholder (view, tile);
+
+  queue_tile_request (view, tile);
+}
+
+
+static void
+view_load_visible_tiles (ChamplainView *view)
+{
+  DEBUG_LOG ()
+
+  ChamplainViewPrivate *priv = view->priv;
+  TileRange *old_range = &priv->tile_index_range;
+  TileRange range;
+  gint size;
+  gint x, y;
+
+  size = champlain_map_source_get_tile_size (priv->map_source);
+
+  compute_tile_range (view, priv->viewport_x + priv->anchor_x,
+      priv->viewport_y + priv->anchor_y, 0, &range);
+
+  DEBUG ("Range %d, %d to %d, %d", range.x_first, range.y_first, range.x_end, range.y_end);
+
+  /* Tiles indexed at a different zoom level are all out of range */
+  if (priv->tile_index_zoom_level != priv->zoom_level)
+    {
+      for (y = old_range->y_first; y < old_range->y_end; y++)
+        for (x = old_range->x_first; x < old_range->x_end; x++)
+          unload_tile (view, x, y);
+
+      clear_tile_index (view);
+      cancel_prefetch (view);
+    }
+
+  /* Get rid of the tiles which left the range */
+  for (y = old_range->y_first; y < old_range->y_end; y++)
+    {
+      if (y < range.y_first || y >= range.y_end)
+        {
+          for (x = old_range->x_first; x < old_range->x_end; x++)
+            unload_tile (view, x, y);
+        }
+      else
+        {
+          for (x = old_range->x_first; x < MIN (old_range->x_end, range.x_first); x++)
+            unload_tile (view, x, y);
+          for (x = MAX (old_range->x_first, range.x_end); x < old_range->x_end; x++)
+            unload_tile (view, x, y);
+        }
+    }
+
+  /* Tiles are positioned relatively to the anchor, only move them when it
+     changed */
+  if (priv->tile_index_anchor_x != priv->anchor_x ||
+      priv->tile_index_anchor_y != priv->anchor_y)
+    {
+      GHashTableIter iter;
+      gpointer tile;
+
+      g_hash_table_iter_init (&iter, priv->tile_index);
+      while (g_hash_table_iter_next (&iter, NULL, &tile))
+        view_position_tile (view, CHAMPLAIN_TILE (tile));
+
+      priv->tile_index_anchor_x = priv->anchor_x;
+      priv->tile_index_anchor_y = priv->anchor_y;
+    }
+
+  /* Load the newly exposed tiles, the request scheduler takes care of
+     loading the ones close to the center first */
+  for (y = range.y_first; y < range.y_end; y++)
+    for (x = range.x_first; x < range.x_end; x++)
+      {
+        if (tile_range_contains (old_range, x, y))
+          x = old_range->x_end - 1; /* skip over the already loaded span */
+        else
+          load_tile (view, x, y, size);
+      }
+
+  *old_range = range;
+}
+
+
+static void
+tile_request_free (TileRequest *request)
+{
+  g_object_unref (request->map_source);
+  g_object_unref (request->tile);
+  g_slice_free (TileRequest, request);
+}
+
+
+static gint
+tile_request_compare (gconstpointer a,
+    gconstpointer b)
+{
+  const TileRequest *req_a = *(TileRequest **) a;
+  const TileRequest *req_b = *(TileRequest **) b;
+
+  /* Sorted farthest first so that the closest request sits at the end of
+   * the array and can be removed cheaply */
+  if (req_a->prefetch != req_b->prefetch)
+    return req_a->prefetch ? -1 : 1;
+  if (req_a->distance > req_b->distance)
+    return -1;
+  if (req_a->distance < req_b->distance)
+    return 1;
+  return 0;
+}
+
+
+static gboolean
+dispatch_tile_requests (ChamplainView *view)
+{
+  DEBUG_LOG ()
+
+  ChamplainViewPrivate *priv = view->priv;
+  GPtrArray *requests = priv->tile_requests;
+  gdouble center_x, center_y;
+  gdouble target_x, target_y;
+  guint i, dispatched;
+
+  center_x = priv->viewport_x + priv->anchor_x + priv->viewport_width / 2.0;
+  center_y = priv->viewport_y + priv->anchor_y + priv->viewport_height / 2.0;
+
+  /* During a go to animation the tiles which aren't displayed are mostly
+   * the prefetched ones around its destination */
+  if (priv->goto_context)
+    {
+      target_x = champlain_map_source_get_x (priv->map_source, priv->zoom_level,
+            priv->goto_context->to_longitude);
+      target_y = champlain_map_source_get_y (priv->map_source, priv->zoom_level,
+            priv->goto_context->to_latitude);
+    }
+  else
+    {
+      target_x = center_x;
+      target_y = center_y;
+    }
+
+  /* Drop the requests for tiles which were removed in the meantime and
+   * compute the distance of the remaining ones from the current center */
+  i = 0;
+  while (i < requests->len)
+    {
+      TileRequest *request = g_ptr_array_index (requests, i);
+      ChamplainTile *tile = request->tile;
+      gdouble dx, dy;
+      guint size;
+
+      if (champlain_tile_get_state (tile) == CHAMPLAIN_STATE_DONE ||
+          champlain_tile_get_zoom_level (tile) != priv->zoom_level)
+        {
+          g_ptr_array_remove_index_fast (requests, i);
+          tile_request_free (request);
+          continue;
+        }
+
+      /* Tiles which aren't displayed are dispatched after all the others,
+       * the closest to the predicted viewport first */
+      request->prefetch = clutter_actor_get_parent (CLUTTER_ACTOR (tile)) == NULL;
+
+      size = champlain_tile_get_size (tile);
+      dx = (champlain_tile_get_x (tile) + 0.5) * size - (request->prefetch ? target_x : center_x);
+      dy = (champlain_tile_get_y (tile) + 0.5) * size - (request->prefetch ? target_y : center_y);
+      request->distance = dx * dx + dy * dy;
+      i++;
+    }
+
+  g_ptr_array_sort (requests, tile_request_compare);
+
+  for (dispatched = 0; dispatched < MAX_TILE_REQUESTS_PER_DISPATCH && requests->len > 0; dispatched++)
+    {
+      TileRequest *request = g_ptr_array_remove_index (requests, requests->len - 1);
+
+      champlain_map_source_fill_tile (request->map_source, request->tile);
+      tile_request_free (request);
+    }
+
+  DEBUG ("Dispatched %u tile requests, %u pending", dispatched, requests->len);
+
+  if (requests->len > 0)
+    return TRUE;
+
+  priv->tile_requests_source_id = 0;
+  return FALSE;
+}
+
+
+static void
+queue_tile_request (ChamplainView *view,
+    ChamplainTile *tile)
+{
+  ChamplainViewPrivate *priv = view->priv;
+  TileRequest *request;
+
+  request = g_slice_new (TileRequest);
+  request->tile = g_object_ref (tile);
+  request->map_source = g_object_ref (priv->map_source);
+  request->distance = 0.0;
+  request->prefetch = FALSE;
+
+  g_ptr_array_add (priv->tile_requests, request);
+  set_tile_in_flight (view, tile);
+
+  if (priv->tile_requests_source_id == 0)
+    priv->tile_requests_source_id = g_idle_add_full (CLUTTER_PRIORITY_REDRAW,
+          (GSourceFunc) dispatch_tile_requests, view, NULL);
+}
+
+
+static void
+clear_tile_requests (ChamplainView *view)
+{
+  ChamplainViewPrivate *priv = view->priv;
+
+  if (priv->tile_requests_source_id != 0)
+    {
+      g_source_remove (priv->tile_requests_source_id);
+      priv->tile_requests_source_id = 0;
+    }
+
+  while (priv->tile_requests->len > 0)
+    tile_request_free (g_ptr_array_remove_index_fast (priv->tile_requests, 0));
+}
+
+
+static void
+view_position_tile (ChamplainView *view,
+    ChamplainTile *tile)
+{
+  DEBUG_LOG ()
+
+  ChamplainViewPrivate *priv = view->priv;
+
+  ClutterActor *actor;
+  gint x;
+  gint y;
+  guint size;
+
+  actor = CLUTTER_ACTOR (tile);
+
+  x = champlain_tile_get_x (tile);
+  y = champlain_tile_get_y (tile);
+  size = champlain_tile_get_size (tile);
+
+  clutter_actor_set_position (actor,
+      (x * size) - priv->anchor_x,
+      (y * size) - priv->anchor_y);
+}
+
+
+static void
+remove_all_tiles (ChamplainView *view)
+{
+  DEBUG_LOG ()
+
+  ChamplainViewPrivate *priv = view->priv;
+  GList *children, *child;
+
+  children = clutter_container_get_children (CLUTTER_CONTAINER (priv->map_layer));
+  for (child = children; child != NULL; child = g_list_next (child))
+    {
+      ChamplainTile *tile = CHAMPLAIN_TILE (child->data);
+
+      champlain_tile_set_state (tile, CHAMPLAIN_STATE_DONE);
+    }
+  champlain_group_remove_all (CHAMPLAIN_GROUP (priv->map_layer));
+  g_list_free (children);
+
+  clear_tile_index (view);
+  cancel_prefetch (view);
+
+  /* the zoom actor shows tiles of another map source */
+  g_hash_table_remove_all (priv->zoom_actor_tiles);
+}
+
+
+/**
+ * champlain_view_reload_tiles:
+ * @view: a #ChamplainView
+ *
+ * Reloads all visible tiles.
+ *
+ * Since: 0.8
+ */
+void
+champlain_view_reload_tiles (ChamplainView *view)
+{
+  DEBUG_LOG ()
+
+  remove_all_tiles (view);
+
+  view_load_visible_tiles (view);
+}
+
+
+static void
+view_tile_loading_started (ChamplainView *view)
+{
+  ChamplainViewPrivate *priv = view->priv;
+
+  if (priv->tiles_loading == 0)
+    {
+      priv->state = CHAMPLAIN_STATE_LOADING;
+      g_object_notify (G_OBJECT (view), "state");
+    }
+  priv->tiles_loading++;
+}
+
+
+static void
+view_tile_loading_finished (ChamplainView *view)
+{
+  ChamplainViewPrivate *priv = view->priv;
+
+  if (priv->tiles_loading > 0)
+    priv->tiles_loading--;
+  if (priv->tiles_loading == 0)
+    {
+      priv->state = CHAMPLAIN_STATE_DONE;
+      g_object_notify (G_OBJECT (view), "state");
+    }
+}
+
+
+static void
+tile_state_notify (ChamplainTile *tile,
+    G_GNUC_UNUSED GParamSpec *pspec,
+    ChamplainView *view)
+{
+  DEBUG_LOG ()
+
+  ChamplainState tile_state = champlain_tile_get_state (tile);
+
+  if (tile_state == CHAMPLAIN_STATE_LOADING)
+    view_tile_loading_started (view);
+  else if (tile_state == CHAMPLAIN_STATE_DONE)
+    view_tile_loading_finished (view);
+}
+
+
+/**
+ * champlain_view_set_map_source:
  * @view: a #ChamplainView
  * @map_source: a #ChamplainMapSource
  *
@@ -2300,6 +3141,91 @@ champlain_view_set_animate_zoom (ChamplainView *view,
 }
 
 
+/**
+ * champlain_view_set_kinetic_prefetch:
+ * @view: a #ChamplainView
+ * @value: a #gboolean
+ *
+ * Should the view prefetch the tiles around the position where a kinetic
+ * deceleration will come to rest. Only used in kinetic mode.
+ *
+ * Since: 0.14
+ */
+void
+champlain_view_set_kinetic_prefetch (ChamplainView *view,
+    gboolean value)
+{
+  DEBUG_LOG ()
+
+  g_return_if_fail (CHAMPLAIN_IS_VIEW (view));
+
+  view->priv->kinetic_prefetch = value;
+
+  if (!value)
+    cancel_prefetch (view);
+
+  g_object_notify (G_OBJECT (view), "kinetic-prefetch");
+}
+
+
+/**
+ * champlain_view_set_goto_prefetch:
+ * @view: a #ChamplainView
+ * @value: a #gboolean
+ *
+ * Should the view prefetch the tiles around the destination of
+ * champlain_view_go_to() when the animation starts.
+ *
+ * Since: 0.14
+ */
+void
+champlain_view_set_goto_prefetch (ChamplainView *view,
+    gboolean value)
+{
+  DEBUG_LOG ()
+
+  g_return_if_fail (CHAMPLAIN_IS_VIEW (view));
+
+  ChamplainViewPrivate *priv = view->priv;
+
+  priv->goto_prefetch = value;
+
+  if (!value && priv->goto_context)
+    {
+      cancel_prefetch_in_range (view, &priv->goto_context->prefetch_range, TRUE);
+      priv->goto_context->prefetch_range.x_first = 0;
+      priv->goto_context->prefetch_range.y_first = 0;
+      priv->goto_context->prefetch_range.x_end = 0;
+      priv->goto_context->prefetch_range.y_end = 0;
+    }
+
+  g_object_notify (G_OBJECT (view), "goto-prefetch");
+}
+
+
+/**
+ * champlain_view_set_prefetch_ring:
+ * @view: a #ChamplainView
+ * @ring: number of tiles
+ *
+ * Sets the number of tiles prefetched in each direction around the predicted
+ * viewport.
+ *
+ * Since: 0.14
+ */
+void
+champlain_view_set_prefetch_ring (ChamplainView *view,
+    guint ring)
+{
+  DEBUG_LOG ()
+
+  g_return_if_fail (CHAMPLAIN_IS_VIEW (view));
+
+  view->priv->prefetch_ring = ring;
+  g_object_notify (G_OBJECT (view), "prefetch-ring");
+}
+
+
 /**
  * champlain_view_ensure_visible:
  * @view: a #ChamplainView
@@ -2485,6 +3411,7 @@ show_zoom_actor (ChamplainView *view,
         priv->zoom_level,
         y_first * size);
 
+      g_hash_table_remove_all (priv->zoom_actor_tiles);
       clutter_group_remove_all (CLUTTER_GROUP (priv->zoom_overlay_actor));
       zoom_actor = clutter_group_new ();
       clutter_group_add (CLUTTER_GROUP (priv->zoom_overlay_actor), zoom_actor);
@@ -2496,6 +3423,13 @@ show_zoom_actor (ChamplainView *view,
           ChamplainTile *tile = CHAMPLAIN_TILE (child->data);
           gint tile_x = champlain_tile_get_x (tile);
           gint tile_y = champlain_tile_get_y (tile);
+          TileKey *key;
+
+          key = g_slice_new (TileKey);
+          key->x = tile_x;
+          key->y = tile_y;
+          key->zoom_level = champlain_tile_get_zoom_level (tile);
+          g_hash_table_insert (priv->zoom_actor_tiles, key, g_object_ref (tile));
 
           champlain_tile_set_state (tile, CHAMPLAIN_STATE_DONE);
           clutter_actor_reparent (CLUTTER_ACTOR (tile), zoom_actor);
@@ -2503,6 +3437,9 @@ show_zoom_actor (ChamplainView *view,
         }
 
       g_list_free (children);
+
+      /* the tiles now belong to the zoom actor */
+      clear_tile_index (view);
       
       gdouble deltax = x_first * size - priv->viewport_x - priv->anchor_x;
       gdouble deltay = y_first * size - priv->viewport_y - priv->anchor_y;
@@ -2804,6 +3741,71 @@ champlain_view_get_animate_zoom (ChamplainView *view)
 }
 
 
+/**
+ * champlain_view_get_kinetic_prefetch:
+ * @view: a #ChamplainView
+ *
+ * Checks whether the view prefetches tiles during kinetic deceleration.
+ *
+ * Returns: TRUE if the view prefetches tiles, FALSE otherwise.
+ *
+ * Since: 0.14
+ */
+gboolean
+champlain_view_get_kinetic_prefetch (ChamplainView *view)
+{
+  DEBUG_LOG ()
+
+  g_return_val_if_fail (CHAMPLAIN_IS_VIEW (view), FALSE);
+
+  return view->priv->kinetic_prefetch;
+}
+
+
+/**
+ * champlain_view_get_goto_prefetch:
+ * @view: a #ChamplainView
+ *
+ * Checks whether the view prefetches the destination tiles of
+ * champlain_view_go_to().
+ *
+ * Returns: TRUE if the view prefetches tiles, FALSE otherwise.
+ *
+ * Since: 0.14
+ */
+gboolean
+champlain_view_get_goto_prefetch (ChamplainView *view)
+{
+  DEBUG_LOG ()
+
+  g_return_val_if_fail (CHAMPLAIN_IS_VIEW (view), FALSE);
+
+  return view->priv->goto_prefetch;
+}
+
+
+/**
+ * champlain_view_get_prefetch_ring:
+ * @view: a #ChamplainView
+ *
+ * Gets the number of tiles prefetched in each direction around the predicted
+ * viewport.
+ *
+ * Returns: the number of tiles.
+ *
+ * Since: 0.14
+ */
+guint
+champlain_view_get_prefetch_ring (ChamplainView *view)
+{
+  DEBUG_LOG ()
+
+  g_return_val_if_fail (CHAMPLAIN_IS_VIEW (view), 0);
+
+  return view->priv->prefetch_ring;
+}
+
+
 /**
  * champlain_view_bin_layout_add:
  * @view: a #ChamplainView
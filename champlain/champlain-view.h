@@ -117,6 +117,12 @@ void champlain_view_set_zoom_on_double_click (ChamplainView *view,
     gboolean value);
 void champlain_view_set_animate_zoom (ChamplainView *view,
     gboolean value);
+void champlain_view_set_kinetic_prefetch (ChamplainView *view,
+    gboolean value);
+void champlain_view_set_goto_prefetch (ChamplainView *view,
+    gboolean value);
+void champlain_view_set_prefetch_ring (ChamplainView *view,
+    guint ring);
 
 void champlain_view_add_layer (ChamplainView *view,
     ChamplainLayer *layer);
@@ -132,6 +138,9 @@ gboolean champlain_view_get_kinetic_mode (ChamplainView *view);
 gboolean champlain_view_get_keep_center_on_resize (ChamplainView *view);
 gboolean champlain_view_get_zoom_on_double_click (ChamplainView *view);
 gboolean champlain_view_get_animate_zoom (ChamplainView *view);
+gboolean champlain_view_get_kinetic_prefetch (ChamplainView *view);
+gboolean champlain_view_get_goto_prefetch (ChamplainView *view);
+guint champlain_view_get_prefetch_ring (ChamplainView *view);
 ChamplainState champlain_view_get_state (ChamplainView *view);
 
 void champlain_view_reload_tiles (ChamplainView *view);
@@ -41,6 +41,7 @@
 #include "champlain/champlain-view.h"
 #include "champlain/champlain-bounding-box.h"
 #include "champlain/champlain-scale.h"
+#include "champlain/champlain-static-map.h"
 
 #include "champlain/champlain-map-source.h"
 #include "champlain/champlain-tile-source.h"
@@ -0,0 +1,421 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors (see AUTHORS)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Renders a list of static maps into PNG files and reports the throughput.
+ *
+ * Every line of the job file describes one image:
+ *
+ *   center LATITUDE LONGITUDE ZOOM [NAME]
+ *   bbox TOP LEFT BOTTOM RIGHT [NAME]
+ *
+ * Empty lines and lines starting with '#' are ignored. All the images share
+ * one map source chain, so tiles loaded for one image are reused from the
+ * memory and file caches by the others. With --offline the tiles come from
+ * the file cache only; --uri-format can point the chain to a local HTTP
+ * server instead of the public tile servers.
+ */
+
+#include <champlain/champlain.h>
+#include <string.h>
+#include <stdlib.h>
+
+typedef struct
+{
+  gchar *name;
+  gboolean use_bbox;
+  ChamplainBoundingBox bbox;
+  gdouble latitude;
+  gdouble longitude;
+  guint zoom_level;
+} Job;
+
+typedef struct
+{
+  cairo_surface_t *surface;
+  gchar *filename;
+} WriteTask;
+
+static gchar *source_id = CHAMPLAIN_MAP_SOURCE_OSM_MAPNIK;
+static gchar *uri_format = NULL;
+static gchar *cache_dir = NULL;
+static gchar *output_dir = ".";
+static gboolean offline = FALSE;
+static gint parallel = 4;
+static gint memory_cache_size = 500;
+static gint width = 512;
+static gint height = 512;
+
+static GOptionEntry entries[] =
+{
+  { "map-source", 's', 0, G_OPTION_ARG_STRING, &source_id, "Map source id", "ID" },
+  { "uri-format", 'u', 0, G_OPTION_ARG_STRING, &uri_format,
+    "Load the tiles from this URI instead, e.g. http://localhost:8080/#Z#/#X#/#Y#.png", "FORMAT" },
+  { "cache-dir", 'c', 0, G_OPTION_ARG_FILENAME, &cache_dir, "File cache directory", "DIR" },
+  { "offline", 'o', 0, G_OPTION_ARG_NONE, &offline, "Use cached tiles only", NULL },
+  { "output-dir", 'd', 0, G_OPTION_ARG_FILENAME, &output_dir, "Directory for the images", "DIR" },
+  { "jobs", 'j', 0, G_OPTION_ARG_INT, &parallel, "Number of images rendered at the same time", "N" },
+  { "memory-cache", 'm', 0, G_OPTION_ARG_INT, &memory_cache_size, "Memory cache size in tiles", "N" },
+  { "width", 'W', 0, G_OPTION_ARG_INT, &width, "Image width", "PIXELS" },
+  { "height", 'H', 0, G_OPTION_ARG_INT, &height, "Image height", "PIXELS" },
+  { NULL }
+};
+
+static ChamplainMapSource *map_source;
+static GPtrArray *jobs;
+static guint next_job = 0;
+static guint rendering = 0;
+static guint writing = 0;
+/* updated from the writer threads */
+static volatile gint written = 0;
+static volatile gint failed = 0;
+static GThreadPool *writers;
+static GTimer *timer;
+
+
+static ChamplainMapSource *
+create_map_source (GError **error)
+{
+  ChamplainMapSourceFactory *factory;
+  ChamplainMapSourceChain *chain;
+  ChamplainMapSource *tile_source;
+  ChamplainMapSource *file_cache;
+  ChamplainMapSource *memory_cache;
+  ChamplainRenderer *renderer;
+  guint tile_size;
+
+  factory = champlain_map_source_factory_dup_default ();
+
+  if (uri_format)
+    {
+      renderer = CHAMPLAIN_RENDERER (champlain_image_renderer_new ());
+      tile_source = CHAMPLAIN_MAP_SOURCE (champlain_network_tile_source_new_full (
+              "batch-render", "Batch render", NULL, NULL, 0, 18, 256,
+              CHAMPLAIN_MAP_PROJECTION_MERCATOR, uri_format, renderer));
+    }
+  else
+    tile_source = champlain_map_source_factory_create (factory, source_id);
+
+  if (!tile_source)
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+          "Unknown map source %s", source_id);
+      g_object_unref (factory);
+      return NULL;
+    }
+
+  if (offline && CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source))
+    champlain_network_tile_source_set_offline (CHAMPLAIN_NETWORK_TILE_SOURCE (tile_source), TRUE);
+
+  tile_size = champlain_map_source_get_tile_size (tile_source);
+
+  renderer = CHAMPLAIN_RENDERER (champlain_image_renderer_new ());
+  file_cache = CHAMPLAIN_MAP_SOURCE (champlain_file_cache_new_full (100000000, cache_dir, renderer));
+
+  renderer = CHAMPLAIN_RENDERER (champlain_image_renderer_new ());
+  memory_cache = CHAMPLAIN_MAP_SOURCE (champlain_memory_cache_new_full (memory_cache_size, renderer));
+
+  chain = champlain_map_source_chain_new ();
+  champlain_map_source_chain_push (chain, champlain_map_source_factory_create_error_source (factory, tile_size));
+  champlain_map_source_chain_push (chain, tile_source);
+  champlain_map_source_chain_push (chain, file_cache);
+  champlain_map_source_chain_push (chain, memory_cache);
+
+  g_object_unref (factory);
+
+  return g_object_ref_sink (chain);
+}
+
+
+static gboolean
+parse_job (gchar *line,
+    guint line_number,
+    Job *job,
+    GError **error)
+{
+  gchar **tokens;
+  guint n_tokens, n_values, i;
+  gdouble values[4];
+  gboolean success = FALSE;
+
+  tokens = g_strsplit_set (g_strstrip (line), " \t", -1);
+
+  /* g_strsplit_set() returns empty tokens for repeated separators */
+  for (i = 0, n_tokens = 0; tokens[i] != NULL; i++)
+    {
+      if (*tokens[i] != '\0')
+        tokens[n_tokens++] = tokens[i];
+      else
+        g_free (tokens[i]);
+    }
+  tokens[n_tokens] = NULL;
+
+  if (n_tokens == 0)
+    goto finish;
+
+  if (g_strcmp0 (tokens[0], "center") == 0)
+    n_values = 3;
+  else if (g_strcmp0 (tokens[0], "bbox") == 0)
+    n_values = 4;
+  else
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+          "Line %u: unknown job type %s", line_number, tokens[0]);
+      goto finish;
+    }
+
+  if (n_tokens < n_values + 1)
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+          "Line %u: %u values expected", line_number, n_values);
+      goto finish;
+    }
+
+  for (i = 0; i < n_values; i++)
+    values[i] = g_ascii_strtod (tokens[i + 1], NULL);
+
+  job->use_bbox = n_values == 4;
+  if (job->use_bbox)
+    {
+      job->bbox.top = values[0];
+      job->bbox.left = values[1];
+      job->bbox.bottom = values[2];
+      job->bbox.right = values[3];
+    }
+  else
+    {
+      job->latitude = values[0];
+      job->longitude = values[1];
+      job->zoom_level = values[2];
+    }
+
+  if (n_tokens > n_values + 1)
+    job->name = g_strdup (tokens[n_values + 1]);
+  else
+    job->name = g_strdup_printf ("map-%04u", jobs->len);
+
+  success = TRUE;
+
+finish:
+  g_strfreev (tokens);
+  return success;
+}
+
+
+static gboolean
+load_jobs (const gchar *filename,
+    GError **error)
+{
+  gchar *contents;
+  gchar **lines;
+  guint i;
+
+  if (!g_file_get_contents (filename, &contents, NULL, error))
+    return FALSE;
+
+  lines = g_strsplit (contents, "\n", -1);
+  g_free (contents);
+
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      Job *job;
+
+      if (*g_strstrip (lines[i]) == '\0' || lines[i][0] == '#')
+        continue;
+
+      job = g_slice_new0 (Job);
+      if (!parse_job (lines[i], i + 1, job, error))
+        {
+          g_slice_free (Job, job);
+          g_strfreev (lines);
+          return FALSE;
+        }
+
+      g_ptr_array_add (jobs, job);
+    }
+
+  g_strfreev (lines);
+  return TRUE;
+}
+
+
+static void
+report (void)
+{
+  gdouble elapsed = g_timer_elapsed (timer, NULL);
+
+  g_print ("%d images (%d failed) in %.2f s: %.2f images/s\n",
+      written, failed, elapsed, elapsed > 0 ? written / elapsed : 0.0);
+}
+
+
+static void
+check_finished (void)
+{
+  if (rendering == 0 && writing == 0 && next_job == jobs->len)
+    {
+      report ();
+      clutter_main_quit ();
+    }
+}
+
+
+static gboolean
+write_done_cb (G_GNUC_UNUSED gpointer data)
+{
+  writing--;
+  check_finished ();
+
+  return FALSE;
+}
+
+
+/* Runs in the writer threads; PNG compression is the most expensive
+   part of the job once the tiles are cached */
+static void
+write_png (WriteTask *task,
+    G_GNUC_UNUSED gpointer user_data)
+{
+  if (cairo_surface_write_to_png (task->surface, task->filename) == CAIRO_STATUS_SUCCESS)
+    g_atomic_int_inc (&written);
+  else
+    {
+      g_printerr ("Unable to write %s\n", task->filename);
+      g_atomic_int_inc (&failed);
+    }
+
+  cairo_surface_destroy (task->surface);
+  g_free (task->filename);
+  g_slice_free (WriteTask, task);
+
+  g_idle_add (write_done_cb, NULL);
+}
+
+
+static void start_jobs (void);
+
+
+static void
+render_cb (GObject *object,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  ChamplainStaticMap *map = CHAMPLAIN_STATIC_MAP (object);
+  Job *job = user_data;
+  cairo_surface_t *surface;
+  GError *error = NULL;
+
+  surface = champlain_static_map_render_finish (map, result, &error);
+  if (surface)
+    {
+      WriteTask *task = g_slice_new (WriteTask);
+      gchar *basename = g_strconcat (job->name, ".png", NULL);
+
+      task->surface = surface;
+      task->filename = g_build_filename (output_dir, basename, NULL);
+      g_free (basename);
+
+      writing++;
+      g_thread_pool_push (writers, task, NULL);
+    }
+  else
+    {
+      g_printerr ("Unable to render %s: %s\n", job->name, error->message);
+      g_error_free (error);
+      g_atomic_int_inc (&failed);
+    }
+
+  g_object_unref (map);
+  rendering--;
+
+  start_jobs ();
+  check_finished ();
+}
+
+
+static void
+start_jobs (void)
+{
+  while (rendering < (guint) parallel && next_job < jobs->len)
+    {
+      Job *job = g_ptr_array_index (jobs, next_job++);
+      ChamplainStaticMap *map;
+
+      map = champlain_static_map_new (map_source, width, height);
+      if (job->use_bbox)
+        champlain_static_map_ensure_visible (map, &job->bbox);
+      else
+        champlain_static_map_center_on (map, job->latitude, job->longitude, job->zoom_level);
+
+      rendering++;
+      champlain_static_map_render_async (map, NULL, render_cb, job);
+    }
+}
+
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *context;
+  GError *error = NULL;
+
+  if (!g_thread_supported ())
+    g_thread_init (NULL);
+
+  context = g_option_context_new ("JOB-FILE - render static maps");
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, clutter_get_option_group_without_init ());
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free (context);
+
+  if (argc != 2 || parallel < 1 || width < 1 || height < 1)
+    {
+      g_printerr ("Usage: %s [OPTION...] JOB-FILE\n", argv[0]);
+      return 1;
+    }
+
+  if (clutter_init (&argc, &argv) != CLUTTER_INIT_SUCCESS)
+    return 1;
+
+  jobs = g_ptr_array_new ();
+  if (!load_jobs (argv[1], &error) ||
+      !(map_source = create_map_source (&error)))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  if (jobs->len == 0)
+    return 0;
+
+  writers = g_thread_pool_new ((GFunc) write_png, NULL, parallel, FALSE, NULL);
+  timer = g_timer_new ();
+
+  start_jobs ();
+  clutter_main ();
+
+  g_thread_pool_free (writers, FALSE, TRUE);
+  g_timer_destroy (timer);
+  g_object_unref (map_source);
+
+  return failed > 0 ? 2 : 0;
+}
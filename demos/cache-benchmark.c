@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors (see AUTHORS)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Replays a trace of tile requests against ChamplainMemoryCache with every
+ * eviction policy and prints the hit rates.
+ *
+ * Every line of the trace file is one tile request:
+ *
+ *   ZOOM X Y
+ *
+ * Empty lines and lines starting with '#' are ignored. Without a trace file
+ * a patrol-style trace is generated: the view alternates between two hot
+ * spots (home and depot) and pans along a random route between the visits,
+ * requesting the tiles entering the viewport as ChamplainView does. The
+ * generated trace can be saved with --save-trace.
+ */
+
+#include <champlain/champlain.h>
+#include <gdk/gdk.h>
+#include <stdio.h>
+
+#define TILE_SIZE 256
+
+typedef struct
+{
+  guint zoom_level;
+  guint x;
+  guint y;
+} Request;
+
+static gint cache_size = 100;
+static gint columns = 5;
+static gint rows = 4;
+static gint rounds = 50;
+static gint route_length = 40;
+static gint zoom_level = 15;
+static gint seed = 1;
+static gchar *save_trace = NULL;
+
+static GOptionEntry entries[] =
+{
+  { "size", 's', 0, G_OPTION_ARG_INT, &cache_size, "Memory cache size in tiles", "N" },
+  { "columns", 'c', 0, G_OPTION_ARG_INT, &columns, "Viewport width in tiles", "N" },
+  { "rows", 'r', 0, G_OPTION_ARG_INT, &rows, "Viewport height in tiles", "N" },
+  { "rounds", 'n', 0, G_OPTION_ARG_INT, &rounds, "Number of patrols in the generated trace", "N" },
+  { "route-length", 'l', 0, G_OPTION_ARG_INT, &route_length, "Length of a patrol in tiles", "N" },
+  { "zoom", 'z', 0, G_OPTION_ARG_INT, &zoom_level, "Zoom level of the generated trace", "ZOOM" },
+  { "seed", 0, 0, G_OPTION_ARG_INT, &seed, "Random seed of the generated trace", "N" },
+  { "save-trace", 0, 0, G_OPTION_ARG_FILENAME, &save_trace, "Write the generated trace to a file", "FILE" },
+  { NULL }
+};
+
+
+static void
+add_request (GArray *trace,
+    guint x,
+    guint y)
+{
+  Request request = { zoom_level, x, y };
+
+  g_array_append_val (trace, request);
+}
+
+
+/* Requests the tiles of the viewport at x, y which weren't visible in the
+ * viewport at old_x, old_y */
+static void
+move_viewport (GArray *trace,
+    gint old_x,
+    gint old_y,
+    gint x,
+    gint y)
+{
+  gint i, j;
+
+  for (j = y; j < y + rows; j++)
+    for (i = x; i < x + columns; i++)
+      {
+        if (i >= old_x && i < old_x + columns && j >= old_y && j < old_y + rows)
+          continue;
+
+        add_request (trace, i, j);
+      }
+}
+
+
+static GArray *
+generate_trace (void)
+{
+  GArray *trace = g_array_new (FALSE, FALSE, sizeof (Request));
+  GRand *rand = g_rand_new_with_seed (seed);
+  gint origin = 1 << (zoom_level - 1);
+  gint spots[2][2] = {
+    { origin, origin },
+    { origin + 3 * columns, origin + 2 * rows }
+  };
+  gint x = G_MININT / 2, y = G_MININT / 2;
+  gint round, step;
+
+  for (round = 0; round < rounds; round++)
+    {
+      gint *spot = spots[round % 2];
+      gint dx, dy;
+
+      /* Jump to the hot spot */
+      move_viewport (trace, x, y, spot[0], spot[1]);
+      x = spot[0];
+      y = spot[1];
+
+      /* and patrol in a random direction */
+      do
+        {
+          dx = g_rand_int_range (rand, -1, 2);
+          dy = g_rand_int_range (rand, -1, 2);
+        }
+      while (dx == 0 && dy == 0);
+
+      for (step = 0; step < route_length; step++)
+        {
+          move_viewport (trace, x, y, x + dx, y + dy);
+          x += dx;
+          y += dy;
+        }
+    }
+
+  g_rand_free (rand);
+
+  return trace;
+}
+
+
+static GArray *
+load_trace (const gchar *filename,
+    GError **error)
+{
+  GArray *trace;
+  gchar *contents;
+  gchar **lines;
+  gint i;
+
+  if (!g_file_get_contents (filename, &contents, NULL, error))
+    return NULL;
+
+  trace = g_array_new (FALSE, FALSE, sizeof (Request));
+  lines = g_strsplit (contents, "\n", -1);
+  g_free (contents);
+
+  for (i = 0; lines[i]; i++)
+    {
+      gchar *line = g_strstrip (lines[i]);
+      Request request;
+
+      if (line[0] == '\0' || line[0] == '#')
+        continue;
+
+      if (sscanf (line, "%u %u %u", &request.zoom_level, &request.x, &request.y) != 3)
+        {
+          g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+              "%s:%d: expected ZOOM X Y", filename, i + 1);
+          g_array_free (trace, TRUE);
+          trace = NULL;
+          break;
+        }
+
+      g_array_append_val (trace, request);
+    }
+
+  g_strfreev (lines);
+
+  return trace;
+}
+
+
+static gboolean
+write_trace (GArray *trace,
+    const gchar *filename,
+    GError **error)
+{
+  GString *contents = g_string_new ("# ZOOM X Y\n");
+  gboolean success;
+  guint i;
+
+  for (i = 0; i < trace->len; i++)
+    {
+      Request *request = &g_array_index (trace, Request, i);
+
+      g_string_append_printf (contents, "%u %u %u\n",
+          request->zoom_level, request->x, request->y);
+    }
+
+  success = g_file_set_contents (filename, contents->str, contents->len, error);
+  g_string_free (contents, TRUE);
+
+  return success;
+}
+
+
+static void
+run_trace (GArray *trace,
+    ChamplainEvictionPolicy policy,
+    const gchar *policy_name,
+    const gchar *data,
+    gsize size)
+{
+  ChamplainMapSourceFactory *factory;
+  ChamplainMemoryCache *memory_cache;
+  ChamplainMapSource *error_source;
+  ChamplainRenderer *renderer;
+  guint hits, misses, evictions;
+  GTimer *timer;
+  guint i;
+
+  factory = champlain_map_source_factory_dup_default ();
+  error_source = champlain_map_source_factory_create_error_source (factory, TILE_SIZE);
+  g_object_unref (factory);
+
+  renderer = CHAMPLAIN_RENDERER (champlain_image_renderer_new ());
+  memory_cache = champlain_memory_cache_new_full (cache_size, renderer);
+  g_object_ref_sink (memory_cache);
+  champlain_memory_cache_set_eviction_policy (memory_cache, policy);
+  champlain_map_source_set_next_source (CHAMPLAIN_MAP_SOURCE (memory_cache), error_source);
+
+  timer = g_timer_new ();
+
+  for (i = 0; i < trace->len; i++)
+    {
+      Request *request = &g_array_index (trace, Request, i);
+      ChamplainTile *tile;
+      guint hits_before;
+
+      tile = champlain_tile_new_full (request->x, request->y, TILE_SIZE, request->zoom_level);
+      g_object_ref_sink (tile);
+
+      champlain_memory_cache_get_stats (memory_cache, &hits_before, NULL, NULL);
+      champlain_map_source_fill_tile (CHAMPLAIN_MAP_SOURCE (memory_cache), tile);
+      champlain_memory_cache_get_stats (memory_cache, &hits, NULL, NULL);
+
+      /* A miss - pretend the tile was downloaded */
+      if (hits == hits_before)
+        champlain_tile_cache_store_tile (CHAMPLAIN_TILE_CACHE (memory_cache), tile, data, size);
+
+      g_object_unref (tile);
+    }
+
+  champlain_memory_cache_get_stats (memory_cache, &hits, &misses, &evictions);
+  g_print ("%-4s  hits %7u  misses %7u  evictions %7u  hit rate %5.1f %%  (%.2f s)\n",
+      policy_name, hits, misses, evictions,
+      hits + misses > 0 ? 100.0 * hits / (hits + misses) : 0.0,
+      g_timer_elapsed (timer, NULL));
+
+  g_timer_destroy (timer);
+  g_object_unref (memory_cache);
+}
+
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  GdkPixbuf *pixbuf;
+  GArray *trace;
+  gchar *data;
+  gsize size;
+
+  context = g_option_context_new ("[TRACE-FILE] - compare memory cache eviction policies");
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, clutter_get_option_group_without_init ());
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free (context);
+
+  if (cache_size < 1 || columns < 1 || rows < 1 || zoom_level < 1 || zoom_level > 20)
+    {
+      g_printerr ("Invalid arguments\n");
+      return 1;
+    }
+
+  if (clutter_init (&argc, &argv) != CLUTTER_INIT_SUCCESS)
+    return 1;
+
+  if (argc > 1)
+    trace = load_trace (argv[1], &error);
+  else
+    trace = generate_trace ();
+
+  if (!trace)
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  if (save_trace && !write_trace (trace, save_trace, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  /* All the tiles share the same image, only the hit rates matter */
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, TILE_SIZE, TILE_SIZE);
+  gdk_pixbuf_fill (pixbuf, 0xaad3dfff);
+  if (!gdk_pixbuf_save_to_buffer (pixbuf, &data, &size, "png", &error, NULL))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+  g_object_unref (pixbuf);
+
+  g_print ("%u requests, cache size %d tiles\n", trace->len, cache_size);
+  run_trace (trace, CHAMPLAIN_EVICTION_POLICY_LRU, "LRU", data, size);
+  run_trace (trace, CHAMPLAIN_EVICTION_POLICY_2Q, "2Q", data, size);
+
+  g_free (data);
+  g_array_free (trace, TRUE);
+
+  return 0;
+}